@@ -0,0 +1,341 @@
+#include "accesslog.h"
+#include "lfqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define WRITER_PERIOD_MS 100   //the writer drains the rings this often
+#define WRITE_BATCH (64 << 10) //formatted lines are written in batches of this size
+#define LOG_LINE_MAX (ACCESSLOG_LINE_MAX * 4 + 128)
+
+/**
+ * one request, copied into the ring as is and formatted by the writer
+ */
+typedef struct access_record_st
+{
+	time_t when;				   //wall clock second the response was built
+	struct in_addr addr;		   //client address
+	int status;
+	unsigned long bytes;		   //response size, headers included
+	unsigned long duration_us;	   //time to build the response
+	unsigned short line_len;
+	char line[ACCESSLOG_LINE_MAX]; //request line, not terminated
+} access_record;
+
+/**
+ * the records of one thread: the thread writes at tail, the writer reads at head
+ */
+typedef struct log_ring_st
+{
+	_Alignas(CACHE_LINE) atomic_ulong head; //next record the writer formats
+	_Alignas(CACHE_LINE) atomic_ulong tail; //next record the owner fills
+	atomic_ulong dropped;					//records lost to a full ring
+	atomic_int in_use;						//1 while a thread owns the ring
+	struct log_ring_st *next;				//list of all rings
+	access_record records[ACCESSLOG_RING];
+} log_ring;
+
+int accesslog_enabled;
+static char *log_path;
+static int log_fd = -1;
+static pthread_t writer;
+static atomic_int stopping;
+static volatile sig_atomic_t reopen_requested;
+static _Atomic(log_ring *) all_rings;
+static pthread_key_t ring_key;
+static __thread log_ring *local_ring;
+static unsigned long written;	   //records written, by the writer thread
+static unsigned long dropped_seen; //drops already reported in the log
+static unsigned long dropped_total; //drops of the rings freed by accesslog_close
+
+// the thread owning a ring exited, the next new thread may take it over
+static void release_ring(void *arg)
+{
+    atomic_store(&((log_ring *)arg)->in_use, 0);
+}
+
+// the ring of the calling thread: a ring released by an exited thread, or a new one
+static log_ring *ring(void)
+{
+    if (local_ring)
+        return local_ring;
+    log_ring *r;
+    for (r = atomic_load(&all_rings); r; r = r->next)
+    {
+        int unused = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &unused, 1))
+            break;
+    }
+    if (!r)
+    {
+        r = (log_ring *)aligned_alloc(CACHE_LINE, (sizeof(log_ring) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+        if (!r)
+            return NULL;
+        atomic_init(&r->head, 0);
+        atomic_init(&r->tail, 0);
+        atomic_init(&r->dropped, 0);
+        atomic_init(&r->in_use, 1);
+        // rings are only added, the writer walks the list without a lock
+        r->next = atomic_load(&all_rings);
+        while (!atomic_compare_exchange_weak(&all_rings, &r->next, r))
+            ;
+    }
+    pthread_setspecific(ring_key, r);
+    local_ring = r;
+    return r;
+}
+
+unsigned long accesslog_clock(void)
+{
+    if (!accesslog_enabled)
+        return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void accesslog_add(const struct sockaddr_in *peer, const char *line, size_t line_len, int status, unsigned long bytes, unsigned long start)
+{
+    log_ring *r;
+    if (!accesslog_enabled || !(r = ring()))
+        return;
+    unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&r->head, memory_order_acquire) == ACCESSLOG_RING)
+    {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    access_record *rec = &r->records[tail % ACCESSLOG_RING];
+    rec->when = time(NULL);
+    rec->addr = peer->sin_addr;
+    rec->status = status;
+    rec->bytes = bytes;
+    rec->duration_us = start ? (accesslog_clock() - start) / 1000 : 0;
+    rec->line_len = line_len < ACCESSLOG_LINE_MAX ? line_len : ACCESSLOG_LINE_MAX;
+    memcpy(rec->line, line, rec->line_len);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+// write the whole batch, a failing log loses the batch but never stops the writer
+static void write_batch(const char *buf, size_t len)
+{
+    while (len > 0 && log_fd >= 0)
+    {
+        ssize_t writed = write(log_fd, buf, len);
+        if (writed < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: write access log failed");
+            return;
+        }
+        buf += writed;
+        len -= writed;
+    }
+}
+
+static int open_log(void)
+{
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        perror("ERROR: open access log failed");
+    return fd;
+}
+
+// format one record in common log format with the duration appended, returns its length
+static size_t format_record(const access_record *rec, char *out, struct tm *tm, time_t *tm_second)
+{
+    // most records of a batch share their second
+    if (rec->when != *tm_second)
+    {
+        gmtime_r(&rec->when, tm);
+        *tm_second = rec->when;
+    }
+    char addr[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &rec->addr, addr, sizeof(addr)))
+        strcpy(addr, "-");
+    size_t len = snprintf(out, LOG_LINE_MAX, "%s - - [", addr);
+    len += strftime(&out[len], LOG_LINE_MAX - len, "%d/%b/%Y:%H:%M:%S +0000", tm);
+    out[len++] = ']';
+    out[len++] = ' ';
+    out[len++] = '"';
+    // the request line comes from the client, quotes and control bytes are escaped
+    for (int i = 0; i < rec->line_len; i++)
+    {
+        unsigned char c = rec->line[i];
+        if (c == '"' || c == '\\')
+        {
+            out[len++] = '\\';
+            out[len++] = c;
+        }
+        else if (c < 0x20 || c >= 0x7f)
+            len += sprintf(&out[len], "\\x%02x", c);
+        else
+            out[len++] = c;
+    }
+    len += snprintf(&out[len], LOG_LINE_MAX - len, "\" %d %lu %luus\n", rec->status, rec->bytes, rec->duration_us);
+    return len;
+}
+
+// drain every ring into the log, returns the number of records written
+static unsigned long drain(char *buf)
+{
+    size_t used = 0;
+    unsigned long count = 0;
+    unsigned long dropped = 0;
+    struct tm tm;
+    time_t tm_second = -1;
+    for (log_ring *r = atomic_load(&all_rings); r; r = r->next)
+    {
+        unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        unsigned long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            if (used + LOG_LINE_MAX > WRITE_BATCH)
+            {
+                write_batch(buf, used);
+                used = 0;
+            }
+            used += format_record(&r->records[head % ACCESSLOG_RING], &buf[used], &tm, &tm_second);
+            count++;
+            // give the slot back at once, the owner drops records while its ring is full
+            atomic_store_explicit(&r->head, head + 1, memory_order_release);
+        }
+        dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+    // losses are written into the log itself, so a reader knows it is incomplete
+    if (dropped > dropped_seen)
+    {
+        if (used + LOG_LINE_MAX > WRITE_BATCH)
+        {
+            write_batch(buf, used);
+            used = 0;
+        }
+        used += snprintf(&buf[used], LOG_LINE_MAX, "# %lu records dropped, the log writer fell behind\n", dropped - dropped_seen);
+        dropped_seen = dropped;
+    }
+    write_batch(buf, used);
+    return count;
+}
+
+static void request_reopen(int sig)
+{
+    (void)sig;
+    reopen_requested = 1;
+}
+
+static void *writer_thread(void *arg)
+{
+    char *buf = (char *)arg;
+    // SIGHUP is taken here only, it cuts the sleep short
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_UNBLOCK, &hup, NULL);
+    struct timespec period = {0, WRITER_PERIOD_MS * 1000000L};
+    while (!atomic_load(&stopping))
+    {
+        nanosleep(&period, NULL);
+        if (reopen_requested)
+        {
+            reopen_requested = 0;
+            // records up to the rotation go to the old file
+            written += drain(buf);
+            int fd = open_log();
+            if (fd >= 0)
+            {
+                close(log_fd);
+                log_fd = fd;
+            }
+        }
+        written += drain(buf);
+    }
+    // records added before the threads exited
+    written += drain(buf);
+    free(buf);
+    return NULL;
+}
+
+int accesslog_open(const char *path)
+{
+    log_path = strdup(path);
+    char *buf = (char *)malloc(WRITE_BATCH);
+    if (!log_path || !buf || pthread_key_create(&ring_key, release_ring))
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(log_path);
+        free(buf);
+        return -1;
+    }
+    log_fd = open_log();
+    if (log_fd < 0)
+    {
+        pthread_key_delete(ring_key);
+        free(log_path);
+        free(buf);
+        return -1;
+    }
+    // threads created from here on (all of them) leave SIGHUP to the writer
+    sigset_t hup;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hup, NULL);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_reopen;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+    accesslog_enabled = 1;
+    if (pthread_create(&writer, NULL, writer_thread, buf))
+    {
+        perror("ERROR: THREAD_CREATE_FAILED");
+        accesslog_enabled = 0;
+        close(log_fd);
+        log_fd = -1;
+        pthread_key_delete(ring_key);
+        free(log_path);
+        free(buf);
+        return -1;
+    }
+    return 0;
+}
+
+void accesslog_counts(unsigned long *written_out, unsigned long *dropped_out)
+{
+    *written_out = written;
+    *dropped_out = dropped_total;
+    for (log_ring *r = atomic_load(&all_rings); r; r = r->next)
+        *dropped_out += atomic_load(&r->dropped);
+}
+
+void accesslog_close(void)
+{
+    if (!accesslog_enabled)
+        return;
+    // the writer notices within one period and drains the rings a last time
+    atomic_store(&stopping, 1);
+    pthread_join(writer, NULL);
+    accesslog_enabled = 0;
+    close(log_fd);
+    log_fd = -1;
+    log_ring *r = atomic_exchange(&all_rings, NULL);
+    while (r)
+    {
+        log_ring *next = r->next;
+        dropped_total += atomic_load(&r->dropped);
+        free(r);
+        r = next;
+    }
+    local_ring = NULL;
+    pthread_key_delete(ring_key);
+    free(log_path);
+    log_path = NULL;
+}
@@ -0,0 +1,58 @@
+#include <stddef.h>
+#include <netinet/in.h>
+
+/**
+ * accesslog.h
+ *
+ * This file declares the access log. request threads never write the log
+ * themselves: every thread appends fixed-size binary records to its own
+ * single-producer ring, a writer thread drains all rings, formats the
+ * records and writes them out in large batches. a full ring drops the
+ * record and counts it instead of blocking the request.
+ * SIGHUP makes the writer reopen the log file (after it was rotated).
+ */
+
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+// records each thread's ring holds until the writer drains them
+#define ACCESSLOG_RING 1024
+
+// bytes of the request line a record keeps
+#define ACCESSLOG_LINE_MAX 128
+
+// 1 once accesslog_open succeeded
+extern int accesslog_enabled;
+
+/**
+ * accesslog_open appends the log to path and starts the writer thread.
+ * SIGHUP is blocked in the calling thread, so it must be called before any
+ * other thread is created: they all inherit the mask and the signal is
+ * only taken by the writer. returns -1 on failure.
+ */
+int accesslog_open(const char *path);
+
+/**
+ * accesslog_clock returns the monotonic time in nanoseconds, 0 while the log is disabled
+ */
+unsigned long accesslog_clock(void);
+
+/**
+ * accesslog_add records a request of client peer: its request line (line_len bytes,
+ * cut to ACCESSLOG_LINE_MAX), the response status and size, and the time since
+ * start (an accesslog_clock value). never blocks, the record is dropped if the ring is full.
+ */
+void accesslog_add(const struct sockaddr_in *peer, const char *line, size_t line_len, int status, unsigned long bytes, unsigned long start);
+
+/**
+ * accesslog_counts returns the records written and dropped so far
+ */
+void accesslog_counts(unsigned long *written, unsigned long *dropped);
+
+/**
+ * accesslog_close writes what the rings still hold, stops the writer and closes the file.
+ * every thread adding records must have exited.
+ */
+void accesslog_close(void);
+
+#endif
@@ -0,0 +1,76 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#define ARENA_ALIGN 16
+
+void arena_init(arena_t *a, char *base, size_t size)
+{
+    a->base = base;
+    a->size = size;
+    a->used = 0;
+    a->extra = NULL;
+}
+
+void *arena_alloc(arena_t *a, size_t len)
+{
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (start + len <= a->size)
+    {
+        a->used = start + len;
+        return &a->base[start];
+    }
+    // the block is full, this allocation gets its own
+    arena_block *block = (arena_block *)malloc(sizeof(arena_block) + len);
+    if (!block)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    block->next = a->extra;
+    a->extra = block;
+    return block->data;
+}
+
+char *arena_printf(arena_t *a, size_t *len, const char *format, ...)
+{
+    va_list args;
+    // try the free tail of the block first, most strings fit
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t room = start < a->size ? a->size - start : 0;
+    va_start(args, format);
+    int needed = vsnprintf(room ? &a->base[start] : NULL, room, format, args);
+    va_end(args);
+    if (needed < 0)
+        return NULL;
+    char *str;
+    if ((size_t)needed < room)
+    {
+        str = &a->base[start];
+        a->used = start + needed + 1;
+    }
+    else
+    {
+        str = (char *)arena_alloc(a, needed + 1);
+        if (!str)
+            return NULL;
+        va_start(args, format);
+        vsnprintf(str, needed + 1, format, args);
+        va_end(args);
+    }
+    if (len)
+        *len = needed;
+    return str;
+}
+
+void arena_reset(arena_t *a)
+{
+    while (a->extra)
+    {
+        arena_block *next = a->extra->next;
+        free(a->extra);
+        a->extra = next;
+    }
+    a->used = 0;
+}
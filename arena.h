@@ -0,0 +1,55 @@
+#include <stddef.h>
+
+/**
+ * arena.h
+ *
+ * This file declares the bump allocator a connection builds its
+ * responses in. per-request scratch (paths, header lines, dates) is
+ * carved out of one preallocated block and dropped all at once with
+ * arena_reset after the responses were written. requests that outgrow
+ * the block get extra heap blocks, freed on the next reset.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * heap block used when the preallocated block is full
+ */
+typedef struct arena_block_st
+{
+	struct arena_block_st *next;
+	char data[];
+} arena_block;
+
+typedef struct arena_st
+{
+	char *base;			//preallocated block
+	size_t size;		//bytes in base
+	size_t used;		//bytes of base handed out
+	arena_block *extra; //overflow blocks, freed on reset
+} arena_t;
+
+/**
+ * arena_init makes an arena over the size bytes at base (owned by the caller)
+ */
+void arena_init(arena_t *a, char *base, size_t size);
+
+/**
+ * arena_alloc returns len bytes aligned for any type, NULL on memory failure.
+ * the memory stays valid until arena_reset.
+ */
+void *arena_alloc(arena_t *a, size_t len);
+
+/**
+ * arena_printf formats into the arena, *len (if not NULL) receives the string length.
+ * returns NULL on memory failure.
+ */
+char *arena_printf(arena_t *a, size_t *len, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * arena_reset drops everything allocated since the last reset
+ */
+void arena_reset(arena_t *a);
+
+#endif
@@ -0,0 +1,279 @@
+#include "compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+#define GZIP_WINDOW_BITS (15 + 16) //deflate with a gzip header and trailer
+#define GZIP_LEVEL_BEST 9
+#define GZIP_LEVEL_FAST 5
+#define BROTLI_QUALITY_BEST 9
+#define BROTLI_QUALITY_FAST 4
+#define STREAM_BUFF_SIZE 16384
+
+static const char *encoding_names[ENC_COUNT] = {"gzip", "br"};
+static const char *encoding_suffixes[ENC_COUNT] = {".gz", ".br"};
+
+// text types besides text/*
+static const char *compressible_types[] = {
+    "application/javascript", "application/json", "application/xml", "image/svg+xml"};
+
+const char *encoding_name(int enc)
+{
+    return encoding_names[enc];
+}
+
+const char *encoding_suffix(int enc)
+{
+    return encoding_suffixes[enc];
+}
+
+int compressible_type(const char *content_type)
+{
+    if (!content_type)
+        return 0;
+    if (strncmp(content_type, "text/", 5) == 0)
+        return 1;
+    for (size_t i = 0; i < sizeof(compressible_types) / sizeof(compressible_types[0]); i++)
+        if (strcmp(content_type, compressible_types[i]) == 0)
+            return 1;
+    return 0;
+}
+
+// q-value of a ";q=" parameter in [p, end), 1000 for q=1
+static int parse_qvalue(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+        p++;
+    if (end - p < 2 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=')
+        return 1000;
+    p += 2;
+    int q = 0;
+    int digits = 0;
+    if (p < end && *p == '1')
+        return 1000;
+    if (p < end && *p == '0')
+        p++;
+    if (p < end && *p == '.')
+        p++;
+    while (p < end && *p >= '0' && *p <= '9' && digits < 3)
+    {
+        q = q * 10 + (*p++ - '0');
+        digits++;
+    }
+    while (digits++ < 3)
+        q *= 10;
+    return q;
+}
+
+int accepted_encoding(const http_request *hr, const char *buff)
+{
+    const http_header *h = http_find_header(hr, buff, "Accept-Encoding");
+    if (!h)
+        return ENC_NONE;
+    // -1 - not listed
+    int q[ENC_COUNT] = {-1, -1};
+    int q_any = -1;
+    const char *p = &buff[h->value.off];
+    const char *end = p + h->value.len;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *token = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        size_t token_len = p - token;
+        const char *params = p;
+        while (p < end && *p != ',')
+            p++;
+        int value = parse_qvalue(params, p);
+        if ((token_len == 4 && strncasecmp(token, "gzip", 4) == 0) || (token_len == 6 && strncasecmp(token, "x-gzip", 6) == 0))
+            q[ENC_GZIP] = value;
+        else if (token_len == 2 && strncasecmp(token, "br", 2) == 0)
+            q[ENC_BR] = value;
+        else if (token_len == 1 && token[0] == '*')
+            q_any = value;
+    }
+    int best = ENC_NONE;
+    int best_q = 0;
+    // brotli is checked first so it wins a tie
+    for (int enc = ENC_COUNT - 1; enc >= 0; enc--)
+    {
+        int value = q[enc] >= 0 ? q[enc] : q_any;
+        if (value > best_q)
+        {
+            best = enc;
+            best_q = value;
+        }
+    }
+    return best;
+}
+
+static char *gzip_buffer(const char *data, size_t len, size_t *out_len)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZIP_LEVEL_BEST, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    size_t bound = deflateBound(&zs, len);
+    char *out = (char *)malloc(bound);
+    if (!out)
+    {
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = bound;
+    int result = deflate(&zs, Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    if (result != Z_STREAM_END)
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static char *brotli_buffer(const char *data, size_t len, size_t *out_len)
+{
+    size_t bound = BrotliEncoderMaxCompressedSize(len);
+    char *out = (char *)malloc(bound ? bound : 1);
+    if (!out)
+        return NULL;
+    *out_len = bound;
+    if (!bound || !BrotliEncoderCompress(BROTLI_QUALITY_BEST, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, (const uint8_t *)data,
+                                         out_len, (uint8_t *)out))
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+char *compress_buffer(int enc, const char *data, size_t len, size_t *out_len)
+{
+    char *out = enc == ENC_GZIP ? gzip_buffer(data, len, out_len) : brotli_buffer(data, len, out_len);
+    if (!out)
+        perror("ERROR: compression failed");
+    return out;
+}
+
+struct compress_stream_st
+{
+    int enc;
+    z_stream zs;			  //ENC_GZIP
+    BrotliEncoderState *br; //ENC_BR
+};
+
+compress_stream *compress_stream_open(int enc)
+{
+    compress_stream *s = (compress_stream *)calloc(1, sizeof(compress_stream));
+    if (!s)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    s->enc = enc;
+    if (enc == ENC_GZIP)
+    {
+        if (deflateInit2(&s->zs, GZIP_LEVEL_FAST, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+            return s;
+    }
+    else if ((s->br = BrotliEncoderCreateInstance(NULL, NULL, NULL)))
+    {
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_QUALITY, BROTLI_QUALITY_FAST);
+        BrotliEncoderSetParameter(s->br, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+        return s;
+    }
+    perror("ERROR: compression failed");
+    free(s);
+    return NULL;
+}
+
+static int gzip_write(z_stream *zs, chunk_buf_t *in, int finish, chunk_buf_t *out)
+{
+    char buff[STREAM_BUFF_SIZE];
+    chunk_t *chunk = in->head;
+    while (1)
+    {
+        if (zs->avail_in == 0 && chunk)
+        {
+            zs->next_in = (Bytef *)chunk->data;
+            zs->avail_in = chunk->len;
+            chunk = chunk->next;
+        }
+        zs->next_out = (Bytef *)buff;
+        zs->avail_out = sizeof(buff);
+        int flush = chunk || zs->avail_in ? Z_NO_FLUSH : finish ? Z_FINISH : Z_SYNC_FLUSH;
+        int result = deflate(zs, flush);
+        if (result == Z_STREAM_ERROR || chunkbuf_append(out, buff, sizeof(buff) - zs->avail_out) < 0)
+            return -1;
+        if (result == Z_STREAM_END)
+            return 0;
+        // a sync flush is complete once it left room in the buffer
+        if (flush == Z_SYNC_FLUSH && zs->avail_out != 0)
+            return 0;
+    }
+}
+
+static int brotli_write(BrotliEncoderState *br, chunk_buf_t *in, int finish, chunk_buf_t *out)
+{
+    uint8_t buff[STREAM_BUFF_SIZE];
+    chunk_t *chunk = in->head;
+    size_t avail_in = 0;
+    const uint8_t *next_in = NULL;
+    while (1)
+    {
+        if (avail_in == 0 && chunk)
+        {
+            next_in = (const uint8_t *)chunk->data;
+            avail_in = chunk->len;
+            chunk = chunk->next;
+        }
+        size_t avail_out = sizeof(buff);
+        uint8_t *next_out = buff;
+        BrotliEncoderOperation op = chunk || avail_in ? BROTLI_OPERATION_PROCESS : finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_FLUSH;
+        if (!BrotliEncoderCompressStream(br, op, &avail_in, &next_in, &avail_out, &next_out, NULL) ||
+            chunkbuf_append(out, (const char *)buff, sizeof(buff) - avail_out) < 0)
+            return -1;
+        if (op == BROTLI_OPERATION_FINISH && BrotliEncoderIsFinished(br))
+            return 0;
+        if (op == BROTLI_OPERATION_FLUSH && !BrotliEncoderHasMoreOutput(br))
+            return 0;
+    }
+}
+
+int compress_stream_write(compress_stream *s, chunk_buf_t *in, int finish, chunk_buf_t *out)
+{
+    int result = s->enc == ENC_GZIP ? gzip_write(&s->zs, in, finish, out) : brotli_write(s->br, in, finish, out);
+    if (result < 0)
+        perror("ERROR: compression failed");
+    return result;
+}
+
+void compress_stream_close(compress_stream *s)
+{
+    if (s->enc == ENC_GZIP)
+        deflateEnd(&s->zs);
+    else
+        BrotliEncoderDestroyInstance(s->br);
+    free(s);
+}
+
+int compress_chunks(int enc, chunk_buf_t *in, chunk_buf_t *out)
+{
+    compress_stream *s = compress_stream_open(enc);
+    if (!s)
+        return -1;
+    int result = compress_stream_write(s, in, 1, out);
+    compress_stream_close(s);
+    if (result < 0)
+        chunkbuf_free(out);
+    return result;
+}
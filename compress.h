@@ -0,0 +1,82 @@
+#include <stddef.h>
+#include "http_parser.h"
+#include "response.h"
+
+/**
+ * compress.h
+ *
+ * This file declares the content encodings the server can send: the
+ * Accept-Encoding negotiation, the mime types worth compressing and gzip
+ * (zlib) / brotli compression of a buffer, of a chunked buffer or of
+ * content generated piece by piece.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// content encodings, also the index of an encoded variant of a cached file
+#define ENC_NONE -1
+#define ENC_GZIP 0
+#define ENC_BR 1
+#define ENC_COUNT 2
+
+// smaller files are sent as they are, the encoding overhead eats the gain
+#define COMPRESS_MIN_SIZE 256
+
+/**
+ * accepted_encoding returns the encoding to send for the Accept-Encoding header of
+ * the request in hr (slices of buff): the one with the highest q-value, brotli on a
+ * tie, ENC_NONE if the client accepts neither
+ */
+int accepted_encoding(const http_request *hr, const char *buff);
+
+/**
+ * encoding_name returns the Content-Encoding token of enc ("gzip", "br")
+ */
+const char *encoding_name(int enc);
+
+/**
+ * encoding_suffix returns the file name suffix of a precompressed sidecar of enc (".gz", ".br")
+ */
+const char *encoding_suffix(int enc);
+
+/**
+ * compressible_type returns 1 for mime types of text content worth compressing
+ */
+int compressible_type(const char *content_type);
+
+/**
+ * compress_buffer compresses len bytes of data with enc (best ratio, it is done once per file).
+ * returns the malloc'd result with its length in *out_len, NULL on failure.
+ */
+char *compress_buffer(int enc, const char *data, size_t len, size_t *out_len);
+
+/**
+ * compress_chunks compresses the content of in into out with enc (fast settings, used
+ * for generated content). in is left as it is. returns -1 on failure.
+ */
+int compress_chunks(int enc, chunk_buf_t *in, chunk_buf_t *out);
+
+/**
+ * a compressor kept open between pieces of generated content
+ */
+typedef struct compress_stream_st compress_stream;
+
+/**
+ * compress_stream_open starts compressing with enc (fast settings). returns NULL on failure.
+ */
+compress_stream *compress_stream_open(int enc);
+
+/**
+ * compress_stream_write compresses the content of in (left as it is) into out. the output
+ * is flushed, so out can be sent as the next piece; finish - in is the last piece.
+ * returns -1 on failure.
+ */
+int compress_stream_write(compress_stream *s, chunk_buf_t *in, int finish, chunk_buf_t *out);
+
+/**
+ * compress_stream_close frees the compressor
+ */
+void compress_stream_close(compress_stream *s);
+
+#endif
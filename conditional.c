@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include "conditional.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define HTTP_DATE_MAX 64
+
+// date formats a client may send, the first is the one servers generate
+static const char *date_formats[] = {
+    "%a, %d %b %Y %H:%M:%S GMT", // IMF-fixdate
+    "%A, %d-%b-%y %H:%M:%S GMT", // RFC 850
+    "%a %b %e %H:%M:%S %Y"};     // asctime
+
+void make_etag(const struct stat *st, char *etag)
+{
+    // nanoseconds catch a rewrite inside the same second that kept the size
+    unsigned long mtime = (unsigned long)st->st_mtim.tv_sec * 1000000000UL + st->st_mtim.tv_nsec;
+    snprintf(etag, ETAG_SIZE, "\"%lx-%lx-%lx\"", (unsigned long)st->st_ino, (unsigned long)st->st_size, mtime);
+}
+
+int http_parse_date(const char *s, size_t len, time_t *t)
+{
+    char date[HTTP_DATE_MAX];
+    if (len >= sizeof(date))
+        return -1;
+    memcpy(date, s, len);
+    date[len] = '\0';
+    for (size_t i = 0; i < sizeof(date_formats) / sizeof(date_formats[0]); i++)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(date, date_formats[i], &tm);
+        if (end && *end == '\0')
+        {
+            *t = timegm(&tm);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// 1 if the comma separated entity-tag list in value matches etag (weak comparison)
+static int etag_list_matches(const char *value, size_t len, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *end = value + len;
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+            value++;
+        const char *tag_end = value;
+        while (tag_end < end && *tag_end != ',')
+            tag_end++;
+        const char *tag = value;
+        size_t tag_len = tag_end - tag;
+        while (tag_len > 0 && (tag[tag_len - 1] == ' ' || tag[tag_len - 1] == '\t'))
+            tag_len--;
+        if (tag_len == 1 && tag[0] == '*')
+            return 1;
+        if (tag_len > 2 && tag[0] == 'W' && tag[1] == '/')
+        {
+            tag += 2;
+            tag_len -= 2;
+        }
+        if (tag_len == etag_len && memcmp(tag, etag, etag_len) == 0)
+            return 1;
+        value = tag_end;
+    }
+    return 0;
+}
+
+int request_is_conditional(const http_request *hr, const char *buff)
+{
+    for (int i = 0; i < hr->header_count; i++)
+    {
+        http_slice name = hr->headers[i].name;
+        if (http_slice_caseeq(buff, name, "If-None-Match") || http_slice_caseeq(buff, name, "If-Modified-Since") ||
+            http_slice_caseeq(buff, name, "Range"))
+            return 1;
+    }
+    return 0;
+}
+
+int request_not_modified(const http_request *hr, const char *buff, const char *etag, time_t mtime)
+{
+    const http_header *h = http_find_header(hr, buff, "If-None-Match");
+    if (h)
+        return etag_list_matches(&buff[h->value.off], h->value.len, etag);
+    h = http_find_header(hr, buff, "If-Modified-Since");
+    time_t since;
+    if (h && http_parse_date(&buff[h->value.off], h->value.len, &since) == 0)
+        return mtime <= since;
+    return 0;
+}
+
+// 1 if the If-Range validator (if any) still matches the file
+static int if_range_matches(const http_request *hr, const char *buff, const char *etag, const char *last_modified)
+{
+    const http_header *h = http_find_header(hr, buff, "If-Range");
+    if (!h)
+        return 1;
+    const char *value = &buff[h->value.off];
+    // a weak tag can not validate a range, only the exact strong tag or date
+    if (value[0] == '"')
+        return h->value.len == strlen(etag) && memcmp(value, etag, h->value.len) == 0;
+    return h->value.len == strlen(last_modified) && memcmp(value, last_modified, h->value.len) == 0;
+}
+
+// parse a decimal number at *p, -1 if there is none
+static off_t parse_offset(const char **p, const char *end)
+{
+    off_t n = 0;
+    const char *start = *p;
+    while (*p < end && **p >= '0' && **p <= '9')
+    {
+        if (n > (off_t)(0x7fffffffffffffffLL / 10) - 1)
+            return -1;
+        n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p == start ? -1 : n;
+}
+
+int request_ranges(const http_request *hr, const char *buff, const char *etag, const char *last_modified, off_t size,
+                   byte_range *ranges, int *count)
+{
+    const http_header *h = http_find_header(hr, buff, "Range");
+    if (!h || h->value.len < 6 || strncasecmp(&buff[h->value.off], "bytes=", 6) != 0)
+        return RANGE_NONE;
+    if (!if_range_matches(hr, buff, etag, last_modified))
+        return RANGE_NONE;
+    const char *p = &buff[h->value.off + 6];
+    const char *end = &buff[h->value.off + h->value.len];
+    int specs = 0;
+    *count = 0;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p == end)
+            break;
+        off_t first, last;
+        if (*p == '-')
+        {
+            // suffix range: the last n bytes
+            p++;
+            off_t n = parse_offset(&p, end);
+            if (n < 0)
+                return RANGE_NONE;
+            first = n < size ? size - n : 0;
+            last = n > 0 ? size - 1 : -1;
+        }
+        else
+        {
+            first = parse_offset(&p, end);
+            if (first < 0 || p == end || *p != '-')
+                return RANGE_NONE;
+            p++;
+            last = parse_offset(&p, end);
+            if (last < 0)
+                last = size - 1;
+            else if (last < first)
+                return RANGE_NONE;
+            else if (last >= size)
+                last = size - 1;
+        }
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p < end && *p != ',')
+            return RANGE_NONE;
+        // too many ranges are not worth the parts, the whole file is sent instead
+        if (++specs > RANGE_MAX)
+            return RANGE_NONE;
+        // ranges starting past the end are skipped, the others are served
+        if (first < size && first <= last)
+        {
+            ranges[*count].first = first;
+            ranges[*count].last = last;
+            (*count)++;
+        }
+    }
+    if (specs == 0)
+        return RANGE_NONE;
+    return *count > 0 ? RANGE_OK : RANGE_UNSATISFIABLE;
+}
@@ -0,0 +1,71 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "http_parser.h"
+
+/**
+ * conditional.h
+ *
+ * This file declares the evaluation of conditional and range requests.
+ * a file is identified by a strong ETag built from its inode, size and
+ * mtime and by its Last-Modified date. If-None-Match / If-Modified-Since
+ * decide on a 304, Range / If-Range on the byte ranges to send.
+ */
+
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+// bytes of an ETag value including the quotes and the NULL
+#define ETAG_SIZE 64
+
+// most ranges served in one multipart response, more are answered with the whole file
+#define RANGE_MAX 16
+
+// request_ranges return values
+#define RANGE_NONE 0		  //no usable Range header, send the whole file
+#define RANGE_OK 1			  //ranges holds the ranges to send
+#define RANGE_UNSATISFIABLE 2 //no range overlaps the file, answer 416
+
+/**
+ * an inclusive range of bytes of a file
+ */
+typedef struct byte_range_st
+{
+	off_t first;
+	off_t last;
+} byte_range;
+
+/**
+ * make_etag renders the quoted ETag of the file with stat st into etag (ETAG_SIZE bytes)
+ */
+void make_etag(const struct stat *st, char *etag);
+
+/**
+ * http_parse_date parses an HTTP date (IMF-fixdate, RFC 850 or asctime format)
+ * of len bytes into *t, returns -1 if it is not a date
+ */
+int http_parse_date(const char *s, size_t len, time_t *t);
+
+/**
+ * request_is_conditional returns 1 if the request in hr (slices of buff) has
+ * an If-None-Match, If-Modified-Since or Range header
+ */
+int request_is_conditional(const http_request *hr, const char *buff);
+
+/**
+ * request_not_modified returns 1 if the validators of the request in hr
+ * (slices of buff) match the file, so a 304 is answered instead of it.
+ * If-None-Match takes precedence over If-Modified-Since.
+ */
+int request_not_modified(const http_request *hr, const char *buff, const char *etag, time_t mtime);
+
+/**
+ * request_ranges parses the Range header of the request for a file of size bytes.
+ * the header is ignored when an If-Range does not match etag / last_modified.
+ * returns RANGE_NONE, RANGE_UNSATISFIABLE or RANGE_OK with *count ranges in
+ * ranges (RANGE_MAX entries).
+ */
+int request_ranges(const http_request *hr, const char *buff, const char *etag, const char *last_modified, off_t size,
+				   byte_range *ranges, int *count);
+
+#endif
@@ -0,0 +1,67 @@
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "response.h"
+#include "arena.h"
+#include "http_parser.h"
+#include "timerwheel.h"
+
+/**
+ * connection.h
+ *
+ * This file declares the state kept for every client connection,
+ * by the event-driven engine and by the blocking pool threads alike.
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+// maximum size of a request the server reads
+#define REQ_MAX_SIZE 4000
+// maximum number of buffers in one io_uring send
+#define URING_MAX_IOV 64
+
+// connection states
+#define CONN_READING 1	  //waiting for a complete request
+#define CONN_PROCESSING 2 //a pool thread is building the response
+#define CONN_WRITING 3	  //waiting for the socket to accept the response
+#define CONN_GENERATING 4 //a pool thread is rendering the next piece of a generated response
+
+typedef struct connection_st
+{
+	// kept while the object waits in the connection pool
+	arena_t arena;				//per-request scratch, reset once the responses were written
+	out_queue_t out;			//response waiting to be written
+	int pooled;					//1 if the object belongs to the pool slab
+	struct msghdr send_msg;		//io_uring: message of the send in flight, lives until its completion
+	struct iovec send_iov[URING_MAX_IOV]; //io_uring: buffers of send_msg, rewritten for every send
+	// reset for every new connection
+	int fd;						//client socket
+	int state;					//one of the CONN_ states
+	int rlen;					//number of bytes in rbuf
+	int requests;				//number of requests answered on this connection
+	int keep_alive;				//0 once the connection must close after the queued responses
+	int peer_closed;			//1 if the client shut down its sending side
+	int closing;				//1 if the connection must close once the worker returns
+	int inflight;				//io_uring: submissions for this connection not completed yet
+	int fixed;					//io_uring: 1 if the socket is in the ring's fixed file table (at index fd)
+	struct sockaddr_in peer;	//client address for the access log, looked up on its first record
+	wheel_timer timer;			//deadline of the current state in the engine's timer wheel
+	unsigned long window_sent;	//out.sent when the current send window started
+	time_t accepted_at;			//monotonic second the connection was accepted
+	time_t last_active;			//monotonic second of the last read or write
+	unsigned long send_start;	//stats_now() when the response was handed back to the reactor
+	void *owner;				//engine the connection belongs to
+	struct connection_st *prev; //list of live connections
+	struct connection_st *next;
+	struct connection_st *done_next; //list of connections handed back by workers
+	http_request parser;			 //parse state of the request at the start of rbuf
+	char rbuf[REQ_MAX_SIZE + 1];	 //request bytes read so far, NULL terminated (kept last, never cleared)
+} connection_t;
+
+// handler that builds the responses to the requests in conn->rbuf into conn->out,
+// answered requests are removed from rbuf and keep_alive is cleared when the connection must close
+typedef int (*request_fn)(connection_t *conn);
+
+#endif
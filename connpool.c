@@ -0,0 +1,88 @@
+#include "connpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+conn_pool *create_connpool(int capacity, size_t arena_size)
+{
+    if (capacity < 1)
+        return NULL;
+    conn_pool *p = (conn_pool *)calloc(1, sizeof(conn_pool));
+    if (!p)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    p->capacity = capacity;
+    p->arena_size = arena_size;
+    p->stride = (sizeof(connection_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    p->slab = (char *)aligned_alloc(CACHE_LINE, p->stride * capacity);
+    p->arenas = arena_size ? (char *)aligned_alloc(CACHE_LINE, (arena_size * capacity + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE) : NULL;
+    if (!p->slab || (arena_size && !p->arenas) || mpmc_init(&p->free_conns, capacity))
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(p->slab);
+        free(p->arenas);
+        free(p);
+        return NULL;
+    }
+    for (int i = 0; i < capacity; i++)
+    {
+        connection_t *conn = (connection_t *)&p->slab[i * p->stride];
+        memset(conn, 0, offsetof(connection_t, rbuf));
+        arena_init(&conn->arena, arena_size ? &p->arenas[i * arena_size] : NULL, arena_size);
+        conn->pooled = 1;
+        mpmc_enqueue(&p->free_conns, conn);
+    }
+    return p;
+}
+
+connection_t *connpool_get(conn_pool *p, int fd)
+{
+    connection_t *conn = (connection_t *)mpmc_dequeue(&p->free_conns);
+    if (!conn)
+    {
+        // more connections than the pool holds, this one lives on its own
+        atomic_fetch_add_explicit(&p->overflows, 1, memory_order_relaxed);
+        size_t size = (sizeof(connection_t) + p->arena_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        conn = (connection_t *)aligned_alloc(CACHE_LINE, size);
+        if (!conn)
+        {
+            perror("ERROR: MEMORY_ALOC_FAILED");
+            return NULL;
+        }
+        memset(conn, 0, offsetof(connection_t, rbuf));
+        // the arena follows the object in the same allocation
+        arena_init(&conn->arena, (char *)conn + sizeof(connection_t), p->arena_size);
+    }
+    // per-connection fields only, the arena and the output queue's array are kept
+    memset(&conn->fd, 0, offsetof(connection_t, rbuf) - offsetof(connection_t, fd));
+    conn->fd = fd;
+    conn->keep_alive = 1;
+    conn->rbuf[0] = '\0';
+    return conn;
+}
+
+void connpool_put(conn_pool *p, connection_t *conn)
+{
+    outq_clear(&conn->out);
+    arena_reset(&conn->arena);
+    if (!conn->pooled)
+    {
+        outq_free(&conn->out);
+        free(conn);
+        return;
+    }
+    mpmc_enqueue(&p->free_conns, conn);
+}
+
+void destroy_connpool(conn_pool *p)
+{
+    for (int i = 0; i < p->capacity; i++)
+        outq_free(&((connection_t *)&p->slab[i * p->stride])->out);
+    mpmc_destroy(&p->free_conns);
+    free(p->arenas);
+    free(p->slab);
+    free(p);
+}
@@ -0,0 +1,51 @@
+#include <stdatomic.h>
+#include "connection.h"
+#include "lfqueue.h"
+
+/**
+ * connpool.h
+ *
+ * This file declares the connection object pool. connection objects
+ * and their request arenas are allocated once in two slabs, every
+ * object starts on its own cache line. a free list ring hands them
+ * out to the reactor and the pool threads without locking. when the
+ * pool runs dry objects are allocated one by one and freed on return.
+ */
+
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+typedef struct conn_pool_st
+{
+	char *slab;				//capacity connection objects
+	size_t stride;			//bytes between objects, a multiple of CACHE_LINE
+	char *arenas;			//capacity arena blocks
+	size_t arena_size;		//bytes of arena per connection
+	int capacity;			//objects in the slab
+	mpmc_ring free_conns;	//objects not in use
+	atomic_ulong overflows; //objects allocated because the pool was empty
+} conn_pool;
+
+/**
+ * create_connpool allocates capacity connections with arena_size bytes of
+ * request arena each. returns NULL on failure.
+ */
+conn_pool *create_connpool(int capacity, size_t arena_size);
+
+/**
+ * connpool_get returns a reset connection for socket fd, NULL on memory failure
+ */
+connection_t *connpool_get(conn_pool *p, int fd);
+
+/**
+ * connpool_put releases what the connection still holds and returns it to the pool,
+ * the socket is left to the caller
+ */
+void connpool_put(conn_pool *p, connection_t *conn);
+
+/**
+ * destroy_connpool frees the pool, every connection must have been returned
+ */
+void destroy_connpool(conn_pool *p);
+
+#endif
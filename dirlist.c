@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include "dirlist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
+#define DIR_TABLE_HEAD_TEMPLATE "<HTML>\n<HEAD><TITLE>Index of %s</TITLE></HEAD>\n<BODY>\n<H4>Index of %s</H4>\n<table CELLSPACING=8>\n<tr><th>Name</th><th>Last Modified</th><th>Size</th></tr>\n"
+#define DIR_ENTERY_TAMPLATE "<tr>\n<td><A HREF=\"%s\">%s</A></td>\n<td>%s</td>\n<td>%s</td>\n</tr>"
+#define DIR_TABLE_END_TEMPLATE "</table>\n<HR>\n<ADDRESS>webserver/1.0</ADDRESS>\n</BODY>\n</HTML>"
+
+// listing stages
+#define STAGE_HEAD 0
+#define STAGE_ENTRIES 1
+#define STAGE_END 2
+#define STAGE_DONE 3
+
+// record layout returned by getdents64
+struct linux_dirent64
+{
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+dir_listing *dir_listing_open(int dirfd, const char *path)
+{
+    dir_listing *l = (dir_listing *)malloc(sizeof(dir_listing));
+    if (l)
+        l->path = strdup(path);
+    if (!l || !l->path)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(l);
+        if (close(dirfd) == -1)
+            perror("ERROR: close directory failed");
+        return NULL;
+    }
+    l->dirfd = dirfd;
+    l->stage = STAGE_HEAD;
+    l->dirents_len = 0;
+    l->dirents_pos = 0;
+    l->last_mtime = -1;
+    return l;
+}
+
+// render one directory entry, entries that can not be stat'ed are skipped
+static int render_entry(dir_listing *l, chunk_buf_t *b, const char *name)
+{
+    struct stat fs;
+    if (fstatat(l->dirfd, name, &fs, 0) == -1)
+    {
+        perror("ERROR: stat failed - dir content");
+        return 0;
+    }
+    // files of one directory often share a modification second, format it once
+    if (fs.st_mtime != l->last_mtime)
+    {
+        struct tm tm;
+        strftime(l->last_mtime_str, sizeof(l->last_mtime_str), RFC1123FMT, gmtime_r(&fs.st_mtime, &tm));
+        l->last_mtime = fs.st_mtime;
+    }
+    // entery size shown for reg files only
+    char entery_size[24] = "";
+    if (S_ISREG(fs.st_mode))
+        sprintf(entery_size, "%ld", (long)fs.st_size);
+    return chunkbuf_printf(b, DIR_ENTERY_TAMPLATE, name, name, l->last_mtime_str, entery_size);
+}
+
+int dir_listing_render(dir_listing *l, chunk_buf_t *b, size_t limit)
+{
+    size_t start = b->total;
+    while (b->total - start < limit)
+    {
+        switch (l->stage)
+        {
+        case STAGE_HEAD:
+            if (chunkbuf_printf(b, DIR_TABLE_HEAD_TEMPLATE, l->path, l->path) < 0)
+                return LISTING_ERROR;
+            l->stage = STAGE_ENTRIES;
+            break;
+        case STAGE_ENTRIES:
+            if (l->dirents_pos >= l->dirents_len)
+            {
+                // single pass over the directory, one batch of records at a time
+                long readed = syscall(SYS_getdents64, l->dirfd, l->dirents, DIRENTS_BUFF_SIZE);
+                if (readed < 0)
+                {
+                    perror("ERROR: getdents64 failed - dir content");
+                    return LISTING_ERROR;
+                }
+                if (readed == 0)
+                {
+                    l->stage = STAGE_END;
+                    break;
+                }
+                l->dirents_len = readed;
+                l->dirents_pos = 0;
+            }
+            struct linux_dirent64 *ent = (struct linux_dirent64 *)&l->dirents[l->dirents_pos];
+            l->dirents_pos += ent->d_reclen;
+            if (render_entry(l, b, ent->d_name) < 0)
+                return LISTING_ERROR;
+            break;
+        case STAGE_END:
+            if (chunkbuf_printf(b, DIR_TABLE_END_TEMPLATE) < 0)
+                return LISTING_ERROR;
+            l->stage = STAGE_DONE;
+            break;
+        default:
+            return LISTING_DONE;
+        }
+    }
+    return l->stage == STAGE_DONE ? LISTING_DONE : LISTING_MORE;
+}
+
+void dir_listing_close(dir_listing *l)
+{
+    if (close(l->dirfd) == -1)
+        perror("ERROR: close directory failed");
+    free(l->path);
+    free(l);
+}
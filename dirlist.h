@@ -0,0 +1,53 @@
+#include <time.h>
+#include "response.h"
+
+/**
+ * dirlist.h
+ *
+ * This file declares the directory listing generator. the directory is
+ * read once with getdents64, entries are stat'ed relative to the
+ * directory fd and the HTML page is rendered into a chunked buffer,
+ * a limited number of bytes at a time.
+ */
+
+#ifndef DIRLIST_H
+#define DIRLIST_H
+
+#define DIRENTS_BUFF_SIZE 32768
+
+// dir_listing_render return values
+#define LISTING_DONE 1
+#define LISTING_MORE 0
+#define LISTING_ERROR -1
+
+typedef struct dir_listing_st
+{
+	int dirfd;					 //directory being listed
+	char *path;					 //request path shown in the title
+	int stage;					 //next part to render: head, entries or end
+	char dirents[DIRENTS_BUFF_SIZE]; //raw getdents64 records
+	int dirents_len;			 //bytes in dirents
+	int dirents_pos;			 //next record to render
+	time_t last_mtime;			 //mtime formatted in last_mtime_str (entries often share it)
+	char last_mtime_str[64];
+} dir_listing;
+
+/**
+ * dir_listing_open starts a listing of the directory open at dirfd,
+ * the listing owns dirfd. returns NULL on memory failure (dirfd is closed).
+ */
+dir_listing *dir_listing_open(int dirfd, const char *path);
+
+/**
+ * dir_listing_render appends the next part of the page to b, stopping once
+ * about limit bytes were added. returns LISTING_DONE when the page is
+ * complete, LISTING_MORE if more is left, LISTING_ERROR on failure.
+ */
+int dir_listing_render(dir_listing *l, chunk_buf_t *b, size_t limit);
+
+/**
+ * dir_listing_close closes the directory and frees the listing
+ */
+void dir_listing_close(dir_listing *l);
+
+#endif
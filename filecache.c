@@ -0,0 +1,515 @@
+#include "filecache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#define WATCH_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static time_t monotonic_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// FNV-1a hash of a path
+static unsigned long hash_path(const char *path)
+{
+    unsigned long h = 14695981039346656037UL;
+    while (*path)
+    {
+        h ^= (unsigned char)*path++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// sidecar file suffixes of the variants, a change of a sidecar drops its original
+static const char *variant_suffixes[FC_VARIANTS] = {".gz", ".br"};
+
+static void entry_free(fc_entry_t *e)
+{
+    if (e->fd >= 0 && close(e->fd) < 0)
+        perror("ERROR: close file failed - leak.");
+    for (int i = 0; i < FC_VARIANTS; i++)
+    {
+        if (e->variants[i].fd >= 0 && close(e->variants[i].fd) < 0)
+            perror("ERROR: close file failed - leak.");
+        free(e->variants[i].data);
+        free(e->variants[i].headers);
+    }
+    free(e->data);
+    free(e->path);
+    free(e);
+}
+
+void filecache_release(void *entry)
+{
+    fc_entry_t *e = (fc_entry_t *)entry;
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        entry_free(e);
+}
+
+static void lru_unlink(filecache *c, fc_entry_t *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        c->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        c->lru_tail = e->lru_prev;
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+}
+
+static void lru_push_front(filecache *c, fc_entry_t *e)
+{
+    e->lru_next = c->lru_head;
+    if (c->lru_head)
+        c->lru_head->lru_prev = e;
+    c->lru_head = e;
+    if (!c->lru_tail)
+        c->lru_tail = e;
+}
+
+// find path in the table, lock must be held
+static fc_entry_t *table_find(filecache *c, const char *path, unsigned long hash)
+{
+    for (fc_entry_t *e = c->buckets[hash & (c->nbuckets - 1)]; e; e = e->hnext)
+        if (e->hash == hash && strcmp(e->path, path) == 0)
+            return e;
+    return NULL;
+}
+
+// take e out of the table and drop the table reference, lock must be held
+static void table_remove(filecache *c, fc_entry_t *e)
+{
+    fc_entry_t **link = &c->buckets[e->hash & (c->nbuckets - 1)];
+    while (*link && *link != e)
+        link = &(*link)->hnext;
+    if (!*link)
+        return;
+    *link = e->hnext;
+    lru_unlink(c, e);
+    if (e->data)
+        c->stats.bytes -= e->st.st_size;
+    c->stats.bytes -= e->variant_bytes;
+    c->stats.entries--;
+    filecache_release(e);
+}
+
+// drop least recently used entries until entries new entries and bytes more memory fit, lock must be held
+static void evict_for(filecache *c, size_t bytes, int entries)
+{
+    while (c->lru_tail && (c->stats.entries + entries > c->max_entries || c->stats.bytes + bytes > c->max_bytes))
+    {
+        table_remove(c, c->lru_tail);
+        c->stats.evictions++;
+    }
+}
+
+// drop every entry whose path starts with prefix, lock must be held
+static void invalidate_prefix(filecache *c, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    fc_entry_t *e = c->lru_head;
+    while (e)
+    {
+        fc_entry_t *next = e->lru_next;
+        if (strncmp(e->path, prefix, len) == 0)
+        {
+            table_remove(c, e);
+            c->stats.invalidations++;
+        }
+        e = next;
+    }
+}
+
+// the file changed since it was cached
+static int entry_changed(fc_entry_t *e, struct stat *now)
+{
+    return now->st_ino != e->st.st_ino || now->st_dev != e->st.st_dev || now->st_size != e->st.st_size ||
+           now->st_mtim.tv_sec != e->st.st_mtim.tv_sec || now->st_mtim.tv_nsec != e->st.st_mtim.tv_nsec ||
+           now->st_mode != e->st.st_mode;
+}
+
+fc_entry_t *filecache_get(filecache *c, const char *path)
+{
+    unsigned long hash = hash_path(path);
+    time_t now = monotonic_now();
+    pthread_mutex_lock(&(c->lock));
+    fc_entry_t *e = table_find(c, path, hash);
+    if (!e)
+    {
+        c->stats.misses++;
+        pthread_mutex_unlock(&(c->lock));
+        return NULL;
+    }
+    __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+    int check = now - e->checked >= c->revalidate;
+    if (!check)
+    {
+        lru_unlink(c, e);
+        lru_push_front(c, e);
+        c->stats.hits++;
+        pthread_mutex_unlock(&(c->lock));
+        return e;
+    }
+    pthread_mutex_unlock(&(c->lock));
+
+    // revalidate outside the lock, the reference keeps the entry alive
+    struct stat fs;
+    int checked = c->check ? c->check(c->check_arg, path, &fs) : stat(path, &fs);
+    int changed = checked == -1 || entry_changed(e, &fs);
+    pthread_mutex_lock(&(c->lock));
+    if (changed)
+    {
+        // another thread may have removed it already
+        if (table_find(c, path, hash) == e)
+        {
+            table_remove(c, e);
+            c->stats.invalidations++;
+        }
+        c->stats.misses++;
+    }
+    else
+    {
+        e->checked = now;
+        lru_unlink(c, e);
+        lru_push_front(c, e);
+        c->stats.hits++;
+    }
+    pthread_mutex_unlock(&(c->lock));
+    if (changed)
+    {
+        filecache_release(e);
+        return NULL;
+    }
+    return e;
+}
+
+// watch the directory of path so changes to the file drop its entry
+static void watch_dir_of(filecache *c, const char *path)
+{
+    if (c->inotify_fd < 0)
+        return;
+    const char *slash = strrchr(path, '/');
+    if (!slash)
+        return;
+    size_t dir_len = slash - path + 1;
+    char dir[dir_len + 1];
+    memcpy(dir, path, dir_len);
+    dir[dir_len] = '\0';
+    // watching an already watched directory returns its existing descriptor
+    int wd = inotify_add_watch(c->inotify_fd, dir, WATCH_EVENTS);
+    if (wd < 0)
+        return;
+    pthread_mutex_lock(&(c->lock));
+    if (wd >= c->nwatch_dirs)
+    {
+        int n = wd * 2 + 16;
+        char **dirs = (char **)realloc(c->watch_dirs, n * sizeof(char *));
+        if (dirs)
+        {
+            memset(&dirs[c->nwatch_dirs], 0, (n - c->nwatch_dirs) * sizeof(char *));
+            c->watch_dirs = dirs;
+            c->nwatch_dirs = n;
+        }
+    }
+    if (wd < c->nwatch_dirs && !c->watch_dirs[wd])
+        c->watch_dirs[wd] = strdup(dir);
+    pthread_mutex_unlock(&(c->lock));
+}
+
+fc_entry_t *filecache_insert(filecache *c, const char *path, int fd, struct stat *st, const char *content_type, const char *headers)
+{
+    fc_entry_t *e = (fc_entry_t *)calloc(1, sizeof(fc_entry_t));
+    if (!e)
+        return NULL;
+    e->path = strdup(path);
+    e->headers_len = strlen(headers);
+    if (!e->path || e->headers_len >= (int)sizeof(e->headers))
+    {
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    memcpy(e->headers, headers, e->headers_len + 1);
+    e->hash = hash_path(path);
+    e->st = *st;
+    e->fd = fd;
+    e->content_type = content_type;
+    for (int i = 0; i < FC_VARIANTS; i++)
+        e->variants[i].fd = -1;
+    e->checked = monotonic_now();
+    e->cache = c;
+    // 1 reference for the table, 1 for the caller
+    e->refs = 2;
+    int small = (size_t)st->st_size <= c->small_max && (size_t)st->st_size <= c->max_bytes;
+    if (small)
+    {
+        // small files are served from memory, read the whole file now
+        e->data = (char *)malloc(st->st_size ? st->st_size : 1);
+        off_t readed = 0;
+        while (e->data && readed < st->st_size)
+        {
+            ssize_t n = pread(fd, &e->data[readed], st->st_size - readed, readed);
+            if (n <= 0)
+                break;
+            readed += n;
+        }
+        if (!e->data || readed != st->st_size)
+        {
+            free(e->data);
+            free(e->path);
+            free(e);
+            return NULL;
+        }
+        if (close(fd) < 0)
+            perror("ERROR: close file failed - leak.");
+        e->fd = -1;
+    }
+    watch_dir_of(c, path);
+
+    pthread_mutex_lock(&(c->lock));
+    fc_entry_t *old = table_find(c, path, e->hash);
+    if (old)
+    {
+        // another thread cached the file first
+        table_remove(c, old);
+    }
+    evict_for(c, small ? st->st_size : 0, 1);
+    fc_entry_t **bucket = &c->buckets[e->hash & (c->nbuckets - 1)];
+    e->hnext = *bucket;
+    *bucket = e;
+    lru_push_front(c, e);
+    c->stats.entries++;
+    if (small)
+        c->stats.bytes += st->st_size;
+    pthread_mutex_unlock(&(c->lock));
+    return e;
+}
+
+int filecache_variant(fc_entry_t *entry, int which)
+{
+    int state = VARIANT_UNKNOWN;
+    // claim the variant, everyone else sends the file as it is until it is set
+    if (__atomic_compare_exchange_n(&entry->variants[which].state, &state, VARIANT_BUSY, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return VARIANT_UNKNOWN;
+    return state;
+}
+
+void filecache_set_variant(fc_entry_t *entry, int which, char *data, int fd, size_t len, const char *headers)
+{
+    fc_variant *v = &entry->variants[which];
+    filecache *c = entry->cache;
+    if (data || fd >= 0)
+    {
+        v->headers = headers ? strdup(headers) : NULL;
+        if (!v->headers)
+        {
+            free(data);
+            if (fd >= 0 && close(fd) < 0)
+                perror("ERROR: close file failed - leak.");
+            data = NULL;
+            fd = -1;
+        }
+    }
+    if (data && len > c->max_bytes)
+    {
+        // larger than the whole cache, not worth holding
+        free(data);
+        free(v->headers);
+        v->headers = NULL;
+        data = NULL;
+    }
+    if (data)
+    {
+        pthread_mutex_lock(&(c->lock));
+        // the entry may have been dropped meanwhile, its memory is then not counted
+        if (table_find(c, entry->path, entry->hash) == entry)
+        {
+            evict_for(c, len, 0);
+            if (table_find(c, entry->path, entry->hash) == entry)
+            {
+                entry->variant_bytes += len;
+                c->stats.bytes += len;
+            }
+        }
+        pthread_mutex_unlock(&(c->lock));
+    }
+    if (data || fd >= 0)
+    {
+        v->data = data;
+        v->fd = fd;
+        v->len = len;
+        v->headers_len = strlen(v->headers);
+    }
+    __atomic_store_n(&v->state, data || fd >= 0 ? VARIANT_READY : VARIANT_NONE, __ATOMIC_RELEASE);
+}
+
+// watcher thread: drop entries of files that changed
+static void *watch_changes(void *p)
+{
+    filecache *c = (filecache *)p;
+    char buff[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{c->inotify_fd, POLLIN, 0}, {c->stop_fd, POLLIN, 0}};
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ERROR: poll inotify failed");
+            return NULL;
+        }
+        if (fds[1].revents)
+            return NULL;
+        ssize_t len = read(c->inotify_fd, buff, sizeof(buff));
+        if (len <= 0)
+            continue;
+        pthread_mutex_lock(&(c->lock));
+        for (char *ptr = buff; ptr < buff + len;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost, nothing cached can be trusted
+                invalidate_prefix(c, "");
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= c->nwatch_dirs || !c->watch_dirs[ev->wd])
+                continue;
+            char *dir = c->watch_dirs[ev->wd];
+            size_t dir_len = strlen(dir);
+            char path[dir_len + ev->len + 2];
+            if (ev->len == 0)
+            {
+                // the directory itself changed
+                invalidate_prefix(c, dir);
+            }
+            else if (ev->mask & IN_ISDIR)
+            {
+                // a sub directory changed, its files may no longer be reachable
+                sprintf(path, "%s%s/", dir, ev->name);
+                invalidate_prefix(c, path);
+            }
+            else
+            {
+                sprintf(path, "%s%s", dir, ev->name);
+                fc_entry_t *e = table_find(c, path, hash_path(path));
+                if (e)
+                {
+                    table_remove(c, e);
+                    c->stats.invalidations++;
+                }
+                // a changed sidecar outdates the variant held by its original
+                size_t path_len = strlen(path);
+                for (int i = 0; i < FC_VARIANTS; i++)
+                {
+                    size_t suffix_len = strlen(variant_suffixes[i]);
+                    if (path_len > suffix_len && strcmp(&path[path_len - suffix_len], variant_suffixes[i]) == 0)
+                    {
+                        path[path_len - suffix_len] = '\0';
+                        e = table_find(c, path, hash_path(path));
+                        if (e)
+                        {
+                            table_remove(c, e);
+                            c->stats.invalidations++;
+                        }
+                        break;
+                    }
+                }
+            }
+            if (ev->mask & IN_IGNORED)
+            {
+                free(c->watch_dirs[ev->wd]);
+                c->watch_dirs[ev->wd] = NULL;
+            }
+        }
+        pthread_mutex_unlock(&(c->lock));
+    }
+}
+
+filecache *create_filecache(size_t max_bytes, int max_entries, size_t small_max, int revalidate, fc_check_fn check, void *check_arg)
+{
+    if (max_entries < 1 || revalidate < 0)
+        return NULL;
+    filecache *c = (filecache *)calloc(1, sizeof(filecache));
+    if (!c)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    c->max_bytes = max_bytes;
+    c->max_entries = max_entries;
+    c->small_max = small_max;
+    c->revalidate = revalidate;
+    c->check = check;
+    c->check_arg = check_arg;
+    c->nbuckets = 64;
+    while (c->nbuckets < max_entries * 2)
+        c->nbuckets *= 2;
+    c->buckets = (fc_entry_t **)calloc(c->nbuckets, sizeof(fc_entry_t *));
+    if (!c->buckets)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(c);
+        return NULL;
+    }
+    if (pthread_mutex_init(&(c->lock), NULL))
+    {
+        perror("ERROR: MUTEX_INIT_FAILED");
+        free(c->buckets);
+        free(c);
+        return NULL;
+    }
+    // without inotify entries are still re-checked every revalidate seconds
+    c->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    c->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (c->inotify_fd >= 0 && (c->stop_fd < 0 || pthread_create(&(c->watcher), NULL, watch_changes, c)))
+    {
+        close(c->inotify_fd);
+        c->inotify_fd = -1;
+    }
+    return c;
+}
+
+void filecache_get_stats(filecache *c, filecache_stats *stats)
+{
+    pthread_mutex_lock(&(c->lock));
+    *stats = c->stats;
+    pthread_mutex_unlock(&(c->lock));
+}
+
+void destroy_filecache(filecache *c)
+{
+    if (c->inotify_fd >= 0)
+    {
+        uint64_t one = 1;
+        if (write(c->stop_fd, &one, sizeof(one)) != sizeof(one))
+            perror("ERROR: stop watcher failed");
+        pthread_join(c->watcher, NULL);
+        close(c->inotify_fd);
+    }
+    if (c->stop_fd >= 0)
+        close(c->stop_fd);
+    pthread_mutex_lock(&(c->lock));
+    invalidate_prefix(c, "");
+    pthread_mutex_unlock(&(c->lock));
+    for (int i = 0; i < c->nwatch_dirs; i++)
+        free(c->watch_dirs[i]);
+    free(c->watch_dirs);
+    free(c->buckets);
+    pthread_mutex_destroy(&(c->lock));
+    free(c);
+}
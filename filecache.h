@@ -0,0 +1,161 @@
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * filecache.h
+ *
+ * This file declares the shared static file cache. entries are keyed by
+ * the resolved request path. small files are held in memory together with
+ * their pre-rendered headers, large files keep an open fd and their stat
+ * so they can be streamed without being opened again.
+ * entries are dropped on inotify events for their directory and
+ * re-checked every revalidate seconds, with the check given at create
+ * (e.g. the resolver's permission walk) or stat.
+ */
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+// encoded variants kept per entry, one per content encoding (ENC_GZIP, ENC_BR of compress.h)
+#define FC_VARIANTS 2
+
+// states of an encoded variant
+#define VARIANT_UNKNOWN 0 //not looked for yet
+#define VARIANT_BUSY 1	  //another thread is looking for or compressing it
+#define VARIANT_NONE 2	  //no useful encoded form, the file is sent as it is
+#define VARIANT_READY 3
+
+/**
+ * an encoded form of a cached file: a precompressed sidecar file (e.g. a.css.gz)
+ * or content compressed once and held in memory
+ */
+typedef struct fc_variant_st
+{
+	int state;		//VARIANT_*, data, fd, len and headers are set before it becomes VARIANT_READY
+	char *data;		//compressed content, NULL for a sidecar file
+	int fd;			//open sidecar file, -1 when data holds the content
+	size_t len;		//bytes of the encoded content
+	char *headers;	//pre-rendered header lines of the encoded response
+	int headers_len;
+} fc_variant;
+
+/**
+ * a cached file
+ */
+typedef struct fc_entry_st
+{
+	char *path;					 //cache key
+	unsigned long hash;			 //hash of path
+	struct stat st;				 //stat of the file when it was cached
+	int fd;						 //open file (large files), -1 when data holds the content
+	char *data;					 //whole file content (small files)
+	char headers[256];			 //pre-rendered header lines of the file
+	int headers_len;
+	const char *content_type;	 //mime type of the file
+	fc_variant variants[FC_VARIANTS]; //encoded forms, dropped together with the entry
+	size_t variant_bytes;		 //memory held by compressed variants
+	time_t checked;				 //monotonic second of the last stat validation
+	int refs;					 //1 for the table + 1 for every response using the entry
+	struct _filecache_st *cache; //cache the entry belongs to
+	struct fc_entry_st *hnext;	 //hash chain
+	struct fc_entry_st *lru_prev; //least recently used list, head is the most recent
+	struct fc_entry_st *lru_next;
+} fc_entry_t;
+
+/**
+ * counters of the cache activity
+ */
+typedef struct filecache_stats_st
+{
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;	 //entries dropped to stay inside the limits
+	unsigned long invalidations; //entries dropped because the file changed
+	size_t bytes;				 //memory held by small file entries
+	int entries;				 //number of entries in the table
+} filecache_stats;
+
+/**
+ * revalidation of a cached path: fills st with the current stat of the file and returns
+ * 0 if it may still be served, -1 if it is gone or no longer allowed
+ */
+typedef int (*fc_check_fn)(void *arg, const char *path, struct stat *st);
+
+typedef struct _filecache_st
+{
+	fc_entry_t **buckets;	//hash table
+	int nbuckets;			//power of 2
+	fc_entry_t *lru_head;	//most recently used
+	fc_entry_t *lru_tail;	//least recently used, evicted first
+	size_t max_bytes;		//memory limit for small file content
+	int max_entries;		//limit on entries (bounds the open fds of large files)
+	size_t small_max;		//files up to this size are held in memory
+	int revalidate;			//seconds between checks of an entry
+	fc_check_fn check;		//check of a stale entry, NULL - stat
+	void *check_arg;
+	pthread_mutex_t lock;	//lock on the table, the lru list and the counters
+	filecache_stats stats;
+	int inotify_fd;			//-1 if inotify is not available
+	int stop_fd;			//eventfd to stop the watcher thread
+	pthread_t watcher;		//thread reading inotify events
+	char **watch_dirs;		//directory path of every watch descriptor
+	int nwatch_dirs;
+} filecache;
+
+/**
+ * create_filecache creates an empty cache, returns NULL on failure.
+ * max_bytes - memory limit for file content, max_entries - limit on entries,
+ * small_max - largest file held in memory, revalidate - seconds between checks of an entry,
+ * check(check_arg, ...) - the check, NULL to only stat the file.
+ */
+filecache *create_filecache(size_t max_bytes, int max_entries, size_t small_max, int revalidate, fc_check_fn check, void *check_arg);
+
+/**
+ * filecache_get returns the entry of path with a reference the caller
+ * must release, or NULL on a miss (or if the file changed).
+ */
+fc_entry_t *filecache_get(filecache *c, const char *path);
+
+/**
+ * filecache_insert caches the file open at fd (stat in st) under path,
+ * headers are the pre-rendered header lines stored with it.
+ * on success the cache takes ownership of fd and returns the entry with a
+ * reference the caller must release. returns NULL if the file could not be
+ * cached, fd then stays with the caller.
+ */
+fc_entry_t *filecache_insert(filecache *c, const char *path, int fd, struct stat *st, const char *content_type, const char *headers);
+
+/**
+ * filecache_release drops a reference taken by get or insert,
+ * usable as a release_fn of the output queue
+ */
+void filecache_release(void *entry);
+
+/**
+ * filecache_variant returns the state of the encoded variant which of entry.
+ * the first caller to find it VARIANT_UNKNOWN gets VARIANT_UNKNOWN and must
+ * call filecache_set_variant, callers meanwhile get VARIANT_BUSY.
+ */
+int filecache_variant(fc_entry_t *entry, int which);
+
+/**
+ * filecache_set_variant stores the variant claimed by filecache_variant: data
+ * (malloc'd) or fd of a sidecar file of len bytes, both taken over by the cache,
+ * with its header lines. data NULL and fd -1 records that there is no variant.
+ * compressed data is counted in the cache memory limit.
+ */
+void filecache_set_variant(fc_entry_t *entry, int which, char *data, int fd, size_t len, const char *headers);
+
+/**
+ * filecache_get_stats copies the cache counters into stats
+ */
+void filecache_get_stats(filecache *c, filecache_stats *stats);
+
+/**
+ * destroy_filecache stops the watcher and drops every entry, entries
+ * still referenced by responses are freed when released.
+ */
+void destroy_filecache(filecache *c);
+
+#endif
@@ -0,0 +1,248 @@
+#include "headers.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
+#define SERVER_HEAD "Server: webserver/1.0\r\nDate: "
+#define OK_HEAD "HTTP/1.1 200 OK\r\n" SERVER_HEAD
+#define PARTIAL_HEAD "HTTP/1.1 206 Partial Content\r\n" SERVER_HEAD
+#define NOT_MODIFIED_HEAD "HTTP/1.1 304 Not Modified\r\n" SERVER_HEAD
+#define FOUND_HEAD "HTTP/1.1 302 Found\r\n" SERVER_HEAD
+#define LOCATION_HEAD "\r\nLocation: "
+#define ERROR_BODY_TEMPLATE "<HTML><HEAD><TITLE>%s</TITLE></HEAD><BODY><H4>%s</H4>%s</BODY></HTML>"
+#define TAIL_TEMPLATE "%s\r\nContent-Type: text/html\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n%s"
+
+/**
+ * a response rendered at startup, only the Date (and the Location of a 302) is filled in per request
+ */
+typedef struct canned_st
+{
+	int status;
+	const char *status_text;
+	const char *message;
+	char *head; //status line up to the Date value
+	size_t head_len;
+	char *tail[2]; //rest of the response after the Date value, [0] - close, [1] - keep-alive
+	size_t tail_len[2];
+} canned_t;
+
+static canned_t canned[] = {
+	{400, "400 Bad Request", "Bad Request."},
+	{403, "403 Forbidden", "Access Denied."},
+	{404, "404 Not Found", "File not found."},
+	{500, "500 Internal Server Error", "Some server side error."},
+	{501, "501 Not supported", "Method is not supported."},
+	{416, "416 Range Not Satisfiable", "Requested range not satisfiable."},
+	{503, "503 Service Unavailable", "Server is busy, try again later."},
+	{302, "302 Found", "Directories must end with a slash."}};
+
+#define CANNED_COUNT (sizeof(canned) / sizeof(canned[0]))
+#define CANNED_FOUND (&canned[CANNED_COUNT - 1])
+
+static const char *connection_lines[2] = {"Connection: close\r\n\r\n", "Connection: keep-alive\r\n\r\n"};
+
+// the Date value, 32 bytes as atomic words so readers never see a torn string
+static _Atomic uint64_t date_words[4];
+// odd while the ticker rewrites date_words
+static atomic_uint date_seq;
+static int ticker_running;
+static int ticker_stop;
+static pthread_t ticker;
+static pthread_mutex_t ticker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticker_cond = PTHREAD_COND_INITIALIZER;
+
+void http_format_date(char *date, time_t now)
+{
+    struct tm tm;
+    strftime(date, HTTP_DATE_LEN + 1, RFC1123FMT, gmtime_r(&now, &tm));
+}
+
+static void publish_date(time_t now)
+{
+    uint64_t words[4] = {0};
+    http_format_date((char *)words, now);
+    atomic_fetch_add_explicit(&date_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < 4; i++)
+        atomic_store_explicit(&date_words[i], words[i], memory_order_relaxed);
+    atomic_fetch_add_explicit(&date_seq, 1, memory_order_release);
+}
+
+void http_date(char *date)
+{
+    if (!__atomic_load_n(&ticker_running, __ATOMIC_ACQUIRE))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        http_format_date(date, now.tv_sec);
+        return;
+    }
+    uint64_t words[4];
+    unsigned int seq;
+    do
+    {
+        seq = atomic_load_explicit(&date_seq, memory_order_acquire);
+        for (int i = 0; i < 4; i++)
+            words[i] = atomic_load_explicit(&date_words[i], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&date_seq, memory_order_relaxed));
+    memcpy(date, words, HTTP_DATE_LEN + 1);
+}
+
+// ticker thread: refresh the Date value on every second boundary
+static void *tick_dates(void *arg)
+{
+    pthread_mutex_lock(&ticker_lock);
+    while (!ticker_stop)
+    {
+        struct timespec next;
+        clock_gettime(CLOCK_REALTIME, &next);
+        next.tv_sec++;
+        next.tv_nsec = 0;
+        pthread_cond_timedwait(&ticker_cond, &ticker_lock, &next);
+        // time() may read a coarse clock that has not reached the new second yet
+        clock_gettime(CLOCK_REALTIME, &next);
+        publish_date(next.tv_sec);
+    }
+    pthread_mutex_unlock(&ticker_lock);
+    return NULL;
+}
+
+// render the parts of a canned response, Content-Length is counted from the rendered body
+static int render_canned(canned_t *c)
+{
+    char body[256];
+    snprintf(body, sizeof(body), ERROR_BODY_TEMPLATE, c->status_text, c->status_text, c->message);
+    size_t body_len = strlen(body);
+    int is_found = c == CANNED_FOUND;
+    char head[128];
+    if (is_found)
+        snprintf(head, sizeof(head), "%s", FOUND_HEAD);
+    else
+        snprintf(head, sizeof(head), "HTTP/1.1 %s\r\n%s", c->status_text, SERVER_HEAD);
+    c->head = strdup(head);
+    c->head_len = strlen(head);
+    if (!c->head)
+        return -1;
+    for (int keep_alive = 0; keep_alive < 2; keep_alive++)
+    {
+        // a 302 continues with the Location value, its tail starts after it
+        const char *lead = is_found ? "/" : "";
+        int len = snprintf(NULL, 0, TAIL_TEMPLATE, lead, body_len, keep_alive ? "keep-alive" : "close", body);
+        c->tail[keep_alive] = (char *)malloc(len + 1);
+        if (!c->tail[keep_alive])
+            return -1;
+        snprintf(c->tail[keep_alive], len + 1, TAIL_TEMPLATE, lead, body_len, keep_alive ? "keep-alive" : "close", body);
+        c->tail_len[keep_alive] = len;
+    }
+    return 0;
+}
+
+int headers_init(void)
+{
+    for (size_t i = 0; i < CANNED_COUNT; i++)
+    {
+        if (render_canned(&canned[i]) < 0)
+        {
+            perror("ERROR: MEMORY_ALOC_FAILED");
+            headers_destroy();
+            return -1;
+        }
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    publish_date(now.tv_sec);
+    ticker_stop = 0;
+    if (pthread_create(&ticker, NULL, tick_dates, NULL))
+    {
+        perror("ERROR: THREAD_CREATE_FAILED");
+        headers_destroy();
+        return -1;
+    }
+    __atomic_store_n(&ticker_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void headers_destroy(void)
+{
+    if (__atomic_load_n(&ticker_running, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&ticker_lock);
+        ticker_stop = 1;
+        pthread_cond_signal(&ticker_cond);
+        pthread_mutex_unlock(&ticker_lock);
+        pthread_join(ticker, NULL);
+        __atomic_store_n(&ticker_running, 0, __ATOMIC_RELEASE);
+    }
+    for (size_t i = 0; i < CANNED_COUNT; i++)
+    {
+        free(canned[i].head);
+        free(canned[i].tail[0]);
+        free(canned[i].tail[1]);
+        canned[i].head = canned[i].tail[0] = canned[i].tail[1] = NULL;
+    }
+}
+
+// queue a fragment that outlives the response (static, canned or arena memory)
+static int queue_fragment(out_queue_t *q, const char *data, size_t len)
+{
+    return outq_push_mem(q, data, len, NULL, NULL);
+}
+
+int queue_error(out_queue_t *q, int status, const char *date, int keep_alive)
+{
+    return queue_error_header(q, status, date, NULL, 0, keep_alive);
+}
+
+int queue_error_header(out_queue_t *q, int status, const char *date, const char *header, size_t header_len, int keep_alive)
+{
+    canned_t *c = NULL;
+    for (size_t i = 0; i < CANNED_COUNT - 1; i++)
+        if (canned[i].status == status)
+            c = &canned[i];
+    if (!c)
+        return queue_error(q, 500, date, keep_alive);
+    keep_alive = keep_alive != 0;
+    stats_status(status);
+    q->status = status;
+    if (queue_fragment(q, c->head, c->head_len) < 0 || queue_fragment(q, date, HTTP_DATE_LEN) < 0)
+        return -1;
+    // the extra header line goes between the Date value and the fixed tail
+    if (header && queue_fragment(q, header, header_len) < 0)
+        return -1;
+    return queue_fragment(q, c->tail[keep_alive], c->tail_len[keep_alive]);
+}
+
+int queue_found(out_queue_t *q, const char *location, size_t location_len, const char *date, int keep_alive)
+{
+    canned_t *c = CANNED_FOUND;
+    keep_alive = keep_alive != 0;
+    stats_status(302);
+    q->status = 302;
+    if (queue_fragment(q, c->head, c->head_len) < 0 || queue_fragment(q, date, HTTP_DATE_LEN) < 0 ||
+        queue_fragment(q, LOCATION_HEAD, sizeof(LOCATION_HEAD) - 1) < 0 || queue_fragment(q, location, location_len) < 0)
+        return -1;
+    return queue_fragment(q, c->tail[keep_alive], c->tail_len[keep_alive]);
+}
+
+int queue_status_head(out_queue_t *q, int status, const char *date)
+{
+    const char *head = status == 206 ? PARTIAL_HEAD : status == 304 ? NOT_MODIFIED_HEAD : OK_HEAD;
+    stats_status(status);
+    q->status = status;
+    if (queue_fragment(q, head, strlen(head)) < 0 || queue_fragment(q, date, HTTP_DATE_LEN) < 0)
+        return -1;
+    return queue_fragment(q, "\r\n", 2);
+}
+
+int queue_connection(out_queue_t *q, int keep_alive)
+{
+    const char *line = connection_lines[keep_alive != 0];
+    return queue_fragment(q, line, strlen(line));
+}
@@ -0,0 +1,72 @@
+#include <stddef.h>
+#include <time.h>
+#include "response.h"
+
+/**
+ * headers.h
+ *
+ * This file declares the response header engine. the Date value is
+ * formatted once a second by a ticker thread, the error responses and
+ * the fixed part of the 302 response are rendered once at startup, and
+ * every response is queued as fixed fragments plus its variable fields
+ * so the output queue sends them with one gathering write.
+ */
+
+#ifndef HEADERS_H
+#define HEADERS_H
+
+// length of an RFC1123 date ("Sun, 06 Nov 1994 08:49:37 GMT")
+#define HTTP_DATE_LEN 29
+
+/**
+ * headers_init renders the fixed responses and starts the Date ticker.
+ * returns -1 on failure.
+ */
+int headers_init(void);
+
+/**
+ * headers_destroy stops the ticker and frees the fixed responses
+ */
+void headers_destroy(void);
+
+/**
+ * http_date copies the current Date value into date (HTTP_DATE_LEN + 1 bytes).
+ * without a running ticker the date is formatted on the spot.
+ */
+void http_date(char *date);
+
+/**
+ * http_format_date formats t as an HTTP date into date (HTTP_DATE_LEN + 1 bytes)
+ */
+void http_format_date(char *date, time_t t);
+
+/**
+ * queue_error queues the whole error response of status (400, 403, 404, 416, 500 or 501).
+ * date must stay valid until the response was written. returns -1 on failure.
+ */
+int queue_error(out_queue_t *q, int status, const char *date, int keep_alive);
+
+/**
+ * queue_error_header queues the error response of status with one more header line
+ * (header_len bytes starting with "\r\n", e.g. the Content-Range of a 416). header
+ * must stay valid until the response was written. returns -1 on failure.
+ */
+int queue_error_header(out_queue_t *q, int status, const char *date, const char *header, size_t header_len, int keep_alive);
+
+/**
+ * queue_found queues a 302 response redirecting to location + "/".
+ * date and location must stay valid until the response was written. returns -1 on failure.
+ */
+int queue_found(out_queue_t *q, const char *location, size_t location_len, const char *date, int keep_alive);
+
+/**
+ * queue_status_head queues the status line (200, 206 or 304), Server and Date headers
+ */
+int queue_status_head(out_queue_t *q, int status, const char *date);
+
+/**
+ * queue_connection queues the Connection header and the empty line ending the headers
+ */
+int queue_connection(out_queue_t *q, int keep_alive);
+
+#endif
@@ -0,0 +1,196 @@
+#include "http_parser.h"
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_PARSER_X86 1
+#endif
+
+#ifdef HTTP_PARSER_X86
+#if defined(__GNUC__) && !defined(__AVX2__)
+__attribute__((target("avx2")))
+#endif
+static size_t find_byte_avx2(const char *p, size_t n, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&p[i]), needle));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i < n; i++)
+        if (p[i] == c)
+            return i;
+    return n;
+}
+
+static size_t find_byte_sse2(const char *p, size_t n, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&p[i]), needle));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    for (; i < n; i++)
+        if (p[i] == c)
+            return i;
+    return n;
+}
+#endif
+
+size_t http_find_byte(const char *p, size_t n, char c)
+{
+#ifdef HTTP_PARSER_X86
+    // the cpu is asked once, the answer is the same for every thread
+    static int use_avx2 = -1;
+    int avx2 = __atomic_load_n(&use_avx2, __ATOMIC_RELAXED);
+    if (avx2 < 0)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") != 0;
+        __atomic_store_n(&use_avx2, avx2, __ATOMIC_RELAXED);
+    }
+    return avx2 ? find_byte_avx2(p, n, c) : find_byte_sse2(p, n, c);
+#else
+    const char *found = (const char *)memchr(p, c, n);
+    return found ? (size_t)(found - p) : n;
+#endif
+}
+
+void http_parser_init(http_request *req)
+{
+    memset(req, 0, sizeof(http_request));
+}
+
+static int is_token_char(unsigned char c)
+{
+    return c > 32 && c < 127 && !strchr("()<>@,;:\\\"/[]?={}", c);
+}
+
+// METHOD SP target SP HTTP/1.x
+static int parse_request_line(http_request *req, const char *buf, size_t start, size_t end)
+{
+    const char *line = &buf[start];
+    size_t len = end - start;
+    size_t sp1 = http_find_byte(line, len, ' ');
+    if (sp1 == 0 || sp1 == len)
+        return HTTP_PARSE_ERROR;
+    for (size_t i = 0; i < sp1; i++)
+        if (!is_token_char(line[i]))
+            return HTTP_PARSE_ERROR;
+    size_t sp2 = sp1 + 1 + http_find_byte(&line[sp1 + 1], len - sp1 - 1, ' ');
+    if (sp2 == sp1 + 1 || sp2 >= len)
+        return HTTP_PARSE_ERROR;
+    const char *version = &line[sp2 + 1];
+    if (len - sp2 - 1 != 8 || strncmp(version, "HTTP/1.", 7) != 0 || (version[7] != '0' && version[7] != '1'))
+        return HTTP_PARSE_ERROR;
+    req->method.off = start;
+    req->method.len = sp1;
+    req->target.off = start + sp1 + 1;
+    req->target.len = sp2 - sp1 - 1;
+    req->version_minor = version[7] - '0';
+    return HTTP_PARSE_MORE;
+}
+
+// name: OWS value OWS
+static int parse_header(http_request *req, const char *buf, size_t start, size_t end)
+{
+    const char *line = &buf[start];
+    size_t len = end - start;
+    // obsolete line folding is not supported
+    if (line[0] == ' ' || line[0] == '\t')
+        return HTTP_PARSE_ERROR;
+    size_t colon = http_find_byte(line, len, ':');
+    if (colon == 0 || colon == len)
+        return HTTP_PARSE_ERROR;
+    for (size_t i = 0; i < colon; i++)
+        if (!is_token_char(line[i]))
+            return HTTP_PARSE_ERROR;
+    if (req->header_count == HTTP_MAX_HEADERS)
+        return HTTP_PARSE_TOO_LARGE;
+    size_t value = colon + 1;
+    while (value < len && (line[value] == ' ' || line[value] == '\t'))
+        value++;
+    size_t value_end = len;
+    while (value_end > value && (line[value_end - 1] == ' ' || line[value_end - 1] == '\t'))
+        value_end--;
+    http_header *h = &req->headers[req->header_count++];
+    h->name.off = start;
+    h->name.len = colon;
+    h->value.off = start + value;
+    h->value.len = value_end - value;
+    return HTTP_PARSE_MORE;
+}
+
+static int finish(http_request *req, int result)
+{
+    req->state = result == HTTP_PARSE_DONE ? HTTP_STATE_DONE : HTTP_STATE_ERROR;
+    req->result = result;
+    return result;
+}
+
+int http_parse(http_request *req, const char *buf, size_t len)
+{
+    if (req->state == HTTP_STATE_DONE || req->state == HTTP_STATE_ERROR)
+        return req->result;
+    while (req->pos < len)
+    {
+        size_t lf = req->pos + http_find_byte(&buf[req->pos], len - req->pos, '\n');
+        if (lf == len)
+        {
+            // no line end yet, the next call starts after the bytes seen here
+            req->pos = len;
+            if (len - req->line_start > HTTP_MAX_LINE)
+                return finish(req, HTTP_PARSE_TOO_LARGE);
+            return HTTP_PARSE_MORE;
+        }
+        size_t start = req->line_start;
+        size_t end = lf > start && buf[lf - 1] == '\r' ? lf - 1 : lf;
+        req->pos = lf + 1;
+        req->line_start = lf + 1;
+        if (end - start > HTTP_MAX_LINE)
+            return finish(req, HTTP_PARSE_TOO_LARGE);
+        int result;
+        if (req->state == HTTP_STATE_REQUEST_LINE)
+        {
+            // empty lines before a request line are ignored
+            if (end == start)
+                continue;
+            result = parse_request_line(req, buf, start, end);
+            req->state = HTTP_STATE_HEADERS;
+        }
+        else if (end == start)
+        {
+            req->length = lf + 1;
+            return finish(req, HTTP_PARSE_DONE);
+        }
+        else
+            result = parse_header(req, buf, start, end);
+        if (result != HTTP_PARSE_MORE)
+            return finish(req, result);
+    }
+    return HTTP_PARSE_MORE;
+}
+
+int http_slice_eq(const char *buf, http_slice s, const char *str)
+{
+    return strlen(str) == s.len && strncmp(&buf[s.off], str, s.len) == 0;
+}
+
+int http_slice_caseeq(const char *buf, http_slice s, const char *str)
+{
+    return strlen(str) == s.len && strncasecmp(&buf[s.off], str, s.len) == 0;
+}
+
+const http_header *http_find_header(const http_request *req, const char *buf, const char *name)
+{
+    for (int i = 0; i < req->header_count; i++)
+        if (http_slice_caseeq(buf, req->headers[i].name, name))
+            return &req->headers[i];
+    return NULL;
+}
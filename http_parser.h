@@ -0,0 +1,89 @@
+#include <stddef.h>
+
+/**
+ * http_parser.h
+ *
+ * This file declares the incremental HTTP/1.x request parser. the parser
+ * is fed the connection's read buffer again after every read and resumes
+ * where it stopped, so no byte is scanned twice. the request line and the
+ * headers are kept as slices (offset + length) of that buffer, nothing is
+ * copied. line ends are found with SSE2/AVX2 scans on x86-64.
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+// limits of one request
+#define HTTP_MAX_HEADERS 32
+#define HTTP_MAX_LINE 2048
+
+// http_parse return values
+#define HTTP_PARSE_DONE 0	   //the request line and all headers were parsed
+#define HTTP_PARSE_MORE 1	   //the request is incomplete, call again after the next read
+#define HTTP_PARSE_ERROR -1	   //malformed request
+#define HTTP_PARSE_TOO_LARGE -2 //a line or the header count is over the limits
+
+// parser states, a zeroed parser is a fresh one
+#define HTTP_STATE_REQUEST_LINE 0
+#define HTTP_STATE_HEADERS 1
+#define HTTP_STATE_DONE 2
+#define HTTP_STATE_ERROR 3
+
+/**
+ * a piece of the read buffer
+ */
+typedef struct http_slice_st
+{
+	unsigned int off;
+	unsigned int len;
+} http_slice;
+
+typedef struct http_header_st
+{
+	http_slice name;
+	http_slice value; //without surrounding white space
+} http_header;
+
+typedef struct http_request_st
+{
+	int state;				//one of the HTTP_STATE_ values
+	int result;				//result once state is DONE or ERROR
+	size_t pos;				//bytes of the buffer already scanned
+	size_t line_start;		//offset of the line being parsed
+	http_slice method;
+	http_slice target;
+	int version_minor;		//0 - HTTP/1.0, 1 - HTTP/1.1
+	http_header headers[HTTP_MAX_HEADERS];
+	int header_count;
+	size_t length;			//bytes of the request up to and including the empty line, once done
+} http_request;
+
+/**
+ * http_parser_init resets req for a new request
+ */
+void http_parser_init(http_request *req);
+
+/**
+ * http_parse continues parsing the request at the start of buf (len bytes).
+ * buf must hold the bytes given in earlier calls at the same offsets.
+ * returns HTTP_PARSE_DONE, HTTP_PARSE_MORE, HTTP_PARSE_ERROR or HTTP_PARSE_TOO_LARGE.
+ */
+int http_parse(http_request *req, const char *buf, size_t len);
+
+/**
+ * http_find_header returns the first header named name (case-insensitive), NULL if missing
+ */
+const http_header *http_find_header(const http_request *req, const char *buf, const char *name);
+
+/**
+ * http_slice_eq compares a slice to str, http_slice_caseeq ignoring case
+ */
+int http_slice_eq(const char *buf, http_slice s, const char *str);
+int http_slice_caseeq(const char *buf, http_slice s, const char *str);
+
+/**
+ * http_find_byte returns the offset of the first c in the n bytes at p, n if there is none
+ */
+size_t http_find_byte(const char *p, size_t n, char c);
+
+#endif
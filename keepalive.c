@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "keepalive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EVENTS 256
+
+// the connection leaves the epoll set, its socket is left open for the callback
+static void unpark(keepalive *k, connection_t *conn)
+{
+    wheel_cancel(&k->wheel, &conn->timer);
+    if (epoll_ctl(k->epfd, EPOLL_CTL_DEL, conn->fd, NULL) < 0)
+        perror("ERROR: epoll_ctl failure");
+    k->parked--;
+}
+
+static void idle_expired(wheel_timer *t, void *arg)
+{
+    keepalive *k = (keepalive *)arg;
+    connection_t *conn = (connection_t *)((char *)t - offsetof(connection_t, timer));
+    unpark(k, conn);
+    k->expired(conn);
+}
+
+// put the connections parked since the last batch in the epoll set
+static void take_pending(keepalive *k)
+{
+    uint64_t count;
+    if (read(k->notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("ERROR: read notify failed");
+    pthread_mutex_lock(&(k->lock));
+    connection_t *conn = k->pending;
+    k->pending = NULL;
+    pthread_mutex_unlock(&(k->lock));
+    while (conn)
+    {
+        connection_t *next = conn->done_next;
+        conn->done_next = NULL;
+        struct epoll_event ev;
+        // one shot: a connection is handed on once, and parked again by the thread that serves it
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(k->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+        {
+            // the pool finds out what is wrong with the socket when it reads it
+            perror("ERROR: epoll_ctl failure");
+            k->ready(conn);
+        }
+        else
+        {
+            k->parked++;
+            if (k->idle_timeout)
+                wheel_arm(&k->wheel, &conn->timer, k->idle_timeout * 1000UL);
+        }
+        conn = next;
+    }
+}
+
+static void *keepalive_run(void *arg)
+{
+    keepalive *k = (keepalive *)arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (1)
+    {
+        int n = epoll_wait(k->epfd, events, MAX_EVENTS, k->wheel.count ? WHEEL_TICK_MS : -1);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("error: epoll_wait failure");
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == &k->notify_fd)
+                take_pending(k);
+            else
+            {
+                connection_t *conn = (connection_t *)events[i].data.ptr;
+                unpark(k, conn);
+                k->ready(conn);
+            }
+        }
+        wheel_advance(&k->wheel, idle_expired, k);
+        pthread_mutex_lock(&(k->lock));
+        int done = k->stopping && !k->pending && k->parked == 0;
+        pthread_mutex_unlock(&(k->lock));
+        if (done)
+            break;
+    }
+    return NULL;
+}
+
+keepalive *create_keepalive(int idle_timeout, idle_fn ready, idle_fn expired)
+{
+    if (idle_timeout < 0 || !ready || !expired)
+        return NULL;
+    keepalive *k = (keepalive *)calloc(1, sizeof(keepalive));
+    if (!k)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    k->idle_timeout = idle_timeout;
+    k->ready = ready;
+    k->expired = expired;
+    wheel_init(&k->wheel);
+    if (pthread_mutex_init(&(k->lock), NULL))
+    {
+        perror("ERROR: MUTEX_INIT_FAILED");
+        free(k);
+        return NULL;
+    }
+    k->epfd = epoll_create1(EPOLL_CLOEXEC);
+    k->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &k->notify_fd;
+    if (k->epfd < 0 || k->notify_fd < 0 || epoll_ctl(k->epfd, EPOLL_CTL_ADD, k->notify_fd, &ev) < 0 ||
+        pthread_create(&k->thread, NULL, keepalive_run, k))
+    {
+        perror("error: keep-alive watcher setup failure");
+        if (k->epfd >= 0)
+            close(k->epfd);
+        if (k->notify_fd >= 0)
+            close(k->notify_fd);
+        pthread_mutex_destroy(&(k->lock));
+        free(k);
+        return NULL;
+    }
+    return k;
+}
+
+int keepalive_park(keepalive *k, connection_t *conn)
+{
+    pthread_mutex_lock(&(k->lock));
+    if (k->stopping)
+    {
+        pthread_mutex_unlock(&(k->lock));
+        return -1;
+    }
+    conn->done_next = k->pending;
+    k->pending = conn;
+    pthread_mutex_unlock(&(k->lock));
+    uint64_t one = 1;
+    if (write(k->notify_fd, &one, sizeof(one)) != sizeof(one))
+        perror("ERROR: notify keep-alive watcher failed");
+    return 0;
+}
+
+void keepalive_stop(keepalive *k)
+{
+    pthread_mutex_lock(&(k->lock));
+    k->stopping = 1;
+    pthread_mutex_unlock(&(k->lock));
+    // wake the watcher, it may be waiting without a deadline
+    uint64_t one = 1;
+    if (write(k->notify_fd, &one, sizeof(one)) != sizeof(one))
+        perror("ERROR: notify keep-alive watcher failed");
+    pthread_join(k->thread, NULL);
+    close(k->epfd);
+    close(k->notify_fd);
+    pthread_mutex_destroy(&(k->lock));
+    free(k);
+}
@@ -0,0 +1,56 @@
+#include <pthread.h>
+#include "connection.h"
+#include "timerwheel.h"
+
+/**
+ * keepalive.h
+ *
+ * This file declares the keep-alive watcher of the blocking mode. a pool
+ * thread that answered a connection's requests parks it here instead of
+ * waiting for its next request, one epoll thread watches every parked
+ * socket and hands the connection back to the pool when bytes arrive,
+ * so the pool's threads (and its admission control) count requests
+ * rather than open connections.
+ */
+
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+// called on the watcher thread with a connection that left the watcher
+typedef void (*idle_fn)(connection_t *conn);
+
+typedef struct _keepalive_st
+{
+	int epfd;				 //epoll instance of the parked sockets
+	int notify_fd;			 //eventfd parking threads wake the watcher with
+	int idle_timeout;		 //seconds a parked connection may wait for its next request, 0 - no limit
+	int parked;				 //connections in the epoll set (watcher thread only)
+	timer_wheel wheel;		 //idle deadlines of the parked connections (watcher thread only)
+	idle_fn ready;			 //takes a connection whose socket became readable (or closed)
+	idle_fn expired;		 //takes a connection that waited idle_timeout
+	pthread_mutex_t lock;	 //lock on the pending list and stopping
+	connection_t *pending;	 //connections parked and not in the epoll set yet
+	int stopping;			 //1 once keepalive_stop began, parking is refused
+	pthread_t thread;		 //the watcher thread
+} keepalive;
+
+/**
+ * create_keepalive starts the watcher thread. parked connections whose socket becomes
+ * readable are passed to ready, the ones idle for idle_timeout seconds to expired.
+ * returns NULL on failure.
+ */
+keepalive *create_keepalive(int idle_timeout, idle_fn ready, idle_fn expired);
+
+/**
+ * keepalive_park hands a connection waiting for its next request (conn->rlen 0) to
+ * the watcher. returns -1 if the watcher is stopping, the caller keeps the connection.
+ */
+int keepalive_park(keepalive *k, connection_t *conn);
+
+/**
+ * keepalive_stop refuses new connections, waits until every parked one left through
+ * ready or expired, then frees the watcher
+ */
+void keepalive_stop(keepalive *k);
+
+#endif
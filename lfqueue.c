@@ -0,0 +1,153 @@
+#include "lfqueue.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+static size_t round_pow2(size_t x)
+{
+    size_t p = 2;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+int ws_deque_init(ws_deque *d, long capacity)
+{
+    long size = (long)round_pow2(capacity);
+    d->slots = (_Atomic(void *) *)calloc(size, sizeof(*d->slots));
+    if (!d->slots)
+        return -1;
+    d->mask = size - 1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    return 0;
+}
+
+void ws_deque_destroy(ws_deque *d)
+{
+    free(d->slots);
+    d->slots = NULL;
+}
+
+int ws_push(ws_deque *d, void *item)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t > d->mask)
+        return -1;
+    atomic_store_explicit(&d->slots[b & d->mask], item, memory_order_relaxed);
+    // the slot must be visible before thieves see the new bottom
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+void *ws_pop(ws_deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b)
+    {
+        // empty, restore bottom
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    void *item = atomic_load_explicit(&d->slots[b & d->mask], memory_order_relaxed);
+    if (t == b)
+    {
+        // last item, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+            item = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+void *ws_steal(ws_deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return WS_EMPTY;
+    void *item = atomic_load_explicit(&d->slots[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return WS_ABORT;
+    return item;
+}
+
+long ws_size(ws_deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+int mpmc_init(mpmc_ring *q, size_t capacity)
+{
+    size_t size = round_pow2(capacity);
+    q->cells = (mpmc_cell *)malloc(size * sizeof(mpmc_cell));
+    if (!q->cells)
+        return -1;
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&q->cells[i].seq, i);
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return 0;
+}
+
+void mpmc_destroy(mpmc_ring *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int mpmc_enqueue(mpmc_ring *q, void *item)
+{
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    while (1)
+    {
+        mpmc_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                cell->data = item;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+        }
+        else if (diff < 0)
+            return -1;
+        else
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    }
+}
+
+void *mpmc_dequeue(mpmc_ring *q)
+{
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    while (1)
+    {
+        mpmc_cell *cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                void *item = cell->data;
+                atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+                return item;
+            }
+        }
+        else if (diff < 0)
+            return NULL;
+        else
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,96 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * lfqueue.h
+ *
+ * This file declares the lock-free queues of the work-stealing pool:
+ * a bounded Chase-Lev deque per worker (the owner pushes and pops at the
+ * bottom, other workers steal from the top) and a bounded multi-producer
+ * multi-consumer ring used for jobs submitted from outside the pool and
+ * for recycling job nodes.
+ */
+
+#ifndef LFQUEUE_H
+#define LFQUEUE_H
+
+#define CACHE_LINE 64
+
+/**
+ * work-stealing deque of pointers, capacity is a power of 2
+ */
+typedef struct ws_deque_st
+{
+	_Alignas(CACHE_LINE) atomic_long top; //next slot thieves take
+	_Alignas(CACHE_LINE) atomic_long bottom; //next slot the owner pushes to
+	_Alignas(CACHE_LINE) long mask;		  //capacity - 1
+	_Atomic(void *) *slots;
+} ws_deque;
+
+/**
+ * bounded multi-producer multi-consumer ring of pointers, capacity is a power of 2
+ */
+typedef struct mpmc_cell_st
+{
+	atomic_size_t seq;
+	void *data;
+} mpmc_cell;
+
+typedef struct mpmc_ring_st
+{
+	_Alignas(CACHE_LINE) atomic_size_t enqueue_pos;
+	_Alignas(CACHE_LINE) atomic_size_t dequeue_pos;
+	_Alignas(CACHE_LINE) size_t mask;
+	mpmc_cell *cells;
+} mpmc_ring;
+
+// ws_steal return values besides a job pointer
+#define WS_EMPTY NULL
+#define WS_ABORT ((void *)1) //lost a race with another thief or the owner
+
+/**
+ * ws_deque_init allocates a deque of capacity slots (rounded up to a power of 2),
+ * returns -1 on memory failure
+ */
+int ws_deque_init(ws_deque *d, long capacity);
+void ws_deque_destroy(ws_deque *d);
+
+/**
+ * ws_push adds item at the bottom (owner only), returns -1 if the deque is full
+ */
+int ws_push(ws_deque *d, void *item);
+
+/**
+ * ws_pop takes the newest item from the bottom (owner only), NULL if empty
+ */
+void *ws_pop(ws_deque *d);
+
+/**
+ * ws_steal takes the oldest item from the top (any thread),
+ * returns WS_EMPTY, WS_ABORT or the item
+ */
+void *ws_steal(ws_deque *d);
+
+/**
+ * ws_size returns an estimate of the items in the deque
+ */
+long ws_size(ws_deque *d);
+
+/**
+ * mpmc_init allocates a ring of capacity cells (rounded up to a power of 2),
+ * returns -1 on memory failure
+ */
+int mpmc_init(mpmc_ring *q, size_t capacity);
+void mpmc_destroy(mpmc_ring *q);
+
+/**
+ * mpmc_enqueue adds item, returns -1 if the ring is full
+ */
+int mpmc_enqueue(mpmc_ring *q, void *item);
+
+/**
+ * mpmc_dequeue removes the oldest item, NULL if the ring is empty
+ */
+void *mpmc_dequeue(mpmc_ring *q);
+
+#endif
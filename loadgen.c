@@ -0,0 +1,946 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+
+/**
+ * loadgen.c
+ *
+ * closed-loop load generator for the server. every connection sends a
+ * request, waits for the whole response, records its latency and sends the
+ * next one, so the offered load follows the server's speed. requests are
+ * drawn from a weighted mix of url kinds matching the docroot written by
+ * --generate. the result is printed as one JSON object.
+ */
+
+#define NS_PER_SEC 1000000000UL
+#define TICK_MS 100        //epoll wait, deadline and timeout checks
+#define HEAD_SIZE 8192     //response head buffer of a connection
+#define DISCARD_SIZE 65536 //bodies are read into a scratch buffer and dropped
+#define REQUEST_SIZE 256
+#define MAX_STATUS 600
+#define MAX_THREADS 64
+
+// generated docroot
+#define SMALL_FILES 200
+#define SMALL_MIN_SIZE 512
+#define SMALL_MAX_SIZE 16384
+#define LARGE_FILES 4
+#define LARGE_MIN_SIZE (1 << 20) //large file i is LARGE_MIN_SIZE << i bytes
+#define BIGDIR_ENTRIES 2000
+#define MISSING_FILES 1000
+
+// url kinds of the mix
+#define KIND_SMALL 0    //200, a small html file
+#define KIND_LARGE 1    //200, a 1-8MB file
+#define KIND_DIR 2      //200, listing of a 2000 entry directory
+#define KIND_MISSING 3  //404
+#define KIND_REDIRECT 4 //302, directory without the trailing '/'
+#define KINDS 5
+
+// connection states
+#define CONN_CONNECTING 0
+#define CONN_SENDING 1
+#define CONN_READING_HEAD 2
+#define CONN_READING_BODY 3
+
+// chunked body states
+#define CHUNK_SIZE 0    //in a chunk size line
+#define CHUNK_DATA 1    //in the data of a chunk
+#define CHUNK_DATA_END 2 //in the CRLF after the data
+#define CHUNK_TRAILER 3 //after the last chunk, until an empty line
+
+static const char *kind_names[KINDS] = {"small", "large", "dir", "missing", "redirect"};
+static const int kind_status[KINDS] = {200, 200, 200, 404, 302};
+
+// default settings
+#define CONNECTIONS 32
+#define DURATION 10
+#define REQUEST_TIMEOUT 5
+
+// runtime settings collected from the command line
+typedef struct loadgen_config
+{
+    int port;
+    struct in_addr host;
+    int connections;      // concurrent connections
+    int threads;          // event loop threads, connections are split between them
+    int duration;         // seconds measured, 0 - until --requests were answered
+    int warmup;           // seconds run before measuring
+    long requests;        // stop after this many requests, 0 - no limit
+    int keep_alive;       // 0 - one request per connection (Connection: close)
+    int timeout;          // seconds a request may take before it counts as an error
+    int mix[KINDS];       // weight of every url kind
+    unsigned long seed;   // url choices are reproducible for a seed
+    const char *generate; // write the docroot to this directory and exit
+} loadgen_config;
+
+static loadgen_config config = {
+    .connections = CONNECTIONS,
+    .threads = 1,
+    .duration = DURATION,
+    .keep_alive = 1,
+    .timeout = REQUEST_TIMEOUT,
+    .mix = {70, 5, 5, 10, 10},
+    .seed = 1};
+
+/**
+ * growable array of latencies in nanoseconds
+ */
+typedef struct samples_st
+{
+    unsigned long *ns;
+    size_t count;
+    size_t cap;
+} samples_t;
+
+typedef struct client_conn_st
+{
+    int fd;
+    int state;
+    int kind;            //url kind of the request in flight
+    int reused;          //a request was already answered on this connection
+    unsigned long rng;   //xorshift state
+    unsigned long start; //request sent, ns
+    char request[REQUEST_SIZE];
+    int request_len;
+    int request_sent;
+    char head[HEAD_SIZE];
+    int head_len;
+    int status;
+    int server_close; //the response asked to close the connection
+    long body_left;   //-1 - body ends with the connection
+    int chunked;      //the body has Transfer-Encoding: chunked
+    int chunk_state;
+    long chunk_left; //data bytes left of the current chunk
+    int line_len;    //bytes of the current size or trailer line
+} client_conn;
+
+typedef struct worker_st
+{
+    pthread_t thread;
+    int epfd;
+    client_conn *conns;
+    int nconns;
+    samples_t samples[KINDS];
+    unsigned long status[MAX_STATUS];
+    unsigned long errors;     //connect failures, resets, timeouts, malformed responses
+    unsigned long unexpected; //answered with another status than the kind expects
+    unsigned long reconnects;
+    unsigned long bytes; //response bytes read while measuring
+} worker_t;
+
+static atomic_long issued;          //requests sent, for --requests
+static unsigned long measure_start; //ns, responses to requests sent before are not recorded
+static unsigned long deadline;      //ns, 0 - none
+static int total_weight;
+
+void usage()
+{
+    printf("Usage: loadgen <port> [--connections <n>] [--threads <n>] [--duration <sec>] [--warmup <sec>]\n"
+           "               [--requests <n>] [--close] [--timeout <sec>] [--host <ipv4>] [--seed <n>]\n"
+           "               [--mix small:<w>,large:<w>,dir:<w>,missing:<w>,redirect:<w>]\n"
+           "       loadgen --generate <dir>\n");
+}
+
+static unsigned long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int samples_add(samples_t *s, unsigned long ns)
+{
+    if (s->count == s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 4096;
+        unsigned long *grown = (unsigned long *)realloc(s->ns, cap * sizeof(unsigned long));
+        if (!grown)
+            return -1;
+        s->ns = grown;
+        s->cap = cap;
+    }
+    s->ns[s->count++] = ns;
+    return 0;
+}
+
+// write len bytes of a repeating pattern to path
+static int write_file(const char *path, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("ERROR: open failed");
+        return -1;
+    }
+    char buff[DISCARD_SIZE];
+    for (size_t i = 0; i < sizeof(buff); i++)
+        buff[i] = "abcdefghijklmnopqrstuvwxyz0123456789 <p>\n"[i % 41];
+    while (len > 0)
+    {
+        size_t n = len < sizeof(buff) ? len : sizeof(buff);
+        if (write(fd, buff, n) != (ssize_t)n)
+        {
+            perror("ERROR: write failed");
+            close(fd);
+            return -1;
+        }
+        len -= n;
+    }
+    close(fd);
+    return 0;
+}
+
+static int make_dir(const char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+    {
+        perror("ERROR: mkdir failed");
+        return -1;
+    }
+    return 0;
+}
+
+// write the docroot the url mix expects
+int generate_docroot(const char *dir)
+{
+    char path[4096];
+    if (make_dir(dir) < 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/index.html", dir);
+    if (write_file(path, SMALL_MIN_SIZE) < 0)
+        return -1;
+    snprintf(path, sizeof(path), "%s/small", dir);
+    if (make_dir(path) < 0)
+        return -1;
+    unsigned long rng = 88172645463325252UL;
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/small/s%d.html", dir, i);
+        if (write_file(path, SMALL_MIN_SIZE + next_random(&rng) % (SMALL_MAX_SIZE - SMALL_MIN_SIZE)) < 0)
+            return -1;
+    }
+    snprintf(path, sizeof(path), "%s/large", dir);
+    if (make_dir(path) < 0)
+        return -1;
+    for (int i = 0; i < LARGE_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/large/l%d.bin", dir, i);
+        if (write_file(path, (size_t)LARGE_MIN_SIZE << i) < 0)
+            return -1;
+    }
+    snprintf(path, sizeof(path), "%s/bigdir", dir);
+    if (make_dir(path) < 0)
+        return -1;
+    for (int i = 0; i < BIGDIR_ENTRIES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/bigdir/entry-%d.txt", dir, i);
+        if (write_file(path, i % 64) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+// parse "small:70,large:5,..." into config.mix, kinds not listed get weight 0
+static int parse_mix(char *arg)
+{
+    memset(config.mix, 0, sizeof(config.mix));
+    char *save;
+    for (char *item = strtok_r(arg, ",", &save); item; item = strtok_r(NULL, ",", &save))
+    {
+        char *colon = strchr(item, ':');
+        if (!colon)
+            return 0;
+        *colon = '\0';
+        int kind = 0;
+        while (kind < KINDS && strcmp(item, kind_names[kind]) != 0)
+            kind++;
+        int weight = atoi(colon + 1);
+        if (kind == KINDS || weight < 0)
+            return 0;
+        config.mix[kind] = weight;
+    }
+    return 1;
+}
+
+// fill config from the command line, return 0 if arguments are invalid
+int parse_args(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"requests", required_argument, NULL, 'n'},
+        {"close", no_argument, NULL, 'k'},
+        {"timeout", required_argument, NULL, 'o'},
+        {"host", required_argument, NULL, 'h'},
+        {"seed", required_argument, NULL, 's'},
+        {"mix", required_argument, NULL, 'm'},
+        {"generate", required_argument, NULL, 'g'},
+        {NULL, 0, NULL, 0}};
+    config.host.s_addr = htonl(INADDR_LOOPBACK);
+    int duration_set = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config.connections = atoi(optarg);
+            if (config.connections < 1)
+                return 0;
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            if (config.threads < 1 || config.threads > MAX_THREADS)
+                return 0;
+            break;
+        case 'd':
+            config.duration = atoi(optarg);
+            duration_set = 1;
+            if (config.duration < 0)
+                return 0;
+            break;
+        case 'w':
+            config.warmup = atoi(optarg);
+            if (config.warmup < 0)
+                return 0;
+            break;
+        case 'n':
+            config.requests = atol(optarg);
+            if (config.requests < 1)
+                return 0;
+            break;
+        case 'k':
+            config.keep_alive = 0;
+            break;
+        case 'o':
+            config.timeout = atoi(optarg);
+            if (config.timeout < 1)
+                return 0;
+            break;
+        case 'h':
+            if (inet_pton(AF_INET, optarg, &config.host) != 1)
+                return 0;
+            break;
+        case 's':
+            config.seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            if (!parse_mix(optarg))
+                return 0;
+            break;
+        case 'g':
+            config.generate = optarg;
+            break;
+        default:
+            return 0;
+        }
+    }
+    if (config.generate)
+        return argc == optind;
+    if (argc - optind != 1)
+        return 0;
+    config.port = atoi(argv[optind]);
+    if (config.port < 1 || config.port > 65535)
+        return 0;
+    // --requests alone runs until they were answered
+    if (config.requests && !duration_set)
+        config.duration = 0;
+    if (!config.requests && config.duration == 0)
+        return 0;
+    for (int kind = 0; kind < KINDS; kind++)
+        total_weight += config.mix[kind];
+    if (config.threads > config.connections)
+        config.threads = config.connections;
+    return total_weight > 0;
+}
+
+// pick the next url kind and render its request into conn
+static void prepare_request(client_conn *conn)
+{
+    unsigned long r = next_random(&conn->rng);
+    int pick = r % total_weight;
+    int kind = 0;
+    while (pick >= config.mix[kind])
+        pick -= config.mix[kind++];
+    char url[64];
+    unsigned long n = r >> 32;
+    switch (kind)
+    {
+    case KIND_SMALL:
+        snprintf(url, sizeof(url), "/small/s%lu.html", n % SMALL_FILES);
+        break;
+    case KIND_LARGE:
+        snprintf(url, sizeof(url), "/large/l%lu.bin", n % LARGE_FILES);
+        break;
+    case KIND_DIR:
+        snprintf(url, sizeof(url), "/bigdir/");
+        break;
+    case KIND_MISSING:
+        snprintf(url, sizeof(url), "/missing/m%lu.html", n % MISSING_FILES);
+        break;
+    default:
+        snprintf(url, sizeof(url), "/small");
+        break;
+    }
+    conn->kind = kind;
+    conn->request_len = snprintf(conn->request, sizeof(conn->request), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: %s\r\n\r\n", url,
+                                 config.keep_alive ? "keep-alive" : "close");
+    conn->request_sent = 0;
+    conn->head_len = 0;
+    conn->status = 0;
+    conn->server_close = 0;
+    conn->body_left = 0;
+}
+
+static void conn_watch(worker_t *w, client_conn *conn, int op, unsigned int events)
+{
+    struct epoll_event ev = {.events = events, .data.ptr = conn};
+    epoll_ctl(w->epfd, op, conn->fd, &ev);
+}
+
+// 1 while new requests may be sent
+static int may_send()
+{
+    if (deadline && now_ns() >= deadline)
+        return 0;
+    return !config.requests || atomic_fetch_add(&issued, 1) < config.requests;
+}
+
+// open a new connection for conn and queue its next request, -1 if none is sent
+static int conn_open(worker_t *w, client_conn *conn, int resend)
+{
+    if (!resend && !may_send())
+    {
+        conn->fd = -1;
+        return -1;
+    }
+    if (!resend)
+        prepare_request(conn);
+    conn->request_sent = 0;
+    conn->reused = 0;
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn->fd < 0)
+    {
+        perror("ERROR: socket failed");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(config.port), .sin_addr = config.host};
+    conn->start = now_ns();
+    if (connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(conn->fd);
+        conn->fd = -1;
+        w->errors++;
+        return -1;
+    }
+    conn->state = CONN_CONNECTING;
+    conn_watch(w, conn, EPOLL_CTL_ADD, EPOLLOUT);
+    return 0;
+}
+
+static void conn_close(worker_t *w, client_conn *conn)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+// drop the connection and retry on a new one. a reused keep-alive connection the
+// server closed before answering (idle timeout, request limit) is not an error
+static void conn_fail(worker_t *w, client_conn *conn)
+{
+    int retry = conn->reused && conn->state != CONN_READING_BODY && conn->head_len == 0;
+    if (!retry)
+        w->errors++;
+    conn_close(w, conn);
+    w->reconnects++;
+    conn_open(w, conn, retry);
+}
+
+// parse the status line and the headers the generator needs, -1 if malformed
+static int parse_head(client_conn *conn, int head_end)
+{
+    conn->head[head_end - 1] = '\0';
+    if (strncmp(conn->head, "HTTP/1.", 7) != 0 || head_end < 12)
+        return -1;
+    conn->status = atoi(conn->head + 9);
+    if (conn->status < 100 || conn->status >= MAX_STATUS)
+        return -1;
+    conn->server_close = conn->head[7] == '0';
+    conn->body_left = -1;
+    conn->chunked = 0;
+    char *save;
+    strtok_r(conn->head, "\r\n", &save);
+    for (char *line = strtok_r(NULL, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save))
+    {
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            conn->body_left = atol(line + 15);
+        else if (strncasecmp(line, "Connection:", 11) == 0)
+            conn->server_close = strcasestr(line + 11, "close") != NULL;
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+            conn->chunked = strcasestr(line + 18, "chunked") != NULL;
+    }
+    if (conn->chunked)
+    {
+        conn->chunk_state = CHUNK_SIZE;
+        conn->chunk_left = 0;
+        conn->line_len = 0;
+    }
+    // a body that ends with the connection needs the connection to end
+    else if (conn->body_left < 0)
+        conn->server_close = 1;
+    return 0;
+}
+
+// follow the framing of len bytes of a chunked body, the data itself is dropped.
+// returns 1 once the body is complete, 0 if more is expected, -1 if malformed
+static int chunked_consume(client_conn *conn, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        switch (conn->chunk_state)
+        {
+        case CHUNK_SIZE:
+            if (c == '\n')
+            {
+                if (conn->line_len == 0)
+                    return -1;
+                conn->chunk_state = conn->chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+                conn->line_len = 0;
+            }
+            else if (conn->line_len >= 0 && c != '\r')
+            {
+                int digit = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+                if (digit < 0)
+                {
+                    // chunk extensions are ignored
+                    if (conn->line_len == 0)
+                        return -1;
+                    conn->line_len = -1;
+                }
+                else if (conn->line_len++ >= 15)
+                    return -1;
+                else
+                    conn->chunk_left = conn->chunk_left * 16 + digit;
+            }
+            break;
+        case CHUNK_DATA:
+        {
+            // skip the data in one step
+            size_t part = len - i < (size_t)conn->chunk_left ? len - i : (size_t)conn->chunk_left;
+            conn->chunk_left -= part;
+            i += part - 1;
+            if (conn->chunk_left == 0)
+                conn->chunk_state = CHUNK_DATA_END;
+            break;
+        }
+        case CHUNK_DATA_END:
+            if (c == '\n')
+            {
+                conn->chunk_state = CHUNK_SIZE;
+                conn->line_len = 0;
+            }
+            else if (c != '\r')
+                return -1;
+            break;
+        default:
+            if (c == '\n')
+            {
+                if (conn->line_len == 0)
+                    return i + 1 == len ? 1 : -1;
+                conn->line_len = 0;
+            }
+            else if (c != '\r')
+                conn->line_len = 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+// the response of conn was read completely
+static void request_done(worker_t *w, client_conn *conn)
+{
+    unsigned long end = now_ns();
+    if (conn->start >= measure_start)
+    {
+        w->status[conn->status]++;
+        if (conn->status != kind_status[conn->kind])
+            w->unexpected++;
+        samples_add(&w->samples[conn->kind], end - conn->start);
+    }
+    if (!config.keep_alive || conn->server_close)
+    {
+        conn_close(w, conn);
+        conn_open(w, conn, 0);
+        return;
+    }
+    conn->reused = 1;
+    if (!may_send())
+    {
+        conn_close(w, conn);
+        return;
+    }
+    prepare_request(conn);
+    conn->start = now_ns();
+    conn->state = CONN_SENDING;
+    conn_watch(w, conn, EPOLL_CTL_MOD, EPOLLOUT);
+}
+
+static void conn_send(worker_t *w, client_conn *conn)
+{
+    while (conn->request_sent < conn->request_len)
+    {
+        ssize_t n = send(conn->fd, conn->request + conn->request_sent, conn->request_len - conn->request_sent, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN)
+                conn_fail(w, conn);
+            return;
+        }
+        conn->request_sent += n;
+    }
+    conn->state = CONN_READING_HEAD;
+    conn_watch(w, conn, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+static void conn_read(worker_t *w, client_conn *conn)
+{
+    static __thread char discard[DISCARD_SIZE];
+    for (;;)
+    {
+        ssize_t n;
+        if (conn->state == CONN_READING_HEAD)
+            n = recv(conn->fd, conn->head + conn->head_len, HEAD_SIZE - conn->head_len, 0);
+        else
+        {
+            size_t want = conn->body_left >= 0 && conn->body_left < DISCARD_SIZE ? (size_t)conn->body_left : DISCARD_SIZE;
+            n = recv(conn->fd, discard, want, 0);
+        }
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n == 0 && conn->state == CONN_READING_BODY && conn->body_left < 0 && !conn->chunked)
+        {
+            request_done(w, conn);
+            return;
+        }
+        if (n <= 0)
+        {
+            conn_fail(w, conn);
+            return;
+        }
+        if (conn->start >= measure_start)
+            w->bytes += n;
+        if (conn->state == CONN_READING_BODY && conn->chunked)
+        {
+            int complete = chunked_consume(conn, discard, n);
+            if (complete < 0)
+                conn_fail(w, conn);
+            else if (complete)
+                request_done(w, conn);
+            else
+                continue;
+            return;
+        }
+        if (conn->state == CONN_READING_BODY)
+        {
+            if (conn->body_left > 0)
+                conn->body_left -= n;
+            if (conn->body_left == 0)
+            {
+                request_done(w, conn);
+                return;
+            }
+            continue;
+        }
+        conn->head_len += n;
+        char *end = memmem(conn->head, conn->head_len, "\r\n\r\n", 4);
+        if (!end)
+        {
+            if (conn->head_len == HEAD_SIZE)
+                conn_fail(w, conn);
+            continue;
+        }
+        int head_end = end - conn->head + 4;
+        int body_read = conn->head_len - head_end;
+        if (parse_head(conn, head_end) < 0 || (conn->body_left >= 0 && body_read > conn->body_left))
+        {
+            conn_fail(w, conn);
+            return;
+        }
+        conn->state = CONN_READING_BODY;
+        if (conn->chunked)
+        {
+            int complete = chunked_consume(conn, &conn->head[head_end], body_read);
+            if (complete < 0)
+                conn_fail(w, conn);
+            else if (complete)
+                request_done(w, conn);
+            else
+                continue;
+            return;
+        }
+        if (conn->body_left > 0)
+            conn->body_left -= body_read;
+        if (conn->body_left == 0)
+        {
+            request_done(w, conn);
+            return;
+        }
+    }
+}
+
+static void conn_connected(worker_t *w, client_conn *conn)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err)
+    {
+        conn_fail(w, conn);
+        return;
+    }
+    conn->state = CONN_SENDING;
+    conn_send(w, conn);
+}
+
+// fail requests older than the timeout
+static void check_timeouts(worker_t *w, unsigned long now)
+{
+    for (int i = 0; i < w->nconns; i++)
+    {
+        client_conn *conn = &w->conns[i];
+        if (conn->fd >= 0 && now - conn->start > (unsigned long)config.timeout * NS_PER_SEC)
+        {
+            conn->reused = 0;
+            conn_fail(w, conn);
+        }
+    }
+}
+
+static void *run_worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    for (int i = 0; i < w->nconns; i++)
+        conn_open(w, &w->conns[i], 0);
+    struct epoll_event events[256];
+    unsigned long last_check = now_ns();
+    for (;;)
+    {
+        int open_conns = 0;
+        for (int i = 0; i < w->nconns; i++)
+            open_conns += w->conns[i].fd >= 0;
+        unsigned long now = now_ns();
+        // in-flight requests are abandoned at the deadline
+        if (open_conns == 0 || (deadline && now >= deadline))
+            break;
+        int n = epoll_wait(w->epfd, events, 256, TICK_MS);
+        for (int i = 0; i < n; i++)
+        {
+            client_conn *conn = (client_conn *)events[i].data.ptr;
+            if (conn->fd < 0)
+                continue;
+            if (conn->state == CONN_CONNECTING)
+                conn_connected(w, conn);
+            else if (conn->state == CONN_SENDING)
+                conn_send(w, conn);
+            else
+                conn_read(w, conn);
+        }
+        now = now_ns();
+        if (now - last_check >= TICK_MS * 1000000UL)
+        {
+            check_timeouts(w, now);
+            last_check = now;
+        }
+    }
+    for (int i = 0; i < w->nconns; i++)
+        if (w->conns[i].fd >= 0)
+            conn_close(w, &w->conns[i]);
+    return NULL;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const samples_t *s, double p)
+{
+    if (s->count == 0)
+        return 0;
+    size_t i = (size_t)(p * (s->count - 1) + 0.5);
+    return s->ns[i] / 1000.0;
+}
+
+// print the latency summary of sorted samples as a JSON object
+static void print_latency(const samples_t *s)
+{
+    double sum = 0;
+    for (size_t i = 0; i < s->count; i++)
+        sum += s->ns[i];
+    printf("{\"count\":%zu,\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}", s->count,
+           s->count ? s->ns[0] / 1000.0 : 0, s->count ? sum / s->count / 1000.0 : 0, percentile_us(s, 0.5), percentile_us(s, 0.9),
+           percentile_us(s, 0.99), percentile_us(s, 0.999), s->count ? s->ns[s->count - 1] / 1000.0 : 0);
+}
+
+// merge the results of all workers and print them
+static int report(worker_t *workers, double elapsed)
+{
+    samples_t all = {NULL, 0, 0};
+    samples_t kinds[KINDS];
+    unsigned long status[MAX_STATUS] = {0};
+    unsigned long errors = 0, unexpected = 0, reconnects = 0, bytes = 0;
+    memset(kinds, 0, sizeof(kinds));
+    for (int t = 0; t < config.threads; t++)
+    {
+        worker_t *w = &workers[t];
+        for (int kind = 0; kind < KINDS; kind++)
+            for (size_t i = 0; i < w->samples[kind].count; i++)
+                if (samples_add(&kinds[kind], w->samples[kind].ns[i]) < 0 || samples_add(&all, w->samples[kind].ns[i]) < 0)
+                {
+                    perror("ERROR: MEMORY_ALOC_FAILED");
+                    return -1;
+                }
+        for (int i = 0; i < MAX_STATUS; i++)
+            status[i] += w->status[i];
+        errors += w->errors;
+        unexpected += w->unexpected;
+        reconnects += w->reconnects;
+        bytes += w->bytes;
+    }
+    qsort(all.ns, all.count, sizeof(unsigned long), compare_ns);
+    printf("{\"config\":{\"port\":%d,\"connections\":%d,\"threads\":%d,\"keep_alive\":%s,\"duration_s\":%d,\"warmup_s\":%d,"
+           "\"requests\":%ld,\"seed\":%lu,\"mix\":{",
+           config.port, config.connections, config.threads, config.keep_alive ? "true" : "false", config.duration, config.warmup,
+           config.requests, config.seed);
+    for (int kind = 0; kind < KINDS; kind++)
+        printf("%s\"%s\":%d", kind ? "," : "", kind_names[kind], config.mix[kind]);
+    printf("}},\"elapsed_s\":%.3f,\"requests\":%zu,\"errors\":%lu,\"unexpected_status\":%lu,\"reconnects\":%lu,\"bytes\":%lu,"
+           "\"throughput_rps\":%.1f,\"throughput_MBps\":%.2f,\"latency_us\":",
+           elapsed, all.count, errors, unexpected, reconnects, bytes, elapsed > 0 ? all.count / elapsed : 0,
+           elapsed > 0 ? bytes / elapsed / (1 << 20) : 0);
+    print_latency(&all);
+    printf(",\"status\":{");
+    int first = 1;
+    for (int i = 0; i < MAX_STATUS; i++)
+        if (status[i])
+        {
+            printf("%s\"%d\":%lu", first ? "" : ",", i, status[i]);
+            first = 0;
+        }
+    printf("},\"kinds\":{");
+    first = 1;
+    for (int kind = 0; kind < KINDS; kind++)
+    {
+        if (!config.mix[kind])
+            continue;
+        qsort(kinds[kind].ns, kinds[kind].count, sizeof(unsigned long), compare_ns);
+        printf("%s\"%s\":", first ? "" : ",", kind_names[kind]);
+        print_latency(&kinds[kind]);
+        first = 0;
+        free(kinds[kind].ns);
+    }
+    printf("}}\n");
+    free(all.ns);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse_args(argc, argv))
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (config.generate)
+        return generate_docroot(config.generate) < 0 ? EXIT_FAILURE : 0;
+    signal(SIGPIPE, SIG_IGN);
+    worker_t *workers = (worker_t *)calloc(config.threads, sizeof(worker_t));
+    client_conn *conns = (client_conn *)calloc(config.connections, sizeof(client_conn));
+    if (!workers || !conns)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(workers);
+        free(conns);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < config.connections; i++)
+    {
+        conns[i].fd = -1;
+        // a zero xorshift state stays zero
+        conns[i].rng = (config.seed + i + 1) * 0x9E3779B97F4A7C15UL;
+    }
+    unsigned long start = now_ns();
+    measure_start = start + (unsigned long)config.warmup * NS_PER_SEC;
+    if (config.duration)
+        deadline = measure_start + (unsigned long)config.duration * NS_PER_SEC;
+    int started = 0;
+    int failed = 0;
+    for (int t = 0; t < config.threads; t++)
+    {
+        worker_t *w = &workers[t];
+        // connections are split evenly, the first threads take the remainder
+        int first = t * (config.connections / config.threads) + (t < config.connections % config.threads ? t : config.connections % config.threads);
+        w->nconns = config.connections / config.threads + (t < config.connections % config.threads);
+        w->conns = &conns[first];
+        w->epfd = epoll_create1(0);
+        if (w->epfd < 0 || pthread_create(&w->thread, NULL, run_worker, w) != 0)
+        {
+            perror("ERROR: worker failed to start");
+            if (w->epfd >= 0)
+                close(w->epfd);
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+    for (int t = 0; t < started; t++)
+        pthread_join(workers[t].thread, NULL);
+    unsigned long end = now_ns();
+    double elapsed = end > measure_start ? (end - measure_start) / (double)NS_PER_SEC : 0;
+    if (!failed && report(workers, elapsed) < 0)
+        failed = 1;
+    for (int t = 0; t < started; t++)
+    {
+        close(workers[t].epfd);
+        for (int kind = 0; kind < KINDS; kind++)
+            free(workers[t].samples[kind].ns);
+    }
+    free(workers);
+    free(conns);
+    return failed ? EXIT_FAILURE : 0;
+}
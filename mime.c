@@ -0,0 +1,230 @@
+#include "mime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MIME_INIT_SLOTS 256
+#define MIME_LINE_MAX 1024
+
+/**
+ * a slot of the registry, empty while ext[0] is '\0'
+ */
+typedef struct mime_slot_st
+{
+	char ext[MIME_MAX_EXT + 1]; //lowercase extension without the dot
+	unsigned long hash;
+	const char *type;
+} mime_slot;
+
+// built-in types, "type ext1 ext2 ..." like a line of mime.types
+static const char *builtin_types[] = {
+    "text/html html htm",
+    "text/css css",
+    "text/plain txt text log",
+    "text/csv csv",
+    "text/markdown md",
+    "text/xml xml",
+    "text/javascript js mjs",
+    "application/json json map",
+    "application/manifest+json webmanifest",
+    "application/pdf pdf",
+    "application/wasm wasm",
+    "application/zip zip",
+    "application/gzip gz",
+    "application/x-tar tar",
+    "image/jpeg jpg jpeg",
+    "image/gif gif",
+    "image/png png",
+    "image/svg+xml svg svgz",
+    "image/webp webp",
+    "image/avif avif",
+    "image/x-icon ico",
+    "image/bmp bmp",
+    "font/woff woff",
+    "font/woff2 woff2",
+    "font/ttf ttf",
+    "font/otf otf",
+    "audio/basic au",
+    "audio/wav wav",
+    "audio/mpeg mp3",
+    "audio/ogg ogg oga",
+    "audio/flac flac",
+    "video/x-msvideo avi",
+    "video/mpeg mpeg mpg",
+    "video/mp4 mp4 m4v",
+    "video/webm webm",
+    "video/quicktime mov"};
+
+static mime_slot *slots;	//open-addressing table, power of 2 slots
+static size_t nslots;
+static size_t count;		//slots in use
+static char **type_strings; //every type string, owned by the registry
+static size_t ntype_strings;
+static size_t type_strings_cap;
+
+// FNV-1a hash of a lowercase extension
+static unsigned long hash_ext(const char *ext)
+{
+    unsigned long h = 14695981039346656037UL;
+    while (*ext)
+    {
+        h ^= (unsigned char)*ext++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// slot of ext, or the empty slot it would take
+static mime_slot *find_slot(mime_slot *table, size_t size, const char *ext, unsigned long hash)
+{
+    size_t i = hash & (size - 1);
+    while (table[i].ext[0] && (table[i].hash != hash || strcmp(table[i].ext, ext) != 0))
+        i = (i + 1) & (size - 1);
+    return &table[i];
+}
+
+// double the table, keeping it at most half full
+static int grow(void)
+{
+    size_t size = nslots ? nslots * 2 : MIME_INIT_SLOTS;
+    mime_slot *table = (mime_slot *)calloc(size, sizeof(mime_slot));
+    if (!table)
+        return -1;
+    for (size_t i = 0; i < nslots; i++)
+        if (slots[i].ext[0])
+            *find_slot(table, size, slots[i].ext, slots[i].hash) = slots[i];
+    free(slots);
+    slots = table;
+    nslots = size;
+    return 0;
+}
+
+// map ext to type, a known ext gets the new type. returns -1 on failure
+static int add_ext(const char *ext, const char *type)
+{
+    size_t len = strlen(ext);
+    if (len == 0 || len > MIME_MAX_EXT)
+        return 0;
+    if ((count + 1) * 2 > nslots && grow() < 0)
+        return -1;
+    char lower[MIME_MAX_EXT + 1];
+    for (size_t i = 0; i <= len; i++)
+        lower[i] = tolower((unsigned char)ext[i]);
+    unsigned long hash = hash_ext(lower);
+    mime_slot *slot = find_slot(slots, nslots, lower, hash);
+    if (!slot->ext[0])
+    {
+        memcpy(slot->ext, lower, len + 1);
+        slot->hash = hash;
+        count++;
+    }
+    slot->type = type;
+    return 0;
+}
+
+// keep a copy of a type string, returns NULL on failure
+static const char *own_type(const char *type)
+{
+    if (ntype_strings == type_strings_cap)
+    {
+        size_t cap = type_strings_cap ? type_strings_cap * 2 : 64;
+        char **strings = (char **)realloc(type_strings, cap * sizeof(char *));
+        if (!strings)
+            return NULL;
+        type_strings = strings;
+        type_strings_cap = cap;
+    }
+    char *copy = strdup(type);
+    if (copy)
+        type_strings[ntype_strings++] = copy;
+    return copy;
+}
+
+// add the extensions of one "type ext1 ext2 ..." line, line is modified
+static int add_line(char *line)
+{
+    char *save;
+    char *type = strtok_r(line, " \t\r\n", &save);
+    if (!type || type[0] == '#')
+        return 0;
+    const char *stored = NULL;
+    char *ext;
+    while ((ext = strtok_r(NULL, " \t\r\n;", &save)) != NULL)
+    {
+        if (ext[0] == '#')
+            break;
+        if (!stored)
+            stored = own_type(type);
+        if (!stored || add_ext(ext, stored) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int load_types_file(const char *types_file)
+{
+    FILE *f = fopen(types_file, "r");
+    if (!f)
+    {
+        perror("ERROR: open mime types file failed");
+        return -1;
+    }
+    char line[MIME_LINE_MAX];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), f))
+        result = add_line(line);
+    fclose(f);
+    return result;
+}
+
+int mime_init(const char *types_file)
+{
+    for (size_t i = 0; i < sizeof(builtin_types) / sizeof(builtin_types[0]); i++)
+    {
+        char line[MIME_LINE_MAX];
+        snprintf(line, sizeof(line), "%s", builtin_types[i]);
+        if (add_line(line) < 0)
+        {
+            perror("ERROR: MEMORY_ALOC_FAILED");
+            mime_destroy();
+            return -1;
+        }
+    }
+    if (types_file && load_types_file(types_file) < 0)
+    {
+        mime_destroy();
+        return -1;
+    }
+    return 0;
+}
+
+const char *mime_type(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/') || !slots)
+        return MIME_DEFAULT_TYPE;
+    ext++;
+    size_t len = strlen(ext);
+    if (len == 0 || len > MIME_MAX_EXT)
+        return MIME_DEFAULT_TYPE;
+    char lower[MIME_MAX_EXT + 1];
+    for (size_t i = 0; i <= len; i++)
+        lower[i] = tolower((unsigned char)ext[i]);
+    mime_slot *slot = find_slot(slots, nslots, lower, hash_ext(lower));
+    return slot->ext[0] ? slot->type : MIME_DEFAULT_TYPE;
+}
+
+void mime_destroy(void)
+{
+    free(slots);
+    slots = NULL;
+    nslots = 0;
+    count = 0;
+    for (size_t i = 0; i < ntype_strings; i++)
+        free(type_strings[i]);
+    free(type_strings);
+    type_strings = NULL;
+    ntype_strings = 0;
+    type_strings_cap = 0;
+}
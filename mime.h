@@ -0,0 +1,40 @@
+#include <stddef.h>
+
+/**
+ * mime.h
+ *
+ * This file declares the mime type registry. file name extensions are
+ * mapped to content types through an open-addressing hash table built at
+ * startup from a built-in table and an optional mime.types-style file.
+ * the table is read-only once built, so lookups take no lock.
+ */
+
+#ifndef MIME_H
+#define MIME_H
+
+// content type of files with an unknown extension
+#define MIME_DEFAULT_TYPE "application/octet-stream"
+
+// longest extension the registry holds
+#define MIME_MAX_EXT 15
+
+/**
+ * mime_init builds the registry from the built-in table, then adds the
+ * types of types_file ("type ext1 ext2 ..." lines, '#' comments) which
+ * override built-in ones. types_file may be NULL. returns -1 on failure.
+ */
+int mime_init(const char *types_file);
+
+/**
+ * mime_type returns the content type of the file name path (by its
+ * extension, case-insensitive), MIME_DEFAULT_TYPE if it is unknown.
+ * the returned string lives until mime_destroy.
+ */
+const char *mime_type(const char *path);
+
+/**
+ * mime_destroy frees the registry
+ */
+void mime_destroy(void);
+
+#endif
@@ -0,0 +1,479 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include "stats.h"
+#include "sockopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define MAX_EVENTS 256
+
+static time_t monotonic_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void conn_close(reactor *r, connection_t *conn)
+{
+    wheel_cancel(&r->wheel, &conn->timer);
+    // closing the fd also removes it from the epoll set
+    if (close(conn->fd) < 0)
+        perror("ERROR: close socket failed");
+    conn->fd = -1;
+    stats_conn_closed();
+    outq_clear(&conn->out);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        r->conns = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    r->live--;
+    // later events of the current epoll batch may still point at it, free after the batch
+    conn->next = r->closed;
+    r->closed = conn;
+}
+
+static void free_closed(reactor *r)
+{
+    while (r->closed)
+    {
+        connection_t *next = r->closed->next;
+        connpool_put(r->cpool, r->closed);
+        r->closed = next;
+    }
+}
+
+// pool side: give a connection with its response queued back to the reactor
+static void hand_back(reactor *r, connection_t *conn)
+{
+    pthread_mutex_lock(&(r->done_lock));
+    conn->done_next = r->done_head;
+    r->done_head = conn;
+    pthread_mutex_unlock(&(r->done_lock));
+    uint64_t one = 1;
+    if (write(r->notify_fd, &one, sizeof(one)) != sizeof(one))
+        perror("ERROR: notify reactor failed");
+}
+
+// pool side: build the response then hand the connection back to the reactor
+static int reactor_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    reactor *r = (reactor *)conn->owner;
+    r->handler(conn);
+    hand_back(r, conn);
+    return 0;
+}
+
+// pool side: render the next piece of a generated response (a listing chunk) then hand the
+// connection back, the reactor only sends bytes that are ready
+static int reactor_generate_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    reactor *r = (reactor *)conn->owner;
+    if (outq_generate(&conn->out) < 0)
+        conn->closing = 1;
+    hand_back(r, conn);
+    return 0;
+}
+
+// pool side: the request waited too long in the queue, answer it without doing its work
+static int reactor_shed_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    reactor *r = (reactor *)conn->owner;
+    r->shed(conn);
+    hand_back(r, conn);
+    return 0;
+}
+
+// a request is complete once the headers end (or are found malformed), or when the buffer is full.
+// the parser resumes where the last read left it, the handler's own call returns at once
+static int request_complete(connection_t *conn)
+{
+    if (conn->rlen == REQ_MAX_SIZE)
+        return 1;
+    unsigned long start = stats_now();
+    int parsed = http_parse(&conn->parser, conn->rbuf, conn->rlen);
+    stats_latency(STAT_PARSE, start);
+    return parsed != HTTP_PARSE_MORE;
+}
+
+// arm the deadline of the state the connection is in, none while a worker has it
+static void conn_deadline(reactor *r, connection_t *conn)
+{
+    int seconds = 0;
+    if (conn->state == CONN_READING)
+        // between requests the keep-alive timeout applies, from the first byte on the header timeout
+        seconds = conn->rlen == 0 && conn->requests > 0 ? r->idle_timeout : r->header_timeout;
+    else if (conn->state == CONN_WRITING)
+    {
+        seconds = r->send_timeout;
+        conn->window_sent = conn->out.sent;
+    }
+    if (seconds)
+        wheel_arm(&r->wheel, &conn->timer, seconds * 1000UL);
+    else
+        wheel_cancel(&r->wheel, &conn->timer);
+}
+
+// a deadline passed: close the connection, unless a sending client took enough in its window
+static void conn_expired(wheel_timer *t, void *arg)
+{
+    reactor *r = (reactor *)arg;
+    connection_t *conn = (connection_t *)((char *)t - offsetof(connection_t, timer));
+    if (conn->state == CONN_WRITING)
+    {
+        unsigned long taken = conn->out.sent - conn->window_sent;
+        if (taken > 0 && taken >= r->send_min_bytes)
+        {
+            conn_deadline(r, conn);
+            return;
+        }
+        stats_timeout(STAT_TIMEOUT_SEND);
+    }
+    else
+        stats_timeout(conn->rlen == 0 && conn->requests > 0 ? STAT_TIMEOUT_IDLE : STAT_TIMEOUT_HEADER);
+    conn_close(r, conn);
+}
+
+static void conn_read(reactor *r, connection_t *conn);
+
+static void conn_write(reactor *r, connection_t *conn)
+{
+    conn->last_active = monotonic_now();
+    // a new response starts its first send window
+    if (conn->state != CONN_WRITING)
+    {
+        conn->state = CONN_WRITING;
+        conn_deadline(r, conn);
+    }
+    unsigned long sent = conn->out.sent;
+    int flushed = outq_flush(&conn->out, conn->fd);
+    stats_bytes(conn->out.sent - sent);
+    switch (flushed)
+    {
+    case OUTQ_AGAIN:
+        // wait for the next EPOLLOUT edge
+        break;
+    case OUTQ_GENERATE:
+        // edges that arrive meanwhile are not needed, conn_write runs again when the piece is ready
+        conn->state = CONN_GENERATING;
+        conn_deadline(r, conn);
+        if (dispatch(r->pool, reactor_generate_job, conn) < 0)
+            conn_close(r, conn);
+        break;
+    case OUTQ_DONE:
+        // everything queued was written, the request scratch can go
+        stats_latency(STAT_SEND, conn->send_start);
+        arena_reset(&conn->arena);
+        if (!conn->keep_alive || conn->peer_closed)
+        {
+            conn_close(r, conn);
+            break;
+        }
+        // edges that arrived while the response was built were not read, read now
+        conn->state = CONN_READING;
+        conn_deadline(r, conn);
+        conn_read(r, conn);
+        break;
+    case OUTQ_ERROR:
+        conn_close(r, conn);
+        break;
+    }
+}
+
+static void conn_read(reactor *r, connection_t *conn)
+{
+    int was_empty = conn->rlen == 0;
+    // edge triggered: drain the socket until it would block
+    while (conn->rlen < REQ_MAX_SIZE)
+    {
+        ssize_t readed = read(conn->fd, &conn->rbuf[conn->rlen], REQ_MAX_SIZE - conn->rlen);
+        if (readed > 0)
+        {
+            conn->last_active = monotonic_now();
+            conn->rlen += readed;
+            conn->rbuf[conn->rlen] = '\0';
+            continue;
+        }
+        if (readed == 0)
+        {
+            conn->peer_closed = 1;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        perror("ERROR: read failure");
+        conn_close(r, conn);
+        return;
+    }
+    if (conn->rlen > 0 && (request_complete(conn) || conn->peer_closed))
+    {
+        conn->state = CONN_PROCESSING;
+        wheel_cancel(&r->wheel, &conn->timer);
+        if (!r->shed)
+        {
+            if (dispatch(r->pool, reactor_job, conn) < 0)
+                conn_close(r, conn);
+        }
+        else if (dispatch_bounded(r->pool, reactor_job, reactor_shed_job, conn) < 0)
+        {
+            // the pool is full, the shed response is written right away
+            r->shed(conn);
+            conn->send_start = stats_now();
+            conn_write(r, conn);
+        }
+    }
+    else if (conn->peer_closed)
+        conn_close(r, conn);
+    else if (was_empty && conn->rlen > 0)
+        // the first bytes of a request start its header deadline
+        conn_deadline(r, conn);
+}
+
+static void stop_listening(reactor *r)
+{
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, r->listen_fd, NULL);
+    r->listen_fd = -1;
+}
+
+static void accept_clients(reactor *r)
+{
+    while (r->listen_fd >= 0)
+    {
+        // take a connection from the budget before accepting it
+        if (atomic_fetch_sub(r->accept_left, 1) <= 0)
+        {
+            atomic_fetch_add(r->accept_left, 1);
+            stop_listening(r);
+            return;
+        }
+        int fd = accept4(r->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            atomic_fetch_add(r->accept_left, 1);
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("error: acceppt failure");
+            return;
+        }
+        connection_t *conn = connpool_get(r->cpool, fd);
+        if (!conn)
+        {
+            close(fd);
+            continue;
+        }
+        conn->state = CONN_READING;
+        conn->accepted_at = monotonic_now();
+        conn->last_active = conn->accepted_at;
+        conn->owner = r;
+        sockopt_accepted(fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            perror("error: epoll_ctl failure");
+            close(fd);
+            connpool_put(r->cpool, conn);
+            continue;
+        }
+        conn->next = r->conns;
+        if (r->conns)
+            r->conns->prev = conn;
+        r->conns = conn;
+        r->live++;
+        stats_conn_opened();
+        conn_deadline(r, conn);
+        // stop listening after the requested number of connections
+        if (atomic_load(r->accept_left) <= 0)
+            stop_listening(r);
+    }
+}
+
+// take back connections whose response is ready and start sending it
+static void collect_done(reactor *r)
+{
+    uint64_t count;
+    if (read(r->notify_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("ERROR: read notify failed");
+    pthread_mutex_lock(&(r->done_lock));
+    connection_t *conn = r->done_head;
+    r->done_head = NULL;
+    pthread_mutex_unlock(&(r->done_lock));
+    while (conn)
+    {
+        connection_t *next = conn->done_next;
+        conn->done_next = NULL;
+        if (conn->closing)
+            conn_close(r, conn);
+        else
+        {
+            // a generated piece continues the response being sent
+            if (conn->state == CONN_PROCESSING)
+                conn->send_start = stats_now();
+            conn_write(r, conn);
+        }
+        conn = next;
+    }
+}
+
+static void conn_event(reactor *r, connection_t *conn, uint32_t events)
+{
+    if (conn->fd < 0)
+        return;
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        // the worker still uses the connection, close it when it returns
+        if (conn->state == CONN_PROCESSING || conn->state == CONN_GENERATING)
+            conn->closing = 1;
+        else
+            conn_close(r, conn);
+        return;
+    }
+    if (conn->state == CONN_READING && (events & (EPOLLIN | EPOLLRDHUP)))
+        conn_read(r, conn);
+    else if (conn->state == CONN_WRITING && (events & EPOLLOUT))
+        conn_write(r, conn);
+}
+
+reactor *create_reactor(int listen_fd, int max_accept, int idle_timeout, threadpool *pool, request_fn handler, conn_pool *cpool)
+{
+    if (listen_fd < 0 || max_accept < 1 || idle_timeout < 0 || !pool || !handler || !cpool)
+        return NULL;
+    reactor *r = (reactor *)calloc(1, sizeof(reactor));
+    if (!r)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    r->listen_fd = listen_fd;
+    atomic_init(&r->own_accept_left, max_accept);
+    r->accept_left = &r->own_accept_left;
+    r->idle_timeout = idle_timeout;
+    r->pool = pool;
+    r->handler = handler;
+    r->cpool = cpool;
+    wheel_init(&r->wheel);
+    if (pthread_mutex_init(&(r->done_lock), NULL))
+    {
+        perror("ERROR: MUTEX_INIT_FAILED");
+        free(r);
+        return NULL;
+    }
+    // the accept loop drains the backlog until it would block
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("error: fcntl failure");
+        pthread_mutex_destroy(&(r->done_lock));
+        free(r);
+        return NULL;
+    }
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    r->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->epfd < 0 || r->notify_fd < 0)
+    {
+        perror("error: epoll setup failure");
+        destroy_reactor(r);
+        return NULL;
+    }
+    // the listener and the notify fd are told apart from connections by their data pointer
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &r->listen_fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+    {
+        perror("error: epoll_ctl failure");
+        destroy_reactor(r);
+        return NULL;
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &r->notify_fd;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->notify_fd, &ev) < 0)
+    {
+        perror("error: epoll_ctl failure");
+        destroy_reactor(r);
+        return NULL;
+    }
+    return r;
+}
+
+void reactor_share_accepts(reactor *r, atomic_int *accept_left)
+{
+    r->accept_left = accept_left;
+}
+
+void reactor_set_shed(reactor *r, request_fn shed)
+{
+    r->shed = shed;
+}
+
+void reactor_set_timeouts(reactor *r, int header_timeout, int send_timeout, unsigned long send_min_bytes)
+{
+    r->header_timeout = header_timeout;
+    r->send_timeout = send_timeout;
+    r->send_min_bytes = send_min_bytes;
+}
+
+void reactor_run(reactor *r)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (r->listen_fd >= 0 || r->live > 0)
+    {
+        // wake up every tick while deadlines are armed, once a second to look for a budget used up by other reactors
+        int shared = r->listen_fd >= 0 && r->accept_left != &r->own_accept_left;
+        int n = epoll_wait(r->epfd, events, MAX_EVENTS, r->wheel.count ? WHEEL_TICK_MS : shared ? 1000 : -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("error: epoll_wait failure");
+            return;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &r->listen_fd)
+                accept_clients(r);
+            else if (ptr == &r->notify_fd)
+                collect_done(r);
+            else
+                conn_event(r, (connection_t *)ptr, events[i].events);
+        }
+        wheel_advance(&r->wheel, conn_expired, r);
+        if (r->listen_fd >= 0 && atomic_load(r->accept_left) <= 0)
+            stop_listening(r);
+        free_closed(r);
+    }
+}
+
+void destroy_reactor(reactor *r)
+{
+    // connections still open here were never completed
+    while (r->conns)
+        conn_close(r, r->conns);
+    free_closed(r);
+    if (r->epfd >= 0)
+        close(r->epfd);
+    if (r->notify_fd >= 0)
+        close(r->notify_fd);
+    pthread_mutex_destroy(&(r->done_lock));
+    free(r);
+}
@@ -0,0 +1,83 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include "threadpool.h"
+#include "connpool.h"
+#include "timerwheel.h"
+
+/**
+ * reactor.h
+ *
+ * This file declares the edge-triggered epoll engine. the reactor
+ * thread owns every socket as a non-blocking fd, reads requests and
+ * writes responses itself, and hands only the response building
+ * (filesystem work) to the threadpool.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+typedef struct _reactor_st
+{
+	int epfd;				   //epoll instance
+	int listen_fd;			   //welcome socket, -1 once max_accept was reached
+	int notify_fd;			   //eventfd workers use to wake the reactor
+	atomic_int *accept_left;   //connections still allowed to be accepted, may be shared by several reactors
+	atomic_int own_accept_left; //budget of a reactor that shares it with no one
+	int live;				   //number of open connections
+	int idle_timeout;		   //seconds a keep-alive connection may wait for its next request, 0 - no limit
+	int header_timeout;		   //seconds a request may take to arrive, 0 - no limit
+	int send_timeout;		   //seconds of a send window, 0 - no limit
+	unsigned long send_min_bytes; //bytes the client must take in every send window
+	timer_wheel wheel;		   //deadlines of the connections
+	threadpool *pool;		   //pool running the request handler
+	request_fn handler;		   //builds a response for a complete request
+	request_fn shed;		   //answers a request the pool has no room or time for, NULL - always queue
+	conn_pool *cpool;		   //connection objects
+	connection_t *conns;	   //list of open connections
+	connection_t *closed;	   //connections closed during the current epoll batch
+	pthread_mutex_t done_lock; //lock on the done list
+	connection_t *done_head;   //connections returned by workers
+} reactor;
+
+/**
+ * create_reactor registers the listening socket in a new epoll instance.
+ * the reactor accepts max_accept connections and then stops listening.
+ * keep-alive connections waiting idle_timeout seconds for their next request are closed.
+ * connection objects are taken from cpool. returns NULL on failure.
+ */
+reactor *create_reactor(int listen_fd, int max_accept, int idle_timeout, threadpool *pool, request_fn handler, conn_pool *cpool);
+
+/**
+ * reactor_share_accepts makes the reactor take its connections from a budget
+ * shared with other reactors (SO_REUSEPORT listeners on one port). a reactor
+ * notices within a second that another one used up the budget.
+ */
+void reactor_share_accepts(reactor *r, atomic_int *accept_left);
+
+/**
+ * reactor_set_shed puts the reactor's jobs under the pool's admission control
+ * (dispatch_bounded). a request refused by a full pool, or taken out of the
+ * queue past its deadline, is answered by shed instead of the handler.
+ * shed must be cheap: it runs on the reactor thread when the pool is full.
+ */
+void reactor_set_shed(reactor *r, request_fn shed);
+
+/**
+ * reactor_set_timeouts sets the deadlines kept in the reactor's timer wheel: a request must
+ * arrive within header_timeout seconds (from the accept or its first byte), a response
+ * must be taken at send_min_bytes per send_timeout seconds. 0 disables a limit.
+ */
+void reactor_set_timeouts(reactor *r, int header_timeout, int send_timeout, unsigned long send_min_bytes);
+
+/**
+ * reactor_run runs the event loop until max_accept connections were
+ * accepted and all of them were closed.
+ */
+void reactor_run(reactor *r);
+
+/**
+ * destroy_reactor frees the reactor, the listening socket is left to the caller.
+ */
+void destroy_reactor(reactor *r);
+
+#endif
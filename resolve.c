@@ -0,0 +1,263 @@
+#define _GNU_SOURCE
+#include "resolve.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+static time_t monotonic_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// FNV-1a hash of the first len bytes of path
+static unsigned long hash_prefix(const char *path, size_t len)
+{
+    unsigned long h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// 1 if rel has a ".." component
+static int has_dotdot(const char *rel)
+{
+    for (const char *p = rel; (p = strstr(p, "..")) != NULL; p += 2)
+        if ((p == rel || p[-1] == '/') && (p[2] == '\0' || p[2] == '/'))
+            return 1;
+    return 0;
+}
+
+// open rel below the docroot, symlinks and ".." may not leave it
+static int open_beneath(resolver *r, const char *rel, int flags)
+{
+    if (!rel[0])
+        rel = ".";
+    if (__atomic_load_n(&r->use_openat2, __ATOMIC_RELAXED))
+    {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        long fd = syscall(SYS_openat2, r->rootfd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS)
+            return (int)fd;
+        // older kernel, fall back to openat for good
+        __atomic_store_n(&r->use_openat2, 0, __ATOMIC_RELAXED);
+    }
+    // without RESOLVE_BENEATH at least ".." can not climb out of the docroot
+    if (has_dotdot(rel))
+    {
+        errno = EXDEV;
+        return -1;
+    }
+    return openat(r->rootfd, rel, flags);
+}
+
+static int errno_to_result(int err)
+{
+    switch (err)
+    {
+    case ENOENT:
+    case ENOTDIR:
+    case ENAMETOOLONG:
+        return RESOLVE_NOT_FOUND;
+    case EACCES:
+    case EPERM:
+    case EXDEV:
+    case ELOOP:
+        return RESOLVE_FORBIDDEN;
+    default:
+        return RESOLVE_ERROR;
+    }
+}
+
+// look up the verdict of the first len bytes of rel, -1 if unknown or expired. lock must be held
+static int verdict_find(resolver *r, const char *rel, size_t len, unsigned long hash, time_t now)
+{
+    for (dir_verdict *v = r->buckets[hash & (r->nbuckets - 1)]; v; v = v->next)
+        if (v->hash == hash && strlen(v->path) == len && strncmp(v->path, rel, len) == 0)
+            return now - v->checked < r->revalidate ? v->allowed : -1;
+    return -1;
+}
+
+// drop every verdict. lock must be held
+static void verdict_clear(resolver *r)
+{
+    for (int i = 0; i < r->nbuckets; i++)
+    {
+        while (r->buckets[i])
+        {
+            dir_verdict *next = r->buckets[i]->next;
+            free(r->buckets[i]->path);
+            free(r->buckets[i]);
+            r->buckets[i] = next;
+        }
+    }
+    r->count = 0;
+}
+
+static void verdict_store(resolver *r, const char *rel, size_t len, unsigned long hash, int allowed, time_t now)
+{
+    pthread_mutex_lock(&(r->lock));
+    dir_verdict *v;
+    for (v = r->buckets[hash & (r->nbuckets - 1)]; v; v = v->next)
+        if (v->hash == hash && strlen(v->path) == len && strncmp(v->path, rel, len) == 0)
+            break;
+    if (!v)
+    {
+        // a full table is simply started over
+        if (r->count >= r->max_count)
+            verdict_clear(r);
+        v = (dir_verdict *)calloc(1, sizeof(dir_verdict));
+        if (v)
+            v->path = strndup(rel, len);
+        if (!v || !v->path)
+        {
+            free(v);
+            pthread_mutex_unlock(&(r->lock));
+            return;
+        }
+        v->hash = hash;
+        v->next = r->buckets[hash & (r->nbuckets - 1)];
+        r->buckets[hash & (r->nbuckets - 1)] = v;
+        r->count++;
+    }
+    v->allowed = allowed;
+    v->checked = now;
+    pthread_mutex_unlock(&(r->lock));
+}
+
+// check the directory named by the first len bytes of rel (its parents were checked already)
+static int check_dir(resolver *r, const char *rel, size_t len, time_t now)
+{
+    char prefix[len + 1];
+    memcpy(prefix, rel, len);
+    prefix[len] = '\0';
+    int fd = open_beneath(r, prefix, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return errno_to_result(errno);
+    struct stat fs;
+    int failed = fstat(fd, &fs) == -1;
+    close(fd);
+    if (failed)
+        return RESOLVE_ERROR;
+    // in case path pointed dir check for EXEC permissions for OTHER
+    int allowed = (S_IXOTH & fs.st_mode) != 0;
+    verdict_store(r, rel, len, hash_prefix(rel, len), allowed, now);
+    return allowed ? RESOLVE_OK : RESOLVE_FORBIDDEN;
+}
+
+int resolve_path(resolver *r, const char *path, int *fd, struct stat *st)
+{
+    const char *rel = path;
+    while (*rel == '.' && rel[1] == '/')
+        rel += 2;
+    while (*rel == '/')
+        rel++;
+    time_t now = monotonic_now();
+    // the deepest directory's verdict covers all its parents
+    const char *last_slash = strrchr(rel, '/');
+    size_t dir_len = last_slash ? (size_t)(last_slash - rel) + 1 : 0;
+    pthread_mutex_lock(&(r->lock));
+    int verdict = verdict_find(r, rel, dir_len, hash_prefix(rel, dir_len), now);
+    if (verdict >= 0)
+        r->hits++;
+    else
+        r->misses++;
+    pthread_mutex_unlock(&(r->lock));
+    if (verdict == 0)
+        return RESOLVE_FORBIDDEN;
+    if (verdict < 0)
+    {
+        // walk once from the docroot, every directory verdict is memoized on the way
+        size_t len = 0;
+        while (1)
+        {
+            int result = check_dir(r, rel, len, now);
+            if (result != RESOLVE_OK)
+                return result;
+            if (len == dir_len)
+                break;
+            const char *next = strchr(&rel[len], '/');
+            len = next - rel + 1;
+        }
+    }
+    // open the target itself, O_NONBLOCK keeps a fifo from blocking the open
+    int target = open_beneath(r, rel, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (target < 0)
+        return errno_to_result(errno);
+    if (fstat(target, st) == -1)
+    {
+        close(target);
+        return RESOLVE_ERROR;
+    }
+    // in case path pointed to reg file check READ permissions for OTHER, for a dir EXEC
+    if ((S_ISREG(st->st_mode) && !(S_IROTH & st->st_mode)) || (S_ISDIR(st->st_mode) && !(S_IXOTH & st->st_mode)))
+    {
+        close(target);
+        return RESOLVE_FORBIDDEN;
+    }
+    *fd = target;
+    return RESOLVE_OK;
+}
+
+resolver *create_resolver(const char *docroot, int max_dirs, int revalidate)
+{
+    if (max_dirs < 1 || revalidate < 0)
+        return NULL;
+    resolver *r = (resolver *)calloc(1, sizeof(resolver));
+    if (!r)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    r->use_openat2 = 1;
+    r->revalidate = revalidate;
+    r->max_count = max_dirs;
+    r->nbuckets = 64;
+    while (r->nbuckets < max_dirs * 2)
+        r->nbuckets *= 2;
+    r->buckets = (dir_verdict **)calloc(r->nbuckets, sizeof(dir_verdict *));
+    if (!r->buckets)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        free(r);
+        return NULL;
+    }
+    r->rootfd = open(docroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (r->rootfd < 0)
+    {
+        perror("ERROR: open docroot failed");
+        free(r->buckets);
+        free(r);
+        return NULL;
+    }
+    if (pthread_mutex_init(&(r->lock), NULL))
+    {
+        perror("ERROR: MUTEX_INIT_FAILED");
+        close(r->rootfd);
+        free(r->buckets);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void destroy_resolver(resolver *r)
+{
+    verdict_clear(r);
+    free(r->buckets);
+    close(r->rootfd);
+    pthread_mutex_destroy(&(r->lock));
+    free(r);
+}
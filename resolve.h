@@ -0,0 +1,69 @@
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * resolve.h
+ *
+ * This file declares the path resolver. request paths are opened relative
+ * to a docroot dirfd (with openat2 RESOLVE_BENEATH when the kernel has it)
+ * and checked for the "other" permission bits: S_IXOTH on every directory
+ * on the way, S_IROTH on the file. directory verdicts are memoized so a
+ * warm lookup costs one open and one fstat.
+ */
+
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+// resolve_path return values
+#define RESOLVE_OK 0
+#define RESOLVE_NOT_FOUND 1
+#define RESOLVE_FORBIDDEN 2
+#define RESOLVE_ERROR 3
+
+/**
+ * memoized verdict of a directory prefix
+ */
+typedef struct dir_verdict_st
+{
+	char *path;					 //directory prefix relative to the docroot, ends with '/' ("" for the root)
+	unsigned long hash;
+	int allowed;				 //1 if every directory up to and including this one has S_IXOTH
+	time_t checked;				 //monotonic second the verdict was made
+	struct dir_verdict_st *next; //hash chain
+} dir_verdict;
+
+typedef struct _resolver_st
+{
+	int rootfd;			  //O_PATH descriptor of the docroot
+	int use_openat2;	  //0 once openat2 was found missing
+	int revalidate;		  //seconds a directory verdict is trusted
+	dir_verdict **buckets; //verdict table
+	int nbuckets;		  //power of 2
+	int count;			  //verdicts in the table
+	int max_count;		  //the table is emptied when it grows past this
+	pthread_mutex_t lock; //lock on the verdict table
+	unsigned long hits;	  //directory verdicts found in the table
+	unsigned long misses; //directories walked and stat'ed
+} resolver;
+
+/**
+ * create_resolver opens docroot and creates an empty verdict table holding
+ * up to max_dirs directories for revalidate seconds. returns NULL on failure.
+ */
+resolver *create_resolver(const char *docroot, int max_dirs, int revalidate);
+
+/**
+ * resolve_path opens path (relative to the docroot, a leading "./" or "/" is
+ * skipped) and checks its permissions. on RESOLVE_OK *fd is an open
+ * descriptor of the file or directory (the caller closes it) and *st its stat.
+ * returns RESOLVE_OK, RESOLVE_NOT_FOUND, RESOLVE_FORBIDDEN or RESOLVE_ERROR.
+ */
+int resolve_path(resolver *r, const char *path, int *fd, struct stat *st);
+
+/**
+ * destroy_resolver closes the docroot and frees the verdict table
+ */
+void destroy_resolver(resolver *r);
+
+#endif
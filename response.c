@@ -0,0 +1,626 @@
+#define _GNU_SOURCE
+#include "response.h"
+#include "sockopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+
+#define OUTQ_INIT_CAP 8
+#define OUTQ_MAX_IOV 64
+#define COPY_BUFF_SIZE 65536
+
+void release_close_fd(void *fd)
+{
+    if (close((int)(intptr_t)fd) < 0)
+        perror("ERROR: close file failed - leak.");
+}
+
+// make room for n more segments, return -1 on memory failure
+static int outq_room(out_queue_t *q, int n)
+{
+    if (q->count + n > q->cap)
+    {
+        // reuse the space of segments already sent before growing
+        if (q->head > 0)
+        {
+            memmove(q->segs, &q->segs[q->head], (q->count - q->head) * sizeof(out_seg_t));
+            q->count -= q->head;
+            q->head = 0;
+        }
+        if (q->count + n > q->cap)
+        {
+            int cap = q->cap ? q->cap * 2 : OUTQ_INIT_CAP;
+            while (cap < q->count + n)
+                cap *= 2;
+            out_seg_t *segs = (out_seg_t *)realloc(q->segs, cap * sizeof(out_seg_t));
+            if (!segs)
+                return -1;
+            q->segs = segs;
+            q->cap = cap;
+        }
+    }
+    return 0;
+}
+
+// make room for one more segment, return pointer to it or NULL on memory failure
+static out_seg_t *outq_reserve(out_queue_t *q)
+{
+    if (outq_room(q, 1) < 0)
+        return NULL;
+    out_seg_t *seg = &q->segs[q->count++];
+    memset(seg, 0, sizeof(out_seg_t));
+    return seg;
+}
+
+int outq_ensure(out_queue_t *q, int n)
+{
+    if (outq_room(q, n) < 0)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return -1;
+    }
+    return 0;
+}
+
+int outq_push_mem(out_queue_t *q, const char *data, size_t len, release_fn release, void *release_arg)
+{
+    out_seg_t *seg = outq_reserve(q);
+    if (!seg)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        if (release)
+            release(release_arg);
+        return -1;
+    }
+    seg->kind = SEG_MEM;
+    seg->data = data;
+    seg->len = len;
+    q->queued += len;
+    seg->release = release;
+    seg->release_arg = release_arg;
+    return 0;
+}
+
+int outq_push_copy(out_queue_t *q, const char *data, size_t len)
+{
+    char *copy = (char *)malloc(len);
+    if (!copy)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return -1;
+    }
+    memcpy(copy, data, len);
+    return outq_push_mem(q, copy, len, free, copy);
+}
+
+// add a chunk with room for at least need bytes at the end of b
+static chunk_t *chunkbuf_grow(chunk_buf_t *b, size_t need)
+{
+    size_t size = need > b->chunk_size ? need : b->chunk_size;
+    chunk_t *chunk = (chunk_t *)malloc(sizeof(chunk_t) + size);
+    if (!chunk)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->len = 0;
+    chunk->size = size;
+    if (b->tail)
+        b->tail->next = chunk;
+    else
+        b->head = chunk;
+    b->tail = chunk;
+    return chunk;
+}
+
+int chunkbuf_printf(chunk_buf_t *b, const char *fmt, ...)
+{
+    va_list args;
+    chunk_t *chunk = b->tail;
+    size_t room = chunk ? chunk->size - chunk->len : 0;
+    va_start(args, fmt);
+    int len = vsnprintf(chunk ? &chunk->data[chunk->len] : NULL, room, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return -1;
+    if ((size_t)len >= room)
+    {
+        // did not fit, format again into a fresh chunk (+1 for vsnprintf's '\0')
+        chunk = chunkbuf_grow(b, len + 1);
+        if (!chunk)
+            return -1;
+        va_start(args, fmt);
+        vsnprintf(chunk->data, chunk->size, fmt, args);
+        va_end(args);
+    }
+    chunk->len += len;
+    b->total += len;
+    return 0;
+}
+
+int chunkbuf_append(chunk_buf_t *b, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        chunk_t *chunk = b->tail;
+        if (!chunk || chunk->len == chunk->size)
+        {
+            chunk = chunkbuf_grow(b, len);
+            if (!chunk)
+                return -1;
+        }
+        // fill the tail chunk before starting a new one
+        size_t part = chunk->size - chunk->len < len ? chunk->size - chunk->len : len;
+        memcpy(&chunk->data[chunk->len], data, part);
+        chunk->len += part;
+        b->total += part;
+        data += part;
+        len -= part;
+    }
+    return 0;
+}
+
+void chunkbuf_free(chunk_buf_t *b)
+{
+    while (b->head)
+    {
+        chunk_t *next = b->head->next;
+        free(b->head);
+        b->head = next;
+    }
+    b->tail = NULL;
+    b->total = 0;
+}
+
+int outq_push_chunks(out_queue_t *q, chunk_buf_t *b)
+{
+    while (b->head)
+    {
+        chunk_t *chunk = b->head;
+        b->head = chunk->next;
+        b->total -= chunk->len;
+        if (outq_push_mem(q, chunk->data, chunk->len, free, chunk) < 0)
+        {
+            chunkbuf_free(b);
+            return -1;
+        }
+    }
+    b->tail = NULL;
+    return 0;
+}
+
+int outq_push_file(out_queue_t *q, int fd, off_t off, size_t len, release_fn release, void *release_arg)
+{
+    out_seg_t *seg = outq_reserve(q);
+    if (!seg)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        if (release)
+            release(release_arg);
+        return -1;
+    }
+    seg->kind = SEG_FILE;
+    seg->fd = fd;
+    seg->off = off;
+    seg->len = len;
+    q->queued += len;
+    seg->release = release;
+    seg->release_arg = release_arg;
+    return 0;
+}
+
+int outq_push_gen(out_queue_t *q, generate_fn generate, void *arg, release_fn release)
+{
+    out_seg_t *seg = outq_reserve(q);
+    if (!seg)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        if (release)
+            release(arg);
+        return -1;
+    }
+    seg->kind = SEG_GEN;
+    seg->generate = generate;
+    seg->release = release;
+    seg->release_arg = arg;
+    // the first piece by the thread building the response, small content is complete with it
+    int generated = generate(arg, &seg->data, &seg->len);
+    seg->last = generated == 0;
+    if (generated < 0)
+    {
+        q->count--;
+        if (release)
+            release(arg);
+        return -1;
+    }
+    q->queued += seg->len;
+    return 0;
+}
+
+// drop the head segment once it was fully sent
+static void outq_pop(out_queue_t *q)
+{
+    out_seg_t *seg = &q->segs[q->head++];
+    if (seg->release)
+        seg->release(seg->release_arg);
+    seg->release = NULL;
+    if (q->head == q->count)
+    {
+        q->head = 0;
+        q->count = 0;
+    }
+}
+
+// 1 if the head is a generated segment whose piece was sent and the next one is not made yet
+static int outq_wants_piece(out_queue_t *q)
+{
+    return q->head < q->count && q->segs[q->head].kind == SEG_GEN && q->segs[q->head].len == 0 && !q->segs[q->head].last;
+}
+
+int outq_generate(out_queue_t *q)
+{
+    while (outq_wants_piece(q))
+    {
+        out_seg_t *seg = &q->segs[q->head];
+        int generated = seg->generate(seg->release_arg, &seg->data, &seg->len);
+        if (generated < 0)
+            return -1;
+        seg->last = generated == 0;
+        q->queued += seg->len;
+    }
+    return 0;
+}
+
+int outq_iov(out_queue_t *q, struct iovec *iov, int max, int *more)
+{
+    int n = 0;
+    *more = 0;
+    if (outq_wants_piece(q))
+        return 0;
+    int i;
+    for (i = q->head; i < q->count && n < max && q->segs[i].kind != SEG_FILE; i++)
+    {
+        iov[n].iov_base = (void *)q->segs[i].data;
+        iov[n].iov_len = q->segs[i].len;
+        n++;
+        // the next piece has to go out before anything queued behind it
+        if (q->segs[i].kind == SEG_GEN)
+        {
+            // pieces are held back to fill packets, the last one pushes them out
+            *more = !q->segs[i].last;
+            return n;
+        }
+    }
+    *more = i < q->count && q->segs[i].kind == SEG_FILE;
+    return n;
+}
+
+void outq_stream_end(out_queue_t *q, int n, int sockfd)
+{
+    // nothing to do if every socket has TCP_NODELAY already
+    if (!sockopts.nodelay && n > 0 && q->segs[q->head + n - 1].kind == SEG_GEN && q->segs[q->head + n - 1].last)
+    {
+        // fails on sockets that are not TCP, they have no Nagle either
+        int one = 1;
+        if (!q->nodelay && setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == 0)
+            q->nodelay = 1;
+    }
+}
+
+void outq_advance(out_queue_t *q, size_t writed)
+{
+    q->sent += writed;
+    size_t left = writed;
+    while (left > 0 || (q->head < q->count && q->segs[q->head].kind != SEG_FILE && q->segs[q->head].len == 0))
+    {
+        out_seg_t *seg = &q->segs[q->head];
+        if (seg->len <= left && seg->kind == SEG_GEN && !seg->last)
+        {
+            // the piece was sent, outq_generate makes the next one
+            left -= seg->len;
+            seg->len = 0;
+            break;
+        }
+        if (seg->len <= left)
+        {
+            left -= seg->len;
+            outq_pop(q);
+        }
+        else
+        {
+            seg->data += left;
+            seg->len -= left;
+            left = 0;
+            break;
+        }
+    }
+}
+
+// write consecutive memory segments with one call, return bytes written or -1
+static ssize_t flush_mem(out_queue_t *q, int sockfd)
+{
+    struct iovec iov[OUTQ_MAX_IOV];
+    int more;
+    int n = outq_iov(q, iov, OUTQ_MAX_IOV, &more);
+    // the caller checked the head is a memory segment or a piece ready to send
+    if (n == 0)
+        return 0;
+    outq_stream_end(q, n, sockfd);
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    // headers followed by a file body are held back to leave in one packet with the first body bytes
+    int flags = MSG_NOSIGNAL;
+    if (more)
+        flags |= sockopt_more_flag();
+    ssize_t writed = sendmsg(sockfd, &msg, flags);
+    if (writed < 0 && errno == ENOTSOCK)
+        writed = writev(sockfd, iov, n);
+    if (writed < 0)
+        return -1;
+    // advance over what the socket accepted
+    outq_advance(q, writed);
+    return writed;
+}
+
+// per-thread copy buffer, allocated on first use: a TLS array would be carved out of every (small) thread stack
+static char *copy_buff(void)
+{
+    static __thread char *file_buff;
+    if (!file_buff)
+        file_buff = (char *)malloc(COPY_BUFF_SIZE);
+    return file_buff;
+}
+
+// copy a chunk of a file segment through a buffer, for files neither sendfile nor splice can read
+static ssize_t copy_file(out_seg_t *seg, int sockfd)
+{
+    char *file_buff = copy_buff();
+    if (!file_buff)
+        return -1;
+    size_t want = seg->len < COPY_BUFF_SIZE ? seg->len : COPY_BUFF_SIZE;
+    ssize_t readed = pread(seg->fd, file_buff, want, seg->off);
+    if (readed <= 0)
+    {
+        // file shrunk or read failed, the promised length can not be sent
+        if (readed == 0)
+            errno = EIO;
+        return -1;
+    }
+    ssize_t writed = write(sockfd, file_buff, readed);
+    if (writed < 0)
+        return -1;
+    // bytes not accepted by the socket are read again from the file next time
+    seg->off += writed;
+    seg->len -= writed;
+    return writed;
+}
+
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+static __thread int *local_pipe;
+
+static void close_pipe(void *arg)
+{
+    int *fds = (int *)arg;
+    close(fds[0]);
+    close(fds[1]);
+    free(fds);
+}
+
+static void pipe_key_init(void)
+{
+    if (pthread_key_create(&pipe_key, close_pipe))
+        perror("ERROR: pthread_key_create failed");
+}
+
+// the calling thread's splice pipe, created on first use and closed when the thread exits
+static int *splice_pipe(void)
+{
+    if (local_pipe)
+        return local_pipe;
+    pthread_once(&pipe_once, pipe_key_init);
+    int *p = (int *)malloc(2 * sizeof(int));
+    if (!p)
+        return NULL;
+    if (pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        free(p);
+        return NULL;
+    }
+    pthread_setspecific(pipe_key, p);
+    return local_pipe = p;
+}
+
+// move a chunk of a file segment into the pipe and on to the socket, return bytes written or -1
+static ssize_t splice_file(out_seg_t *seg, int sockfd)
+{
+    int *fds = splice_pipe();
+    if (!fds)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // the pipe is empty between calls, a chunk fits in its default capacity
+    size_t want = seg->len < COPY_BUFF_SIZE ? seg->len : COPY_BUFF_SIZE;
+    loff_t off = seg->off;
+    ssize_t readed = splice(seg->fd, &off, fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (readed <= 0)
+    {
+        if (readed == 0)
+            errno = EIO;
+        return -1;
+    }
+    ssize_t writed = splice(fds[0], NULL, sockfd, NULL, readed, SPLICE_F_MOVE);
+    if (writed < readed)
+    {
+        // bytes not accepted by the socket are dropped from the pipe and spliced again from the file next time
+        int err = errno;
+        char *drain = copy_buff();
+        ssize_t left = readed - (writed > 0 ? writed : 0);
+        while (left > 0)
+        {
+            ssize_t n = drain ? read(fds[0], drain, left) : -1;
+            if (n <= 0)
+            {
+                // a pipe that can not be emptied is useless, the next call starts a fresh one
+                pthread_setspecific(pipe_key, NULL);
+                close_pipe(fds);
+                local_pipe = NULL;
+                break;
+            }
+            left -= n;
+        }
+        errno = err;
+    }
+    if (writed < 0)
+        return -1;
+    seg->off += writed;
+    seg->len -= writed;
+    return writed;
+}
+
+// send a file segment from the page cache straight to the socket, return bytes written or -1
+static ssize_t flush_file(out_seg_t *seg, int sockfd)
+{
+    ssize_t writed;
+    if (seg->path == FILE_SPLICE)
+    {
+        writed = splice_file(seg, sockfd);
+        if (writed >= 0 || (errno != EINVAL && errno != ENOSYS))
+            return writed;
+        // neither the file nor the socket splices, stay with the copy path
+        seg->path = FILE_COPY;
+    }
+    if (seg->path == FILE_COPY)
+        return copy_file(seg, sockfd);
+    writed = sendfile(sockfd, seg->fd, &seg->off, seg->len);
+    if (writed < 0 && (errno == EINVAL || errno == ENOSYS))
+    {
+        // this file (or socket) does not support sendfile, try a pipe before a buffer copy
+        seg->path = FILE_SPLICE;
+        return flush_file(seg, sockfd);
+    }
+    if (writed == 0)
+    {
+        // file shrunk, the promised length can not be sent
+        errno = EIO;
+        return -1;
+    }
+    if (writed > 0)
+        seg->len -= writed;
+    return writed;
+}
+
+int outq_flush(out_queue_t *q, int sockfd)
+{
+    return outq_flush_max(q, sockfd, 0);
+}
+
+void outq_cork(out_queue_t *q, int sockfd)
+{
+    if (!q->corked && q->head < q->count)
+    {
+        sockopt_cork(sockfd, 1);
+        q->corked = 1;
+    }
+}
+
+// undo what outq_cork and outq_stream_end set for the response just written
+static void outq_release_socket(out_queue_t *q, int sockfd)
+{
+    if (q->corked)
+    {
+        sockopt_cork(sockfd, 0);
+        q->corked = 0;
+    }
+    if (q->nodelay)
+    {
+        // back to Nagle for the next responses on the connection
+        int zero = 0;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &zero, sizeof(zero));
+        q->nodelay = 0;
+    }
+}
+
+int outq_flush_max(out_queue_t *q, int sockfd, size_t max)
+{
+    size_t start = q->sent;
+    // corked once per response, retries after OUTQ_AGAIN find it corked already
+    outq_cork(q, sockfd);
+    while (q->head < q->count)
+    {
+        if (max && q->sent - start >= max)
+        {
+            // the rest is written by a later call, do not hold back what was written
+            if (q->corked)
+            {
+                sockopt_cork(sockfd, 0);
+                q->corked = 0;
+            }
+            return OUTQ_MORE;
+        }
+        // rendering the next piece is left to the caller, it may not be the engine's thread to do it
+        if (outq_wants_piece(q))
+            return OUTQ_GENERATE;
+        out_seg_t *seg = &q->segs[q->head];
+        ssize_t writed;
+        if (seg->kind != SEG_FILE)
+            writed = flush_mem(q, sockfd);
+        else
+        {
+            writed = seg->len ? flush_file(seg, sockfd) : 0;
+            if (writed >= 0 && seg->len == 0)
+                outq_pop(q);
+            if (writed > 0)
+                q->sent += writed;
+        }
+        if (writed < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return OUTQ_AGAIN;
+            perror("ERROR: write response to fd failed");
+            return OUTQ_ERROR;
+        }
+    }
+    outq_release_socket(q, sockfd);
+    return OUTQ_DONE;
+}
+
+int outq_empty(out_queue_t *q)
+{
+    return q->head == q->count;
+}
+
+void outq_clear(out_queue_t *q)
+{
+    for (int i = q->head; i < q->count; i++)
+        if (q->segs[i].release)
+            q->segs[i].release(q->segs[i].release_arg);
+    q->head = 0;
+    q->count = 0;
+    q->corked = 0;
+    q->nodelay = 0;
+}
+
+void outq_free(out_queue_t *q)
+{
+    outq_clear(q);
+    free(q->segs);
+    q->segs = NULL;
+    q->cap = 0;
+}
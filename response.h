@@ -0,0 +1,217 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * response.h
+ *
+ * This file declares the output queue a response is built into.
+ * a response is a list of segments (memory buffers, file ranges or
+ * generated content) that are written to the client socket in order,
+ * on blocking and non-blocking sockets alike.
+ */
+
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+// kinds of segments in the output queue
+#define SEG_MEM 1
+#define SEG_FILE 2
+#define SEG_GEN 3
+
+// ways a file segment is written to the socket, the next one is tried when one is not supported
+#define FILE_SENDFILE 0 //sendfile from the page cache
+#define FILE_SPLICE 1	//splice through a per-thread pipe
+#define FILE_COPY 2		//pread and write through a per-thread buffer
+
+// outq_flush return values
+#define OUTQ_DONE 0
+#define OUTQ_AGAIN 1
+#define OUTQ_ERROR -1
+#define OUTQ_MORE 2
+#define OUTQ_GENERATE 3
+
+typedef void (*release_fn)(void *);
+
+/**
+ * produces the next piece of a generated segment into *data and *len, valid until
+ * the next call. returns 1 if more pieces follow, 0 if this piece is the last,
+ * -1 on failure
+ */
+typedef int (*generate_fn)(void *arg, const char **data, size_t *len);
+
+/**
+ * one piece of a response
+ */
+typedef struct out_seg_st
+{
+	int kind;			//SEG_MEM, SEG_FILE or SEG_GEN
+	const char *data;	//SEG_MEM, SEG_GEN: next byte to send
+	int fd;				//SEG_FILE: file to send from
+	off_t off;			//SEG_FILE: offset of next byte to send
+	int path;			//SEG_FILE: one of the FILE_ ways, starts with FILE_SENDFILE
+	size_t len;			//bytes left to send (SEG_GEN: of the current piece)
+	generate_fn generate; //SEG_GEN: called for the next piece once len is 0
+	int last;			//SEG_GEN: the current piece is the last
+	release_fn release; //called once the segment is sent or dropped (may be NULL)
+	void *release_arg;
+} out_seg_t;
+
+/**
+ * the queue of segments waiting to be written to a socket
+ */
+typedef struct out_queue_st
+{
+	out_seg_t *segs; //growable array of segments
+	int head;		 //first segment not fully sent
+	int count;		 //number of segments in the array
+	int cap;		 //allocated size of the array
+	unsigned long sent; //bytes written since the queue was created
+	unsigned long queued; //bytes queued since the queue was created
+	int status;			 //status code of the last response head queued
+	int corked;			 //1 while the socket is corked for the response being written
+	int nodelay;		 //1 if outq_stream_end turned TCP_NODELAY on for the response being written
+} out_queue_t;
+
+/**
+ * a piece of a growable chunked buffer
+ */
+typedef struct chunk_st
+{
+	struct chunk_st *next;
+	size_t len;	 //bytes used
+	size_t size; //bytes allocated in data
+	char data[];
+} chunk_t;
+
+/**
+ * growable buffer made of separately allocated chunks, used to render
+ * generated content without one large contiguous allocation
+ */
+typedef struct chunk_buf_st
+{
+	chunk_t *head;
+	chunk_t *tail;
+	size_t total;	   //bytes in all chunks
+	size_t chunk_size; //size of newly allocated chunks
+} chunk_buf_t;
+
+/**
+ * chunkbuf_printf appends formatted text, returns -1 on memory failure
+ */
+int chunkbuf_printf(chunk_buf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * chunkbuf_append appends len bytes of data, returns -1 on memory failure
+ */
+int chunkbuf_append(chunk_buf_t *b, const char *data, size_t len);
+
+/**
+ * chunkbuf_free frees every chunk and empties the buffer
+ */
+void chunkbuf_free(chunk_buf_t *b);
+
+/**
+ * outq_push_mem appends a memory segment, the queue does not copy data.
+ * release(release_arg) is called when the segment is done with.
+ * returns 0 on success, -1 on memory failure (release is called on failure).
+ */
+int outq_push_mem(out_queue_t *q, const char *data, size_t len, release_fn release, void *release_arg);
+
+/**
+ * outq_push_copy appends a private copy of data to the queue.
+ */
+int outq_push_copy(out_queue_t *q, const char *data, size_t len);
+
+/**
+ * outq_push_chunks moves every chunk of b into the queue, b is left empty
+ */
+int outq_push_chunks(out_queue_t *q, chunk_buf_t *b);
+
+/**
+ * outq_push_file appends len bytes of fd starting at off.
+ */
+int outq_push_file(out_queue_t *q, int fd, off_t off, size_t len, release_fn release, void *release_arg);
+
+/**
+ * outq_push_gen appends content produced piece by piece by generate(arg) while the
+ * queue is written, so it is never held in memory as a whole. the first piece is
+ * generated at once. release(arg) is called when the segment is done with.
+ * returns 0 on success, -1 on failure (release is called on failure).
+ */
+int outq_push_gen(out_queue_t *q, generate_fn generate, void *arg, release_fn release);
+
+/**
+ * outq_ensure makes room for n more segments, so the next n pushes of memory
+ * and file segments can not fail. returns -1 on memory failure.
+ */
+int outq_ensure(out_queue_t *q, int n);
+
+/**
+ * outq_flush writes as much of the queue as the socket accepts.
+ * returns OUTQ_DONE when the queue is empty, OUTQ_AGAIN when a
+ * non-blocking socket is full, OUTQ_GENERATE when a generated segment
+ * at the head needs its next piece (outq_generate), OUTQ_ERROR on write failure.
+ */
+int outq_flush(out_queue_t *q, int sockfd);
+
+/**
+ * outq_flush_max is outq_flush that stops after writing max bytes or more,
+ * returning OUTQ_MORE with the rest of the queue left for a later call.
+ * max 0 writes without a limit.
+ */
+int outq_flush_max(out_queue_t *q, int sockfd, size_t max);
+
+/**
+ * outq_cork corks sockfd once for the response in q (TCP_CORK coalescing only),
+ * outq_flush uncorks it when the queue was written or OUTQ_MORE leaves the rest for later
+ */
+void outq_cork(out_queue_t *q, int sockfd);
+
+/**
+ * outq_iov fills iov with up to max memory segments from the head of the queue,
+ * for engines that write asynchronously. the piece of a generated segment ends the list.
+ * *more is set to 1 if a file segment or another piece follows them. returns the number
+ * of iovecs, 0 if the head is a file segment, a generated segment waiting for its next
+ * piece, or the queue is empty (outq_flush tells them apart).
+ */
+int outq_iov(out_queue_t *q, struct iovec *iov, int max, int *more);
+
+/**
+ * outq_generate produces the next piece of the generated segment at the head once the
+ * previous one was sent, nothing otherwise. it renders (and compresses) content, so the
+ * event-driven engines run it in a pool job. returns -1 if generating failed.
+ */
+int outq_generate(out_queue_t *q);
+
+/**
+ * outq_stream_end prepares sockfd for the n iovecs outq_iov returned: when they end
+ * generated content, the pieces before were held back with MSG_MORE and the last one
+ * must not wait (Nagle) for their ACK, so the socket is switched to TCP_NODELAY
+ * until outq_flush sees the queue written
+ */
+void outq_stream_end(out_queue_t *q, int n, int sockfd);
+
+/**
+ * outq_advance drops writed bytes of the memory segments outq_iov returned
+ */
+void outq_advance(out_queue_t *q, size_t writed);
+
+/**
+ * outq_empty returns 1 when nothing is left to send
+ */
+int outq_empty(out_queue_t *q);
+
+/**
+ * outq_clear releases every segment and resets the queue for reuse
+ */
+void outq_clear(out_queue_t *q);
+
+/**
+ * outq_free releases every segment and the queue's own memory
+ */
+void outq_free(out_queue_t *q);
+
+// release function for SEG_FILE segments that own their descriptor
+void release_close_fd(void *fd);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,34 +8,209 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <poll.h>
+#include <strings.h>
+#include <ctype.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include "threadpool.h"
+#include "reactor.h"
+#include "uring.h"
+#include "connpool.h"
+#include "filecache.h"
+#include "dirlist.h"
+#include "resolve.h"
+#include "headers.h"
+#include "conditional.h"
+#include "compress.h"
+#include "mime.h"
+#include "stats.h"
+#include "accesslog.h"
+#include "sockopt.h"
+#include "keepalive.h"
 
 #define OK 200
+#define PARTIAL_CONTENT 206
 #define FOUND 302
+#define NOT_MODIFIED 304
 #define BAD_REQUEST 400
 #define FORBIDDEN 403
 #define NOT_FOUND 404
 #define INTERNAL_SERVER_ERROR 500
 #define NOT_SUPPORTED 501
+#define RANGE_NOT_SATISFIABLE 416
+#define SERVICE_UNAVAILABLE 503
 
 #define DIR_CONTENT 102
 #define RETURN_FILE 103
+#define STATS_PAGE 104
 
-#define REQ_MAX_SIZE 4000
-#define MIN_RES_SIZE 300
 
 #define RFC1123FMT "%a, %d %b %Y %H:%M:%S GMT"
-#define FOUND_RESPONSE_TAMPLATE "HTTP/1.1 302 Found\r\nServer: webserver/1.0\r\nDate: %s\r\nLocation: %s/\r\nContent-Type: text/html\r\nContent-Length: %d\r\nConnection: close\r\n\r\n<HTML><HEAD><TITLE>302 Found</TITLE></HEAD><BODY><H4>302 Found</H4>Directories must end with a slash.</BODY></HTML>"
-#define ERROR_RESPONSE_TAMPLATE "HTTP/1.1 %s\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: %d\r\nConnection: close\r\n\r\n<HTML><HEAD><TITLE>%s</TITLE></HEAD><BODY><H4>%s</H4>%s</BODY></HTML>"
-#define FILE_RESPONSE_TAMPLATE "HTTP/1.1 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: %s\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n"
-#define DIR_HEADERS_TAMPLATE "HTTP/1.1 200 OK\r\nServer: webserver/1.0\r\nDate: %s\r\nContent-Type: text/html\r\nContent-Length: %ld\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n"             // 130
-#define DIR_TABLE_HEAD_TEMPLATE "<HTML>\n<HEAD><TITLE>Index of %s</TITLE></HEAD>\n<BODY>\n<H4>Index of %s</H4>\n<table CELLSPACING=8>\n<tr><th>Name</th><th>Last Modified</th><th>Size</th></tr>\n" // 152
-#define DIR_ENTERY_TAMPLATE "<tr>\n<td><A HREF=\"%s\">%s</A></td>\n<td>%s</td>\n<td>%s</td>\n</tr>"                                                                                                 // 55                                                                                                                                                                                                                                      // 53
-#define DIR_TABLE_END_TEMPLATE "</table>\n<HR>\n<ADDRESS>webserver/1.0</ADDRESS>\n</BODY>\n</HTML>"                                                                                                 // 62
+#define FILE_HEADERS_TAMPLATE "Content-Type: %s\r\nContent-Length: %ld\r\nLast-Modified: %s\r\nETag: %s\r\nAccept-Ranges: bytes\r\n%s"
+#define ENCODED_HEADERS_TAMPLATE "Content-Type: %s\r\nContent-Encoding: %s\r\nContent-Length: %ld\r\nLast-Modified: %s\r\nETag: %s\r\n" VARY_HEADER
+#define NOT_MODIFIED_HEADERS_TAMPLATE "Last-Modified: %s\r\nETag: %s\r\n%s"
+#define RANGE_HEADERS_TAMPLATE "Content-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\nContent-Length: %ld\r\nLast-Modified: %s\r\nETag: %s\r\nAccept-Ranges: bytes\r\n"
+#define MULTIPART_HEADERS_TAMPLATE "Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %ld\r\nLast-Modified: %s\r\nETag: %s\r\nAccept-Ranges: bytes\r\n"
+#define PART_HEADERS_TAMPLATE "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n"
+#define PART_END_TAMPLATE "\r\n--%s--\r\n"
+#define UNSATISFIABLE_HEADER_TAMPLATE "\r\nContent-Range: bytes */%ld"
+#define DIR_HEADERS_TAMPLATE "Content-Type: text/html\r\n%sContent-Length: %ld\r\nLast-Modified: %s\r\n" VARY_HEADER
+#define DIR_CHUNKED_HEADERS_TAMPLATE "Content-Type: text/html\r\n%sTransfer-Encoding: chunked\r\nLast-Modified: %s\r\n" VARY_HEADER
+#define LAST_CHUNK "0\r\n\r\n"
+#define CONTENT_ENCODING_TAMPLATE "Content-Encoding: %s\r\n"
+#define VARY_HEADER "Vary: Accept-Encoding\r\n"
+#define STATS_HEADERS_TAMPLATE "Content-Type: application/json\r\nContent-Length: %ld\r\nCache-Control: no-store\r\n"
+#define POOL_STATS_TAMPLATE "{\"threads\":%d,\"qsize\":%d,\"idle\":%d,\"dispatched\":%lu,\"rejected\":%lu,\"expired\":%lu,\"grows\":%lu,\"shrinks\":%lu,\"bulk_queued\":%d,\"bulk_running\":%d,\"bulk_dispatched\":%lu}"
+// extra line of a 503, goes right after the Date value like every canned header line
+#define RETRY_AFTER_HEADER "\r\nRetry-After: 1"
+#define STATS_PATH "/__stats"
+#define DIR_CHUNK_SIZE 16384
+
+#define KEEPALIVE_REQUESTS 100
+#define KEEPALIVE_TIMEOUT 5
+#define HEADER_TIMEOUT 10
+#define SEND_TIMEOUT 10
+#define SEND_MIN_RATE 1024
+#define BULK_MIN_KB 1024
+#define BULK_SLICE_KB 512
+#define BULK_RESERVE 1
+#define CACHE_SIZE_MB 64
+#define CACHE_ENTRIES 1024
+#define CACHE_SMALL_KB 64
+#define CACHE_REVALIDATE 2
+#define RESOLVE_MAX_DIRS 4096
+#define CONN_POOL_SIZE 1024
+#define REQUEST_ARENA_SIZE 4096
+#define THREAD_STACK_KB 256
+#define LISTEN_BACKLOG 128
+#define ACCEPT_BATCH 64
+#define COMPRESS_MAX_KB 1024
+
+// runtime settings collected from the command line
+typedef struct server_config
+{
+    int port;
+    int pool_size;
+    int max_request;
+    int use_epoll;          // 1 - serve connections from the epoll reactor
+    int use_uring;          // 1 - serve connections from the io_uring engine instead of the reactor
+    int keepalive_requests; // max requests answered on one connection
+    int keepalive_timeout;  // seconds an idle connection is kept open, 0 - no keep-alive
+    int header_timeout;     // seconds a request may take to arrive, 0 - no limit
+    int send_timeout;       // seconds of a send window, 0 - no limit
+    int send_min_rate;      // bytes per second a client must take of a response
+    int bulk_min;           // KB, blocking mode responses this large are sent from the pool's bulk lane, 0 - one lane
+    int bulk_slice;         // KB a bulk response sends before it queues up again
+    int bulk_reserve;       // pool threads that never send bulk responses
+    int cache_size;         // MB of file content held in memory, 0 - no file cache
+    int cache_entries;      // max files in the cache
+    int cache_small;        // KB, files up to this size are held in memory
+    int cache_revalidate;   // seconds between stat checks of a cached file
+    int pool_mode;          // THREADPOOL_MUTEX or THREADPOOL_WORK_STEALING
+    int conn_pool_size;     // connection objects allocated up front
+    int stack_size;         // KB of stack per pool thread, 0 - system default
+    int listeners;          // SO_REUSEPORT listeners, each with its own accept thread and threadpool
+    int backlog;            // listen backlog of every listener
+    int pin_cpus;           // 1 - pin every listener shard to its own cpu
+    int compress_max;       // KB, larger files are not compressed on the fly, 0 - only precompressed sidecars
+    char *mime_types;       // mime.types-style file adding to the built-in types, NULL if none
+    int stats;              // 1 - count metrics and serve them at STATS_PATH
+    int queue_max;          // jobs queued per threadpool before new clients get a 503, 0 - unbounded
+    int queue_wait;         // ms a job may wait in the queue before it is answered with a 503, 0 - no limit
+    int pool_max;           // threads the pool may grow to, 0 - pool-size (fixed)
+    int pool_idle;          // seconds an idle thread above pool-size waits before it exits
+    char *access_log;       // file the access log is appended to, NULL - no access log
+} server_config;
+
+static server_config config = {
+    .keepalive_requests = KEEPALIVE_REQUESTS,
+    .keepalive_timeout = KEEPALIVE_TIMEOUT,
+    .header_timeout = HEADER_TIMEOUT,
+    .send_timeout = SEND_TIMEOUT,
+    .send_min_rate = SEND_MIN_RATE,
+    .bulk_min = BULK_MIN_KB,
+    .bulk_slice = BULK_SLICE_KB,
+    .bulk_reserve = BULK_RESERVE,
+    .cache_size = CACHE_SIZE_MB,
+    .cache_entries = CACHE_ENTRIES,
+    .cache_small = CACHE_SMALL_KB,
+    .cache_revalidate = CACHE_REVALIDATE,
+    .pool_mode = THREADPOOL_MUTEX,
+    .conn_pool_size = CONN_POOL_SIZE,
+    .stack_size = THREAD_STACK_KB,
+    .listeners = 1,
+    .backlog = LISTEN_BACKLOG,
+    .compress_max = COMPRESS_MAX_KB,
+    .pool_idle = POOL_IDLE_TIMEOUT};
+
+// shared static file cache, NULL when disabled
+static filecache *file_cache;
+// opens request paths below the docroot (the working directory)
+static resolver *path_resolver;
+// connection objects and their request arenas
+static conn_pool *connections;
+// blocking mode: keep-alive connections waiting for their next request, NULL if none are kept
+static keepalive *idle_clients;
+// threadpools reported by the stats page
+static threadpool *stats_pools[MAXT_IN_POOL];
+static int stats_npools;
+static pthread_mutex_t stats_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// details of the request being answered that shape the response headers
+typedef struct request_info
+{
+    char *now;          // response Date
+    char *path;         // path the response is about, relative to the docroot
+    arena_t *arena;     // scratch memory of the connection, valid until the response was written
+    int keep_alive;     // 1 - connection stays open after the response
+    fc_entry_t *entry;  // cached file to send (referenced), NULL if not cached
+    int fd;             // resolved file or directory, -1 if none
+    struct stat st;     // stat of fd
+    http_request *hr;   // the parsed request, slices of buff
+    const char *buff;   // read buffer holding the request
+} request_info;
+
+// a directory listing sent with chunked transfer encoding, rendered a piece at a time
+// while the response is written
+typedef struct dir_stream
+{
+    dir_listing *listing;
+    compress_stream *encoder; // NULL - sent as it is
+    chunk_buf_t page;         // rendered bytes of the current piece
+    chunk_buf_t encoded;      // the same, compressed
+    char *piece;              // the current piece framed as a chunk
+    size_t piece_size;        // bytes allocated in piece
+    int done;                 // the terminating chunk was produced
+} dir_stream;
+
+// the body of a file response and the reference that keeps it alive
+typedef struct file_source
+{
+    fc_entry_t *entry;        // referenced cache entry, NULL for a file owned by the response
+    int fd;                   // file to send from when data is NULL
+    const char *data;         // whole content in memory, NULL to send from fd
+    struct stat *st;          // stat of the file
+    const char *content_type; // mime type of the file
+} file_source;
 
 void usage()
 {
-    printf("Usage: server <port> <pool-size>\n");
+    printf("Usage: server <port> <pool-size> <max-number-of-request> [--epoll] [--uring] [--keepalive-requests <n>] [--keepalive-timeout <sec>]\n"
+           "              [--cache-size <MB>] [--cache-entries <n>] [--cache-small <KB>] [--cache-revalidate <sec>]\n"
+           "              [--pool mutex|ws] [--conn-pool <n>] [--stack-size <KB>]\n"
+           "              [--listeners <n>] [--backlog <n>] [--pin-cpus] [--compress-max <KB>]\n"
+           "              [--mime-types <file>] [--stats] [--queue-max <n>] [--queue-wait <ms>]\n"
+           "              [--pool-max <n>] [--pool-idle <sec>] [--access-log <file>]\n"
+           "              [--header-timeout <sec>] [--send-timeout <sec>] [--send-min-rate <bytes/s>]\n"
+           "              [--coalesce more|cork|off] [--nodelay] [--defer-accept <sec>] [--fastopen <n>] [--sndbuf <KB>]\n"
+           "              [--bulk-min <KB>] [--bulk-slice <KB>] [--bulk-reserve <n>]\n");
 }
 
 size_t log_10(size_t x)
@@ -48,28 +224,6 @@ size_t log_10(size_t x)
     return i;
 }
 
-// function looking for \r\n and put '
-int find_end_line(char *buff)
-{
-    int bn = 0;
-    for (int i = 0; i < REQ_MAX_SIZE; i++)
-    {
-        if (bn == 1)
-        {
-            if (buff[i] == '\n')
-            {
-                buff[i - 1] = '\0';
-                return 1;
-            }
-            else
-                bn = 0;
-        }
-        else if (buff[i] == '\r')
-            bn = 1;
-    }
-    return 0;
-}
-
 // function to check if port is match dev demand
 int validatePort(char *port)
 {
@@ -81,465 +235,1761 @@ int validatePort(char *port)
     return 1;
 }
 
-//function to check permission to path, return: 0 - granted, 302 - fobidden, 500 - sys call
-int check_permission(char *path)
+// map a resolver result to a response code
+int resolve_status(int resolved)
 {
-    // create another empty string to add dir by dir for checking permissions
-    int path_len = strlen(path);
-    char part[path_len + 1];
-    memset(part, '\0', path_len + 1);
-    char *ptr = path;
-    // idx of first '/'
-    int idx = 0;
-    do
+    switch (resolved)
     {
-        ptr = strchr(&ptr[1], '/');
-        if (!ptr)
-            idx = path_len - 1;
-        else
-            idx = (int)(ptr - path);
-        // copy till current dir to check
-        strncpy(part, path, idx + 1);
-        struct stat fs;
-        if (stat(part, &fs) == -1)
-            return INTERNAL_SERVER_ERROR;
-        // in case path pointed dir check for EXEC permissions for OTHER
-        if (S_ISDIR(fs.st_mode))
-            if (!(S_IXOTH & fs.st_mode))
-                return FORBIDDEN;
-        // in case path pointed to reg file check READ permissions for OTHER
-        if (S_ISREG(fs.st_mode))
-        {
-            if (!(S_IROTH & fs.st_mode))
-                return FORBIDDEN;
-            else
-                return 0;
-        }
-    } while (idx < path_len - 1);
+    case RESOLVE_NOT_FOUND:
+        return NOT_FOUND;
+    case RESOLVE_FORBIDDEN:
+        return FORBIDDEN;
+    default:
+        return INTERNAL_SERVER_ERROR;
+    }
+}
+
+// revalidation of a cached file: the permission walk of an uncached request, so a
+// directory on the way that was closed since the file was cached stops it being served
+int recheck_cached(void *resolver_arg, const char *path, struct stat *st)
+{
+    int fd;
+    if (resolve_path((resolver *)resolver_arg, path, &fd, st) != RESOLVE_OK)
+        return -1;
+    close(fd);
     return 0;
 }
 
 // analyse function return a response code.
-// in other case then BAD_REQUEST or NOT_SUPPORTED, request pointer will overwrite to be path
-int analyse(char *request)
+// parsed - result of the parser, HTTP_PARSE_MORE for a request cut short by the client.
+// the path the response is about (starting with ".") is returned in req->path.
+// files found in the cache are returned in req->entry without touching the filesystem,
+// other files and directories are returned open in req->fd with their stat in req->st
+int analyse(int parsed, http_request *hr, const char *buff, request_info *req)
 {
-
-    if (!find_end_line(request))
+    // without a complete request line there is nothing to answer
+    if (parsed == HTTP_PARSE_ERROR || parsed == HTTP_PARSE_TOO_LARGE || hr->method.len == 0)
         return BAD_REQUEST;
-
-    // cut line - put a NULL at the end of the line
-    // validate path not contains a "//"
-    if (strstr(request, "//"))
-        return BAD_REQUEST;
-    // set pointers to required arguments: method, path, protocol
-    char *method, *path, *protocol = NULL;
-    method = strtok(request, " ");
-    path = strtok(NULL, " ");
-    protocol = strtok(NULL, "\0");
-    // validate pointers succesfully created, also validtae http protocol is known
-    if (!method || !path || !protocol || (strncmp(protocol, "HTTP/1.1", 8) != 0 && strncmp(protocol, "HTTP/1.0", 8) != 0))
+    const char *path = &buff[hr->target.off];
+    int path_len = hr->target.len;
+    // validate path not contains a "//" (or a NULL byte)
+    if (path[0] != '/' || memmem(path, path_len, "//", 2) || memchr(path, '\0', path_len))
         return BAD_REQUEST;
     // validtae method support
-    if (strcmp(method, "GET") != 0)
+    if (!http_slice_eq(buff, hr->method, "GET"))
         return NOT_SUPPORTED;
+    if (config.stats && path_len == sizeof(STATS_PATH) - 1 && memcmp(path, STATS_PATH, path_len) == 0)
+        return STATS_PAGE;
     // creating a proper path that starts with "."
-    int proper_path_len = strlen(path) + 2;
-    char proper_path[proper_path_len];
-    sprintf(proper_path, ".%s", path);
-    // request -> path
-    sprintf(request, "%s", proper_path);
-    // validate path integrity
-    if (access(proper_path, F_OK) != 0)
-        return NOT_FOUND;
-    // check_permissions return 0 if permission granted to data
-    int permission = check_permission(proper_path);
-    if (permission > 0)
-        return permission;
-    // get file stat for file information, (stat is sys call so in case of failure return 500 ERROR)
-    struct stat fs;
-    if (stat(proper_path, &fs) == -1)
+    int proper_path_len = path_len + 2;
+    char *proper_path = arena_printf(req->arena, NULL, ".%.*s", path_len, path);
+    char *index_path = arena_printf(req->arena, NULL, ".%.*sindex.html", path_len, path);
+    if (!proper_path || !index_path)
         return INTERNAL_SERVER_ERROR;
-    if (S_ISREG(fs.st_mode))
+    req->path = proper_path;
+    // cached files (and cached index.html of directories) were already checked when cached
+    if (file_cache)
+    {
+        char *key = proper_path[proper_path_len - 2] == '/' ? index_path : proper_path;
+        req->entry = filecache_get(file_cache, key);
+        if (req->entry)
+        {
+            req->path = key;
+            return RETURN_FILE;
+        }
+    }
+    // open the path once below the docroot, permissions are checked on the way
+    int resolved = resolve_path(path_resolver, proper_path, &req->fd, &req->st);
+    if (resolved != RESOLVE_OK)
+        return resolve_status(resolved);
+    if (S_ISREG(req->st.st_mode))
         return RETURN_FILE;
-    if (S_ISDIR(fs.st_mode))
+    if (S_ISDIR(req->st.st_mode))
     {
         if (proper_path[proper_path_len - 2] != '/')
             return FOUND;
-        char index_path[proper_path_len + 10];
-        sprintf(index_path, "%sindex.html", proper_path);
-        if (access(index_path, F_OK) != 0)
+        int index_fd;
+        struct stat index_st;
+        resolved = resolve_path(path_resolver, index_path, &index_fd, &index_st);
+        // no index.html - list the directory
+        if (resolved == RESOLVE_NOT_FOUND)
             return DIR_CONTENT;
-        // check permission to index.html
-        permission = check_permission(index_path);
-        if (permission > 0)
-            return permission;
-        sprintf(request, "%s", index_path);
+        if (resolved != RESOLVE_OK)
+            return resolve_status(resolved);
+        // serve index.html instead of the directory
+        close(req->fd);
+        req->fd = index_fd;
+        req->st = index_st;
+        if (!S_ISREG(index_st.st_mode))
+            return FORBIDDEN;
+        req->path = index_path;
         return RETURN_FILE;
     }
     return FORBIDDEN;
 }
 
-int send_error(int type, int fd, char *now)
+// queue the error response rendered at startup
+int send_error(int type, out_queue_t *out, request_info *req)
+{
+    return queue_error(out, type, req->now, req->keep_alive);
+}
+
+int send_found(char *path, out_queue_t *out, request_info *req)
+{
+    // the path lives in the request buffer, the response outlives it
+    size_t len = strlen(&path[1]);
+    char *location = (char *)arena_alloc(req->arena, len);
+    if (!location)
+        return -1;
+    memcpy(location, &path[1], len);
+    return queue_found(out, location, len, req->now, req->keep_alive);
+}
+
+// drop the reference of a file response that was not queued
+void release_source(file_source *src)
+{
+    if (src->entry)
+        filecache_release(src->entry);
+    else
+        release_close_fd((void *)(intptr_t)src->fd);
+}
+
+// queue len bytes of the body starting at off, the last segment holds the reference of src
+int push_body(out_queue_t *out, file_source *src, off_t off, size_t len, int last)
 {
-    const int SIZE = 30;
-    char response_type[SIZE];
-    char response_body[SIZE];
-    char response[300];
-    switch (type)
+    release_fn release = NULL;
+    void *release_arg = NULL;
+    if (last)
     {
-    case BAD_REQUEST:
-        strncpy(response_type, "400 Bad Request", SIZE);
-        strncpy(response_body, "Bad Request.", SIZE);
-        break;
-    case FORBIDDEN:
-        strncpy(response_type, "403 Forbidden", SIZE);
-        strncpy(response_body, "Access Denied.", SIZE);
-        break;
-    case NOT_FOUND:
-        strncpy(response_type, "404 Not Found", SIZE);
-        strncpy(response_body, "File not found.", SIZE);
-        break;
-    case INTERNAL_SERVER_ERROR:
-        strncpy(response_type, "500 Internal Server Error", SIZE);
-        strncpy(response_body, "Some server side error.", SIZE);
-        break;
-    case NOT_SUPPORTED:
-        strncpy(response_type, "501 Not supported", SIZE);
-        strncpy(response_body, "Method is not supported.", SIZE);
-        break;
+        release = src->entry ? filecache_release : release_close_fd;
+        release_arg = src->entry ? (void *)src->entry : (void *)(intptr_t)src->fd;
+    }
+    if (src->data)
+        return outq_push_mem(out, src->data + off, len, release, release_arg);
+    return outq_push_file(out, src->fd, off, len, release, release_arg);
+}
+
+// 304: the validators only, no body
+int send_not_modified(out_queue_t *out, request_info *req, const char *etag, const char *last_modified, int vary)
+{
+    size_t len;
+    char *headers = arena_printf(req->arena, &len, NOT_MODIFIED_HEADERS_TAMPLATE, last_modified, etag, vary ? VARY_HEADER : "");
+    // head fragments, headers and connection: nothing is queued unless all of it is
+    if (!headers || outq_ensure(out, 5) < 0)
+        return -1;
+    queue_status_head(out, NOT_MODIFIED, req->now);
+    outq_push_mem(out, headers, len, NULL, NULL);
+    return queue_connection(out, req->keep_alive);
+}
+
+// 206 with one range, the body is a slice of the file
+int send_range(out_queue_t *out, request_info *req, file_source *src, byte_range *range, const char *etag, const char *last_modified)
+{
+    size_t len;
+    long range_len = range->last - range->first + 1;
+    char *headers = arena_printf(req->arena, &len, RANGE_HEADERS_TAMPLATE, src->content_type, (long)range->first, (long)range->last,
+                                 (long)src->st->st_size, range_len, last_modified, etag);
+    // head fragments, headers, connection and the body: nothing fails once there is room
+    if (!headers || outq_ensure(out, 6) < 0)
+    {
+        release_source(src);
+        return -1;
+    }
+    queue_status_head(out, PARTIAL_CONTENT, req->now);
+    outq_push_mem(out, headers, len, NULL, NULL);
+    queue_connection(out, req->keep_alive);
+    return push_body(out, src, range->first, range_len, 1);
+}
+
+// 206 multipart/byteranges, every range is a part with its own headers
+int send_multipart(out_queue_t *out, request_info *req, file_source *src, byte_range *ranges, int count, const char *etag,
+                   const char *last_modified)
+{
+    // the boundary is the ETag without its quotes, it only needs to be absent from the part headers
+    char *boundary = arena_printf(req->arena, NULL, "webserver-%.*s", (int)strlen(etag) - 2, etag + 1);
+    char **parts = (char **)arena_alloc(req->arena, count * sizeof(char *));
+    size_t *parts_len = (size_t *)arena_alloc(req->arena, count * sizeof(size_t));
+    size_t end_len = 0;
+    char *end = boundary ? arena_printf(req->arena, &end_len, PART_END_TAMPLATE, boundary) : NULL;
+    if (!end || !parts || !parts_len)
+    {
+        release_source(src);
+        return -1;
+    }
+    // render the part headers first, they count in the Content-Length
+    long content_len = end_len;
+    for (int i = 0; i < count; i++)
+    {
+        parts[i] = arena_printf(req->arena, &parts_len[i], PART_HEADERS_TAMPLATE, boundary, src->content_type, (long)ranges[i].first,
+                                (long)ranges[i].last, (long)src->st->st_size);
+        if (!parts[i])
+        {
+            release_source(src);
+            return -1;
+        }
+        content_len += parts_len[i] + (ranges[i].last - ranges[i].first + 1);
+    }
+    size_t len;
+    char *headers = arena_printf(req->arena, &len, MULTIPART_HEADERS_TAMPLATE, boundary, content_len, last_modified, etag);
+    // the body segments share one reference, so no push may fail half way
+    if (!headers || outq_ensure(out, 5 + 2 * count + 1) < 0)
+    {
+        release_source(src);
+        return -1;
+    }
+    queue_status_head(out, PARTIAL_CONTENT, req->now);
+    outq_push_mem(out, headers, len, NULL, NULL);
+    queue_connection(out, req->keep_alive);
+    for (int i = 0; i < count; i++)
+    {
+        outq_push_mem(out, parts[i], parts_len[i], NULL, NULL);
+        push_body(out, src, ranges[i].first, ranges[i].last - ranges[i].first + 1, 0);
+    }
+    // the closing boundary is the last segment, it releases the file
+    release_fn release = src->entry ? filecache_release : release_close_fd;
+    void *release_arg = src->entry ? (void *)src->entry : (void *)(intptr_t)src->fd;
+    return outq_push_mem(out, end, end_len, release, release_arg);
+}
+
+// answer a request with If-None-Match, If-Modified-Since or Range headers.
+// returns 1 if a response was queued (and src handed over), 0 to send the whole file
+int send_conditional(out_queue_t *out, request_info *req, file_source *src)
+{
+    char etag[ETAG_SIZE];
+    char last_modified[HTTP_DATE_LEN + 1];
+    make_etag(src->st, etag);
+    http_format_date(last_modified, src->st->st_mtime);
+    int sent;
+    byte_range ranges[RANGE_MAX];
+    int count;
+    if (request_not_modified(req->hr, req->buff, etag, src->st->st_mtime))
+    {
+        sent = send_not_modified(out, req, etag, last_modified, compressible_type(src->content_type));
+        release_source(src);
+    }
+    else
+    {
+        switch (request_ranges(req->hr, req->buff, etag, last_modified, src->st->st_size, ranges, &count))
+        {
+        case RANGE_OK:
+            // both release src whether they succeed or not
+            if (count == 1)
+                sent = send_range(out, req, src, &ranges[0], etag, last_modified);
+            else
+                sent = send_multipart(out, req, src, ranges, count, etag, last_modified);
+            break;
+        case RANGE_UNSATISFIABLE:
+        {
+            size_t len;
+            char *header = arena_printf(req->arena, &len, UNSATISFIABLE_HEADER_TAMPLATE, (long)src->st->st_size);
+            // head, Date, the header line and the tail: queued whole or not at all
+            sent = header && outq_ensure(out, 4) == 0 ? queue_error_header(out, RANGE_NOT_SATISFIABLE, req->now, header, len, req->keep_alive) : -1;
+            release_source(src);
+            break;
+        }
+        default:
+            return 0;
+        }
+    }
+    if (sent < 0)
+    {
+        // nothing of the response was queued: a 500 tells the client, the connection closes after it
+        req->keep_alive = 0;
+        send_error(INTERNAL_SERVER_ERROR, out, req);
+    }
+    return 1;
+}
+
+// the encoding to send a file of content_type in: ENC_NONE unless the type is worth
+// compressing, the client accepts an encoding and asks for the whole file
+int response_encoding(request_info *req, const char *content_type)
+{
+    if (!compressible_type(content_type) || http_find_header(req->hr, req->buff, "Range"))
+        return ENC_NONE;
+    return accepted_encoding(req->hr, req->buff);
+}
+
+// ETag of the encoded form of a file: the file's ETag with the encoding appended
+void variant_etag(const struct stat *st, int enc, char *etag)
+{
+    make_etag(st, etag);
+    size_t len = strlen(etag);
+    snprintf(&etag[len - 1], ETAG_SIZE - len + 1, "-%s\"", encoding_name(enc));
+}
+
+// header lines of the encoded form (len bytes) of the file with stat st, rendered into the arena
+char *encoded_headers(request_info *req, const struct stat *st, const char *content_type, int enc, size_t len, size_t *headers_len)
+{
+    char etag[ETAG_SIZE];
+    char last_modified[HTTP_DATE_LEN + 1];
+    variant_etag(st, enc, etag);
+    http_format_date(last_modified, st->st_mtime);
+    return arena_printf(req->arena, headers_len, ENCODED_HEADERS_TAMPLATE, content_type, encoding_name(enc), (long)len, last_modified, etag);
+}
+
+// open the precompressed sidecar of path for enc (path + ".gz" / ".br"),
+// -1 if there is none or it is older than the file with stat st
+int open_sidecar(const char *path, const struct stat *st, int enc, struct stat *sidecar_st)
+{
+    char sidecar_path[strlen(path) + 4];
+    sprintf(sidecar_path, "%s%s", path, encoding_suffix(enc));
+    int fd;
+    if (resolve_path(path_resolver, sidecar_path, &fd, sidecar_st) != RESOLVE_OK)
+        return -1;
+    if (!S_ISREG(sidecar_st->st_mode) || sidecar_st->st_mtime < st->st_mtime)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// read the whole file open at fd, NULL on failure
+char *read_content(int fd, size_t size)
+{
+    char *content = (char *)malloc(size ? size : 1);
+    size_t readed = 0;
+    while (content && readed < size)
+    {
+        ssize_t n = pread(fd, &content[readed], size - readed, readed);
+        if (n <= 0)
+        {
+            perror("ERROR: read file failed");
+            free(content);
+            return NULL;
+        }
+        readed += n;
+    }
+    return content;
+}
+
+// find the encoded variant enc of entry: its sidecar, or the content compressed once.
+// returns the state of the variant, VARIANT_READY if it can be sent
+int load_variant(request_info *req, fc_entry_t *entry, int enc)
+{
+    int state = filecache_variant(entry, enc);
+    if (state != VARIANT_UNKNOWN)
+        return state;
+    struct stat sidecar_st;
+    int fd = open_sidecar(entry->path, &entry->st, enc, &sidecar_st);
+    char *data = NULL;
+    size_t len = 0;
+    if (fd >= 0)
+        len = sidecar_st.st_size;
+    else if (config.compress_max > 0 && entry->st.st_size >= COMPRESS_MIN_SIZE && entry->st.st_size <= (off_t)config.compress_max * 1024)
+    {
+        // compressed once, later requests take it from the entry until the file changes
+        char *content = entry->data ? entry->data : read_content(entry->fd, entry->st.st_size);
+        if (content)
+            data = compress_buffer(enc, content, entry->st.st_size, &len);
+        if (content != entry->data)
+            free(content);
+        // no gain, the file is sent as it is
+        if (data && len >= (size_t)entry->st.st_size)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    char *headers = fd >= 0 || data ? encoded_headers(req, &entry->st, entry->content_type, enc, len, NULL) : NULL;
+    filecache_set_variant(entry, enc, data, fd, len, headers);
+    return filecache_variant(entry, enc);
+}
+
+// queue the encoded form of the file with stat st. body holds the encoded content (len bytes)
+// and the reference that keeps it alive, headers the rendered header lines
+int send_encoded(out_queue_t *out, request_info *req, const struct stat *st, int enc, const char *headers, size_t headers_len,
+                 file_source *body, size_t len)
+{
+    if (request_is_conditional(req->hr, req->buff))
+    {
+        char etag[ETAG_SIZE];
+        char last_modified[HTTP_DATE_LEN + 1];
+        variant_etag(st, enc, etag);
+        http_format_date(last_modified, st->st_mtime);
+        if (request_not_modified(req->hr, req->buff, etag, st->st_mtime))
+        {
+            send_not_modified(out, req, etag, last_modified, 1);
+            release_source(body);
+            return 0;
+        }
+    }
+    if (queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, headers, headers_len, NULL, NULL) < 0 ||
+        queue_connection(out, req->keep_alive) < 0)
+    {
+        release_source(body);
+        return -1;
+    }
+    return push_body(out, body, 0, len, 1);
+}
+
+// send the precompressed sidecar of a file that is not cached.
+// returns 1 if it was queued (src is then released), 0 to send the file itself
+int send_sidecar(out_queue_t *out, request_info *req, const char *path, file_source *src, int enc)
+{
+    struct stat sidecar_st;
+    int sidecar = open_sidecar(path, src->st, enc, &sidecar_st);
+    if (sidecar < 0)
+        return 0;
+    file_source body = {.fd = sidecar, .st = &sidecar_st};
+    size_t headers_len;
+    char *headers = encoded_headers(req, src->st, src->content_type, enc, sidecar_st.st_size, &headers_len);
+    if (headers)
+        send_encoded(out, req, src->st, enc, headers, headers_len, &body, sidecar_st.st_size);
+    else
+        release_source(&body);
+    release_source(src);
+    return 1;
+}
+
+// function to queue file response to client. received: path to file, output queue, request info.
+// the file is served from the cache entry in req, or opened and added to the cache
+int send_file(char *path, out_queue_t *out, request_info *req)
+{
+    fc_entry_t *entry = req->entry;
+    req->entry = NULL;
+    if (!entry)
+    {
+        // the file resolved by analyse, the output queue (or the cache) closes it
+        int file = req->fd;
+        struct stat fs = req->st;
+        req->fd = -1;
+        // get the relevant content type (text/html / imj ...)
+        const char *content_type = mime_type(path);
+        char etag[ETAG_SIZE];
+        char last_modified[HTTP_DATE_LEN + 1];
+        make_etag(&fs, etag);
+        http_format_date(last_modified, fs.st_mtime);
+        char *file_headers = arena_printf(req->arena, NULL, FILE_HEADERS_TAMPLATE, content_type, fs.st_size, last_modified, etag,
+                                          compressible_type(content_type) ? VARY_HEADER : "");
+        entry = file_cache && file_headers ? filecache_insert(file_cache, path, file, &fs, content_type, file_headers) : NULL;
+        if (!entry)
+        {
+            // not cached, send straight from the file (or its precompressed sidecar)
+            file_source src = {.fd = file, .st = &fs, .content_type = content_type};
+            int enc = response_encoding(req, content_type);
+            if (enc != ENC_NONE && send_sidecar(out, req, path, &src, enc))
+                return 0;
+            if (request_is_conditional(req->hr, req->buff) && send_conditional(out, req, &src))
+                return 0;
+            if (!file_headers || queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, file_headers, strlen(file_headers), NULL, NULL) < 0 ||
+                queue_connection(out, req->keep_alive) < 0)
+            {
+                release_close_fd((void *)(intptr_t)file);
+                return 0;
+            }
+            outq_push_file(out, file, 0, fs.st_size, release_close_fd, (void *)(intptr_t)file);
+            return 0;
+        }
+    }
+    int enc = response_encoding(req, entry->content_type);
+    if (enc != ENC_NONE && load_variant(req, entry, enc) == VARIANT_READY)
+    {
+        // the encoded variant held by the entry, its headers copied like the entry's own
+        fc_variant *v = &entry->variants[enc];
+        char *headers = (char *)arena_alloc(req->arena, v->headers_len);
+        if (!headers)
+        {
+            filecache_release(entry);
+            return 0;
+        }
+        memcpy(headers, v->headers, v->headers_len);
+        file_source body = {.entry = entry, .fd = v->fd, .data = v->data, .st = &entry->st};
+        send_encoded(out, req, &entry->st, enc, headers, v->headers_len, &body, v->len);
+        return 0;
+    }
+    file_source src = {.entry = entry, .fd = entry->fd, .data = entry->data, .st = &entry->st, .content_type = entry->content_type};
+    if (request_is_conditional(req->hr, req->buff) && send_conditional(out, req, &src))
+        return 0;
+    // fixed fragments around the pre-rendered header lines of the entry, copied because
+    // the queue may drop the entry (on failure) before the headers were written
+    char *headers = (char *)arena_alloc(req->arena, entry->headers_len);
+    if (headers)
+        memcpy(headers, entry->headers, entry->headers_len);
+    if (!headers || queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, headers, entry->headers_len, NULL, NULL) < 0 ||
+        queue_connection(out, req->keep_alive) < 0)
+    {
+        filecache_release(entry);
+        return 0;
     }
-    // 63 - num of all html tags ONLY in error response
-    int content_length = 63 + 2 * strlen(response_type) + strlen(response_body);
-    sprintf(response, ERROR_RESPONSE_TAMPLATE,
-            response_type, now, content_length, response_type, response_type, response_body);
-    int response_length = strlen(response);
-    int writed = write(fd, response, response_length);
-    if (writed != response_length)
-        perror("error: write headers to fd failed - (send_error)");
-    // printf("----- writed: %d ------\n", writed);
+    // the output queue holds the entry reference until the body was sent
+    if (entry->data)
+        outq_push_mem(out, entry->data, entry->st.st_size, filecache_release, entry);
+    else
+        outq_push_file(out, entry->fd, 0, entry->st.st_size, filecache_release, entry);
     return 0;
 }
-int send_found(char *path, int fd, char *now)
+
+// release function of a dir_stream segment
+void dir_stream_free(void *arg)
+{
+    dir_stream *ds = (dir_stream *)arg;
+    dir_listing_close(ds->listing);
+    if (ds->encoder)
+        compress_stream_close(ds->encoder);
+    chunkbuf_free(&ds->page);
+    chunkbuf_free(&ds->encoded);
+    free(ds->piece);
+    free(ds);
+}
+
+// generate function of a dir_stream segment: renders about DIR_CHUNK_SIZE bytes of the
+// listing and frames them as a chunk, the last piece carries the terminating chunk
+int dir_stream_next(void *arg, const char **data, size_t *len)
+{
+    dir_stream *ds = (dir_stream *)arg;
+    chunk_buf_t *body = ds->encoder ? &ds->encoded : &ds->page;
+    int rendered;
+    do
+    {
+        rendered = dir_listing_render(ds->listing, &ds->page, DIR_CHUNK_SIZE);
+        if (rendered == LISTING_ERROR ||
+            (ds->encoder && compress_stream_write(ds->encoder, &ds->page, rendered == LISTING_DONE, &ds->encoded) < 0))
+            return -1;
+        if (ds->encoder)
+            chunkbuf_free(&ds->page);
+        // a chunk of size 0 would end the body
+    } while (body->total == 0 && rendered == LISTING_MORE);
+    // chunk size line, data, CRLF, and after the last data the terminating chunk
+    size_t need = 20 + body->total + 2 + sizeof(LAST_CHUNK);
+    if (need > ds->piece_size)
+    {
+        char *piece = (char *)realloc(ds->piece, need);
+        if (!piece)
+        {
+            perror("ERROR: MEMORY_ALOC_FAILED");
+            return -1;
+        }
+        ds->piece = piece;
+        ds->piece_size = need;
+    }
+    size_t used = 0;
+    if (body->total > 0)
+    {
+        used = sprintf(ds->piece, "%lx\r\n", (unsigned long)body->total);
+        for (chunk_t *chunk = body->head; chunk; chunk = chunk->next)
+        {
+            memcpy(&ds->piece[used], chunk->data, chunk->len);
+            used += chunk->len;
+        }
+        memcpy(&ds->piece[used], "\r\n", 2);
+        used += 2;
+    }
+    chunkbuf_free(body);
+    if (rendered == LISTING_DONE)
+    {
+        memcpy(&ds->piece[used], LAST_CHUNK, sizeof(LAST_CHUNK) - 1);
+        used += sizeof(LAST_CHUNK) - 1;
+        ds->done = 1;
+    }
+    *data = ds->piece;
+    *len = used;
+    return !ds->done;
+}
+
+// queue a listing rendered while it is written, for HTTP/1.1 clients
+int send_dir_stream(dir_listing *listing, int enc, const char *last_modified, out_queue_t *out, request_info *req)
 {
-    char response[MIN_RES_SIZE + strlen(path)];
-    int content_length = 115;
-    sprintf(response, FOUND_RESPONSE_TAMPLATE, now, &path[1], content_length);
-    int response_length = strlen(response);
-    int writed = write(fd, response, response_length);
-    if (writed != response_length)
-        perror("error: write headers to fd failed - (send_found)");
+    dir_stream *ds = (dir_stream *)calloc(1, sizeof(dir_stream));
+    if (!ds)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        dir_listing_close(listing);
+        return send_error(INTERNAL_SERVER_ERROR, out, req);
+    }
+    ds->listing = listing;
+    ds->page.chunk_size = DIR_CHUNK_SIZE;
+    ds->encoded.chunk_size = DIR_CHUNK_SIZE;
+    const char *encoding = "";
+    if (enc != ENC_NONE)
+    {
+        // the size is not known up front, every listing is compressed
+        char *line = arena_printf(req->arena, NULL, CONTENT_ENCODING_TAMPLATE, encoding_name(enc));
+        if (line && (ds->encoder = compress_stream_open(enc)))
+            encoding = line;
+    }
+    size_t len;
+    char *headers = arena_printf(req->arena, &len, DIR_CHUNKED_HEADERS_TAMPLATE, encoding, last_modified);
+    if (!headers || queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, headers, len, NULL, NULL) < 0 ||
+        queue_connection(out, req->keep_alive) < 0)
+    {
+        dir_stream_free(ds);
+        return 0;
+    }
+    // a failure after the head was queued can only cut the response, the connection closes
+    if (outq_push_gen(out, dir_stream_next, ds, dir_stream_free) < 0)
+        req->keep_alive = 0;
     return 0;
 }
 
-//return str contains type
-char *get_mime_type(char *name)
+int send_dir_content(char *path, out_queue_t *out, request_info *req)
 {
-    char *ext = strrchr(name, '.');
-    if (!ext)
-        return NULL;
-    if (strcmp(ext, ".html") == 0 || strcmp(ext, ".htm") == 0)
-        return "text/html";
-    if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0)
-        return "image/jpeg";
-    if (strcmp(ext, ".gif") == 0)
-        return "image/gif";
-    if (strcmp(ext, ".png") == 0)
-        return "image/png";
-    if (strcmp(ext, ".css") == 0)
-        return "text/css";
-    if (strcmp(ext, ".au") == 0)
-        return "audio/basic";
-    if (strcmp(ext, ".wav") == 0)
-        return "audio/wav";
-    if (strcmp(ext, ".avi") == 0)
-        return "video/x-msvideo";
-    if (strcmp(ext, ".mpeg") == 0 || strcmp(ext, ".mpg") == 0)
-        return "video/mpeg";
-    if (strcmp(ext, ".mp3") == 0)
-        return "audio/mpeg";
-    return NULL;
+    // the directory resolved by analyse, the listing closes it
+    int dirfd = req->fd;
+    struct stat fs = req->st;
+    req->fd = -1;
+    // str to handle last modified time
+    char *timebuf_last_mod = (char *)arena_alloc(req->arena, 128);
+    if (!timebuf_last_mod)
+    {
+        close(dirfd);
+        return send_error(INTERNAL_SERVER_ERROR, out, req);
+    }
+    struct tm tm;
+    strftime(timebuf_last_mod, 128, RFC1123FMT, gmtime_r(&fs.st_mtime, &tm));
+    dir_listing *listing = dir_listing_open(dirfd, path);
+    if (!listing)
+        return send_error(INTERNAL_SERVER_ERROR, out, req);
+    // the page is generated for every request, so it is compressed with fast settings
+    int enc = config.compress_max > 0 ? accepted_encoding(req->hr, req->buff) : ENC_NONE;
+    // HTTP/1.1 clients get the page chunked as it is rendered, the first bytes leave at once
+    if (req->hr->version_minor == 1)
+        return send_dir_stream(listing, enc, timebuf_last_mod, out, req);
+    // HTTP/1.0 has no chunked encoding: render the whole page into heap chunks, its size is the Content-Length
+    chunk_buf_t content = {NULL, NULL, 0, DIR_CHUNK_SIZE};
+    int rendered;
+    while ((rendered = dir_listing_render(listing, &content, DIR_CHUNK_SIZE)) == LISTING_MORE)
+        ;
+    dir_listing_close(listing);
+    if (rendered == LISTING_ERROR)
+    {
+        chunkbuf_free(&content);
+        return send_error(INTERNAL_SERVER_ERROR, out, req);
+    }
+    const char *encoding = "";
+    if (enc != ENC_NONE && content.total >= COMPRESS_MIN_SIZE)
+    {
+        chunk_buf_t encoded = {NULL, NULL, 0, DIR_CHUNK_SIZE};
+        char *line = arena_printf(req->arena, NULL, CONTENT_ENCODING_TAMPLATE, encoding_name(enc));
+        if (line && compress_chunks(enc, &content, &encoded) == 0)
+        {
+            chunkbuf_free(&content);
+            content = encoded;
+            encoding = line;
+        }
+    }
+    //create headers
+    size_t len;
+    char *headers = arena_printf(req->arena, &len, DIR_HEADERS_TAMPLATE, encoding, (long)content.total, timebuf_last_mod);
+    // queue headers then content
+    if (!headers || queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, headers, len, NULL, NULL) < 0 ||
+        queue_connection(out, req->keep_alive) < 0)
+        chunkbuf_free(&content);
+    else
+        outq_push_chunks(out, &content);
+    return 0;
+}
+
+// send the metrics counted since startup as a JSON object
+int send_stats(out_queue_t *out, request_info *req)
+{
+    stats_snapshot snapshot;
+    stats_collect(&snapshot);
+    chunk_buf_t content = {NULL, NULL, 0, DIR_CHUNK_SIZE};
+    int failed = chunkbuf_append(&content, "{", 1) < 0 || stats_render(&content, &snapshot) < 0 ||
+                 chunkbuf_printf(&content, ",\"threadpools\":[") < 0;
+    pthread_mutex_lock(&stats_pools_lock);
+    for (int i = 0; i < stats_npools && !failed; i++)
+    {
+        threadpool_stats ps;
+        threadpool_get_stats(stats_pools[i], &ps);
+        failed = chunkbuf_printf(&content, "%s" POOL_STATS_TAMPLATE, i ? "," : "", ps.threads, ps.queued, ps.idle, ps.dispatched,
+                                 ps.rejected, ps.expired, ps.grows, ps.shrinks, ps.bulk_queued, ps.bulk_running, ps.bulk_dispatched) < 0;
+    }
+    pthread_mutex_unlock(&stats_pools_lock);
+    if (failed || chunkbuf_append(&content, "]}", 2) < 0)
+    {
+        chunkbuf_free(&content);
+        return send_error(INTERNAL_SERVER_ERROR, out, req);
+    }
+    size_t len;
+    char *headers = arena_printf(req->arena, &len, STATS_HEADERS_TAMPLATE, (long)content.total);
+    if (!headers || queue_status_head(out, OK, req->now) < 0 || outq_push_mem(out, headers, len, NULL, NULL) < 0 ||
+        queue_connection(out, req->keep_alive) < 0)
+        chunkbuf_free(&content);
+    else
+        outq_push_chunks(out, &content);
+    return 0;
 }
 
-// function to send file response to client. received: path to dile, file descriptor, corrent time (char *).
-int send_file(char *path, int fd, char *now)
-{
-    struct stat fs;
-    // gets file stat
-    if (stat(path, &fs) == -1)
-        return send_error(INTERNAL_SERVER_ERROR, fd, now);
-    // get last modified time from stat into char * buffer
-    char timebuf_last_mod[128];
-    strftime(timebuf_last_mod, sizeof(timebuf_last_mod), RFC1123FMT, gmtime(&fs.st_mtime));
-    // get the relevant content type (text/html / imj ...)
-    char headers[256];
-    char *content_type = get_mime_type(path);
-    // open stream to file
-    FILE *file = fopen(path, "r");
-    if (!file)
-        return send_error(INTERNAL_SERVER_ERROR, fd, now);
-
-    // create response headers
-    sprintf(headers, FILE_RESPONSE_TAMPLATE, now, content_type, fs.st_size);
-    int headers_length = strlen(headers);
-    // write the headers into file descriptor
-    int writed = write(fd, headers, headers_length);
-    if (writed != headers_length)
-    {
-        perror("error: write headers to fd failed - (send_file)");
-        if (fclose(file) < 0)
-            perror("ERROR: close file failed - leak.");
+// check if the client wants the connection kept open after this request.
+// HTTP/1.1 defaults to keep-alive, HTTP/1.0 to close, a Connection header overrides both
+int keep_alive_requested(http_request *hr, const char *buff)
+{
+    if (hr->method.len == 0)
         return 0;
+    int keep_alive = hr->version_minor == 1;
+    for (int i = 0; i < hr->header_count; i++)
+    {
+        if (!http_slice_caseeq(buff, hr->headers[i].name, "Connection"))
+            continue;
+        // header value is a comma separated token list
+        const char *token = &buff[hr->headers[i].value.off];
+        const char *value_end = token + hr->headers[i].value.len;
+        while (token < value_end)
+        {
+            while (token < value_end && (*token == ' ' || *token == '\t' || *token == ','))
+                token++;
+            const char *token_end = token;
+            while (token_end < value_end && *token_end != ',' && *token_end != ' ' && *token_end != '\t')
+                token_end++;
+            if (token_end - token == 5 && strncasecmp(token, "close", 5) == 0)
+                return 0;
+            if (token_end - token == 10 && strncasecmp(token, "keep-alive", 10) == 0)
+                keep_alive = 1;
+            token = token_end;
+        }
     }
-    // buff to hold file
-    unsigned char *file_buff[1000];
-    int readed = 0;
-    long int tot_readed = 0;
-    long int tot_writed = 0;
+    return keep_alive;
+}
 
-    do
+// build the response to the request parsed in hr (slices of buff) into out, scratch memory comes from arena.
+// keep_alive - 1 if the connection may stay open, returns 1 if it stays open after the response
+int build_response(int parsed, http_request *hr, const char *buff, out_queue_t *out, arena_t *arena, int keep_alive)
+{
+    // the Date value of the ticker, copied since the response may be written seconds later
+    char *timebuf_now = (char *)arena_alloc(arena, HTTP_DATE_LEN + 1);
+    if (!timebuf_now)
+        return 0;
+    http_date(timebuf_now);
+    request_info req = {.now = timebuf_now, .arena = arena, .keep_alive = keep_alive && keep_alive_requested(hr, buff), .fd = -1,
+                        .hr = hr, .buff = buff};
+    // get response code
+    unsigned long start = stats_now();
+    int result = analyse(parsed, hr, buff, &req);
+    stats_latency(STAT_RESOLVE, start);
+    // after a malformed or unsupported request the next request can not be found reliably
+    if (result == BAD_REQUEST || result == NOT_SUPPORTED)
+        req.keep_alive = 0;
+    switch (result)
     {
-        // read from stream into buffer
-        readed = fread(file_buff, 1, 1000, file);
-        // write from buffer into file descriptor
-        writed = write(fd, file_buff, readed);
-        tot_readed += readed;
-        tot_writed += writed;
-
-        // repeat until the end of the file
-    } while (readed > 0 && readed == writed);
-    // writed += write(fd, "\r\n", 2);
-
-    // printf("file size: %ld, readed: %ld, writed: %ld\n", fs.st_size, tot_readed, tot_writed);
-    if (tot_writed != tot_readed)
-        perror("ERROR: write file to fd failed.");
-    if (fclose(file) < 0)
+    case RETURN_FILE:
+        send_file(req.path, out, &req);
+        break;
+    case DIR_CONTENT:
+        send_dir_content(req.path, out, &req);
+        break;
+    case FOUND:
+        send_found(req.path, out, &req);
+        break;
+    case STATS_PAGE:
+        send_stats(out, &req);
+        break;
+    default:
+        send_error(result, out, &req);
+        break;
+    }
+    // a resolved path not handed to a sender (e.g. 302)
+    if (req.fd >= 0 && close(req.fd) == -1)
         perror("ERROR: close file failed - leak.");
+    return req.keep_alive;
+}
+
+// add an access log record of the request in the first length bytes of conn->rbuf,
+// answered with the bytes queued in conn->out since queued, start - accesslog_clock() before it
+void log_request(connection_t *conn, int length, unsigned long queued, unsigned long start)
+{
+    // the client address is looked up once per connection
+    if (!conn->peer.sin_family)
+    {
+        socklen_t addr_len = sizeof(conn->peer);
+        if (getpeername(conn->fd, (struct sockaddr *)&conn->peer, &addr_len) < 0)
+            conn->peer.sin_family = AF_INET;
+    }
+    const char *line_end = (const char *)memchr(conn->rbuf, '\n', length);
+    int line_len = line_end ? line_end - conn->rbuf : length;
+    if (line_len > 0 && conn->rbuf[line_len - 1] == '\r')
+        line_len--;
+    accesslog_add(&conn->peer, conn->rbuf, line_len, conn->out.status, conn->out.queued - queued, start);
+}
+
+// request handler: answers every complete request in conn->rbuf in order.
+// pipelined requests are queued one after the other in conn->out so they go out in one write.
+// conn->keep_alive is cleared when the connection must close after the queued responses.
+int handle_connection(connection_t *conn)
+{
+    while (conn->keep_alive && conn->rlen > 0)
+    {
+        // the parser resumes after the bytes it saw in earlier calls (the reactor may have finished it)
+        unsigned long start = conn->parser.state < HTTP_STATE_DONE ? stats_now() : 0;
+        int parsed = http_parse(&conn->parser, conn->rbuf, conn->rlen);
+        stats_latency(STAT_PARSE, start);
+        int length = conn->parser.length;
+        if (parsed != HTTP_PARSE_DONE)
+        {
+            // headers filling the whole buffer are over the size limit
+            if (parsed == HTTP_PARSE_MORE && conn->rlen == REQ_MAX_SIZE)
+                parsed = HTTP_PARSE_TOO_LARGE;
+            // without an end of headers the request can only be answered as the last one
+            if (parsed == HTTP_PARSE_MORE && !conn->peer_closed)
+                break;
+            length = conn->rlen;
+            conn->keep_alive = 0;
+        }
+        conn->requests++;
+        int keep_alive = conn->keep_alive && !conn->peer_closed && config.keepalive_timeout > 0 && conn->requests < config.keepalive_requests;
+        unsigned long log_start = accesslog_clock();
+        unsigned long queued = conn->out.queued;
+        conn->keep_alive = build_response(parsed, &conn->parser, conn->rbuf, &conn->out, &conn->arena, keep_alive);
+        if (accesslog_enabled)
+            log_request(conn, length, queued, log_start);
+        http_parser_init(&conn->parser);
+        // remove the answered request from the buffer
+        conn->rlen -= length;
+        memmove(conn->rbuf, &conn->rbuf[length], conn->rlen);
+        conn->rbuf[conn->rlen] = '\0';
+    }
     return 0;
 }
 
-int send_dir_content(char *path, int fd, char *now)
-{
-    // create ref to directory
-    DIR *dir = opendir(path);
-    if (!dir)
-        return send_error(INTERNAL_SERVER_ERROR, fd, now);
-    // get directory stat
-    struct stat fs;
-    if (stat(path, &fs) == -1)
-    {
-        if (closedir(dir) == -1)
-            perror("ERROR: close directory failed");
-        return send_error(INTERNAL_SERVER_ERROR, fd, now);
-    }
-    // str to handle last modified time's
-    char timebuf_last_mod[128];
-    strftime(timebuf_last_mod, sizeof(timebuf_last_mod), RFC1123FMT, gmtime(&fs.st_mtime));
-    // counting enteries in directory
-    int num_of_enteries = 0;
-    // ref's to entery template arguments
-    int date_length = strlen(timebuf_last_mod);
-    // int dir_template_length = 53;
-    int dir_path_len = strlen(path);
-    // counter to detect content total size
-    long int content_length = strlen(DIR_TABLE_HEAD_TEMPLATE) + strlen(DIR_TABLE_END_TEMPLATE) + (2 * dir_path_len) + 1;
-    // get entery ref
-    struct dirent *dir_entry;
-    // counting content size by adding each entery full template size (long int for file size)
-    const int entery_basic_length = strlen(DIR_ENTERY_TAMPLATE) + dir_path_len + date_length + sizeof(long) + 1;
-    while ((dir_entry = readdir(dir)) != NULL)
-    {
-        content_length = content_length + entery_basic_length + (2 * strlen(dir_entry->d_name));
-        num_of_enteries++;
-    }
-    // get headers length
-    int headers_length = strlen(DIR_HEADERS_TAMPLATE) + log_10(content_length) + (2 * date_length) + 2; // 2 = 1 for log10+1 (length of num), 1 for '\0' /--/ 2 times: for last mode & date
-    char headers[headers_length];
-
-    // str to handle content itself
-    char content[content_length];
-    sprintf(content, DIR_TABLE_HEAD_TEMPLATE, path, path);
-    // pointer where to write each loop
-    int write_to_here = strlen(content);
-    rewinddir(dir);
-    for (int i = 0; i < num_of_enteries; i++)
-    {
-        dir_entry = readdir(dir);
-        int d_name_length = strlen(dir_entry->d_name) + 2; // 2 = 1 reserve for dir, 1 for '\0'
-        // entery name for show
-        char d_name[d_name_length];
-        // entery name for href
-        sprintf(d_name, "%s", dir_entry->d_name);
-        int full_path_length = dir_path_len + d_name_length;
-        char entery_full_path[full_path_length];
-        // create a valid path to file
-        sprintf(entery_full_path, "%s%s", path, d_name);
-        // get stat to sepecific file
-        if (stat(entery_full_path, &fs) == -1)
+// monotonic milliseconds at which seconds from now are over, 0 (no deadline) if seconds is 0
+long deadline_after(int seconds)
+{
+    if (!seconds)
+        return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000 + seconds * 1000L;
+}
+
+// wait until fd is ready for events or deadline (see deadline_after) passed.
+// returns 1 if ready, 0 on timeout, -1 on failure
+int wait_socket(int fd, short events, long deadline)
+{
+    while (1)
+    {
+        int timeout = -1;
+        if (deadline)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            long left = deadline - (ts.tv_sec * 1000L + ts.tv_nsec / 1000000);
+            if (left <= 0)
+                return 0;
+            timeout = (int)left;
+        }
+        struct pollfd pfd = {fd, events, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready >= 0 || errno != EINTR)
+            return ready;
+    }
+}
+
+// write the queued responses to a non-blocking client socket. the client must take
+// send-min-rate bytes per second of every send-timeout window, or the write fails.
+// max - return OUTQ_MORE once max bytes were written, 0 - write everything
+int flush_client(connection_t *conn, int fd, size_t max)
+{
+    unsigned long start = conn->out.sent;
+    unsigned long window_sent = conn->out.sent;
+    long window_end = deadline_after(config.send_timeout);
+    int flushed;
+    while ((flushed = outq_flush_max(&conn->out, fd, max ? max - (conn->out.sent - start) : 0)) == OUTQ_AGAIN ||
+           flushed == OUTQ_GENERATE)
+    {
+        if (flushed == OUTQ_GENERATE)
         {
-            printf("ERROR: stat failed - dir content");
+            // the pool thread owns the socket, it renders the next piece itself
+            if (outq_generate(&conn->out) < 0)
+                return OUTQ_ERROR;
             continue;
         }
-        // get entery last modified date
-        strftime(timebuf_last_mod, sizeof(timebuf_last_mod), RFC1123FMT, gmtime(&fs.st_mtime));
-        // create a str to handle entery size (if reg file)
-        int entery_size_length = log_10(fs.st_size) + 2; // 2 = 1 for actually length, 1 for '\0'
-        char entery_size[entery_size_length];
-        if (S_ISREG(fs.st_mode))
+        int ready = wait_socket(fd, POLLOUT, window_end);
+        if (ready < 0)
+            return OUTQ_ERROR;
+        if (ready > 0)
+            continue;
+        // the window is over: a client that took enough gets the next one
+        unsigned long taken = conn->out.sent - window_sent;
+        if (taken == 0 || taken < (unsigned long)config.send_min_rate * config.send_timeout)
         {
-            sprintf(entery_size, "%ld", fs.st_size);
+            stats_timeout(STAT_TIMEOUT_SEND);
+            return OUTQ_ERROR;
         }
-        else
+        window_sent = conn->out.sent;
+        window_end = deadline_after(config.send_timeout);
+    }
+    return flushed;
+}
+
+void close_client(connection_t *conn)
+{
+    int fd = conn->fd;
+    stats_conn_closed();
+    connpool_put(connections, conn);
+    close(fd);
+}
+
+int send_bulk(void *conn_arg);
+
+// serve a connection's requests until it closes or a response goes to the bulk lane.
+// the socket is non-blocking and every wait is bounded by a deadline, so a client that
+// trickles its request or stops reading the response can not hold the thread
+void serve_client(connection_t *conn)
+{
+    int fd = conn->fd;
+    // between requests wait at most keepalive_timeout, for the rest of a request until its deadline
+    long deadline = deadline_after(conn->requests > 0 && conn->rlen == 0 ? config.keepalive_timeout : config.header_timeout);
+    while (conn->keep_alive && !conn->peer_closed)
+    {
+        int request_size = read(fd, &conn->rbuf[conn->rlen], REQ_MAX_SIZE - conn->rlen);
+        if (request_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            // idle between requests: the watcher waits for the next one, the thread goes back to the pool
+            if (errno != EINTR && conn->rlen == 0 && conn->requests > 0 && idle_clients && keepalive_park(idle_clients, conn) == 0)
+                return;
+            int ready = errno == EINTR ? 1 : wait_socket(fd, POLLIN, deadline);
+            if (ready > 0)
+                continue;
+            if (ready == 0)
+                stats_timeout(conn->rlen == 0 && conn->requests > 0 ? STAT_TIMEOUT_IDLE : STAT_TIMEOUT_HEADER);
+            break;
+        }
+        if (request_size < 0)
+        {
+            perror("ERROR: read failure");
+            break;
+        }
+        if (request_size == 0)
+        {
+            // client disconnected, answer what it already sent
+            conn->peer_closed = 1;
+            if (conn->rlen == 0)
+                break;
+        }
+        else if (conn->rlen == 0 && conn->requests > 0)
+            // the first bytes of the next request start its header deadline
+            deadline = deadline_after(config.header_timeout);
+        conn->rlen += request_size;
+        conn->rbuf[conn->rlen] = '\0';
+        int answered = conn->requests;
+        handle_connection(conn);
+        conn->send_start = stats_now();
+        // a large response is sent slice by slice from the bulk lane, this thread goes back to short jobs
+        size_t slice = 0;
+        if (config.bulk_min && conn->owner && conn->out.queued - conn->out.sent >= (unsigned long)config.bulk_min << 10)
+            slice = (size_t)config.bulk_slice << 10;
+        unsigned long sent = conn->out.sent;
+        int flushed = flush_client(conn, fd, slice);
+        stats_bytes(conn->out.sent - sent);
+        if (flushed == OUTQ_MORE && dispatch_bulk(conn->owner, send_bulk, conn) == 0)
+            return;
+        if (flushed == OUTQ_MORE)
         {
-            entery_size[0] = '\0';
-            sprintf(&d_name[d_name_length - 2], "/");
+            // the pool is shutting down or has no bulk lane, finish the response here
+            sent = conn->out.sent;
+            flushed = flush_client(conn, fd, 0);
+            stats_bytes(conn->out.sent - sent);
         }
-        sprintf(&content[write_to_here], DIR_ENTERY_TAMPLATE, dir_entry->d_name, dir_entry->d_name, timebuf_last_mod, entery_size);
-        write_to_here = write_to_here + strlen(&content[write_to_here]);
+        if (flushed != OUTQ_DONE)
+            break;
+        stats_latency(STAT_SEND, conn->send_start);
+        arena_reset(&conn->arena);
+        if (conn->requests != answered)
+            deadline = deadline_after(conn->rlen == 0 ? config.keepalive_timeout : config.header_timeout);
     }
-    sprintf(&content[write_to_here], DIR_TABLE_END_TEMPLATE);
-    content_length = strlen(content);
-    //create headers
-    sprintf(headers, DIR_HEADERS_TAMPLATE, now, content_length, timebuf_last_mod);
-    int writed = write(fd, headers, strlen(headers));
-    // write headers to file descriptor
-    if (writed != strlen(headers))
-    {
-        perror("error: write headers to fd failed - (send_dir_content)");
-        if (closedir(dir) == -1)
-            perror("ERROR: close directory failed");
+    close_client(conn);
+}
+
+// regular lane job: serve the requests following a bulk response
+int resume_client(void *conn_arg)
+{
+    serve_client((connection_t *)conn_arg);
+    return 0;
+}
+
+// bulk lane job: send the next slice of a bulk response and queue up again, so short jobs
+// that arrived meanwhile run first. the finished connection goes back to the regular lane
+int send_bulk(void *conn_arg)
+{
+    connection_t *conn = (connection_t *)conn_arg;
+    int flushed;
+    // a pool that is shutting down takes no more jobs, the slices are sent here
+    do
+    {
+        unsigned long sent = conn->out.sent;
+        flushed = flush_client(conn, conn->fd, (size_t)config.bulk_slice << 10);
+        stats_bytes(conn->out.sent - sent);
+    } while (flushed == OUTQ_MORE && dispatch_bulk(conn->owner, send_bulk, conn) < 0);
+    if (flushed == OUTQ_MORE)
+        return 0;
+    if (flushed != OUTQ_DONE)
+    {
+        close_client(conn);
+        return 0;
+    }
+    stats_latency(STAT_SEND, conn->send_start);
+    arena_reset(&conn->arena);
+    if (dispatch_bounded(conn->owner, resume_client, NULL, conn) < 0)
+        serve_client(conn);
+    return 0;
+}
+
+// dispatch function for thread from threadpool, serves one connection
+int handle_client(void *fd_arg)
+{
+    // the socket is passed by value, main's next accept can not overwrite it
+    int fd = (int)(intptr_t)fd_arg;
+    connection_t *conn = connpool_get(connections, fd);
+    if (!conn)
+    {
+        close(fd);
         return 0;
     }
-    // write content to file descriptor
-    writed = write(fd, content, content_length);
-    if (writed != content_length)
-        perror("ERROR: write content to fd failed - (send_dir_content)");
-    if (closedir(dir) == -1)
-        perror("ERROR: close directory failed");
+    stats_conn_opened();
+    // slices of bulk responses are queued on the pool running this job
+    conn->owner = threadpool_current();
+    serve_client(conn);
+    return 0;
+}
 
+// shed handler: answer an overloaded server's 503 instead of the requests in conn->rbuf.
+// nothing is parsed or looked up, the connection closes after the response
+int shed_connection(connection_t *conn)
+{
+    conn->keep_alive = 0;
+    char *date = (char *)arena_alloc(&conn->arena, HTTP_DATE_LEN + 1);
+    if (date)
+    {
+        unsigned long queued = conn->out.queued;
+        http_date(date);
+        queue_error_header(&conn->out, SERVICE_UNAVAILABLE, date, RETRY_AFTER_HEADER, sizeof(RETRY_AFTER_HEADER) - 1, 0);
+        if (accesslog_enabled)
+            log_request(conn, conn->rlen, queued, 0);
+    }
+    conn->rlen = 0;
     return 0;
 }
 
-// dispatch function for thread from threadpool
-int handle_client(void *fd_buff)
+// close a socket whose request was not read after its 503: end our side first and drop
+// what arrived, so the close does not reset the connection before the client read the 503
+void shed_close(int fd)
+{
+    shutdown(fd, SHUT_WR);
+    char drain[REQ_MAX_SIZE];
+    while (recv(fd, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+        ;
+    close(fd);
+}
+
+// answer a blocking-mode client the pool has no room or time for with a 503
+int shed_client(void *fd_arg)
 {
-    int fd = atoi((char *)fd_buff);
-    char buff[REQ_MAX_SIZE + 1];
-    buff[REQ_MAX_SIZE] = '\0';
-    int request_size = read(fd, buff, REQ_MAX_SIZE);
-    if (request_size < 0)
+    int fd = (int)(intptr_t)fd_arg;
+    connection_t *conn = connpool_get(connections, fd);
+    if (conn)
     {
-        perror("ERROR: read failure");
+        stats_conn_opened();
+        shed_connection(conn);
+        unsigned long sent = conn->out.sent;
+        outq_flush(&conn->out, fd);
+        stats_bytes(conn->out.sent - sent);
+        stats_conn_closed();
+        connpool_put(connections, conn);
     }
-    else if (request_size == 0)
+    shed_close(fd);
+    return 0;
+}
+
+// answer the next request of a parked keep-alive connection with a 503, the pool has no room or time for it
+int shed_parked(void *conn_arg)
+{
+    connection_t *conn = (connection_t *)conn_arg;
+    int fd = conn->fd;
+    shed_connection(conn);
+    unsigned long sent = conn->out.sent;
+    outq_flush(&conn->out, fd);
+    stats_bytes(conn->out.sent - sent);
+    stats_conn_closed();
+    connpool_put(connections, conn);
+    shed_close(fd);
+    return 0;
+}
+
+// keep-alive watcher: the next request of a parked connection arrived (or the client closed),
+// it goes through the pool's admission control like a new client
+void client_ready(connection_t *conn)
+{
+    if (dispatch_bounded(conn->owner, resume_client, shed_parked, conn) < 0)
+        shed_parked(conn);
+}
+
+// keep-alive watcher: the connection waited keepalive_timeout for its next request
+void client_idle(connection_t *conn)
+{
+    stats_timeout(STAT_TIMEOUT_IDLE);
+    close_client(conn);
+}
+
+// hand n accepted sockets to the pool in one batch, the ones a full pool refuses are answered on the spot
+void dispatch_clients(threadpool *t, int *fds, int n)
+{
+    void *args[ACCEPT_BATCH];
+    for (int i = 0; i < n; i++)
     {
-        // client disconnected
+        sockopt_accepted(fds[i]);
+        args[i] = (void *)(intptr_t)fds[i];
     }
-    else
+    int queued = dispatch_batch(t, handle_client, shed_client, args, n);
+    for (int i = queued; i < n; i++)
+        shed_client(args[i]);
+}
+
+// accept the connections waiting on the non-blocking listen_fd until its backlog is empty,
+// at most max (and ACCEPT_BATCH), and dispatch them together. budget - connections the
+// shards may still accept, one is taken before each accept, NULL if none. returns the number accepted
+int accept_clients(threadpool *t, int listen_fd, int max, atomic_int *budget)
+{
+    int fds[ACCEPT_BATCH];
+    int n = 0;
+    if (max > ACCEPT_BATCH)
+        max = ACCEPT_BATCH;
+    while (n < max)
     {
-        time_t now;
-        char timebuf_now[128];
-        now = time(NULL);
-        strftime(timebuf_now, sizeof(timebuf_now), RFC1123FMT, gmtime(&now));
-        // get response code
-        int result = analyse(buff);
-        switch (result)
+        if (budget && atomic_fetch_sub(budget, 1) <= 0)
         {
-        case RETURN_FILE:
-            send_file(buff, fd, timebuf_now);
+            atomic_fetch_add(budget, 1);
             break;
-        case DIR_CONTENT:
-            send_dir_content(buff, fd, timebuf_now);
-            break;
-        case FOUND:
-            send_found(buff, fd, timebuf_now);
-            break;
-        default:
-            send_error(result, fd, timebuf_now);
+        }
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (budget)
+                atomic_fetch_add(budget, 1);
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("error: acceppt failure");
             break;
         }
+        fds[n++] = fd;
+    }
+    if (n)
+        dispatch_clients(t, fds, n);
+    return n;
+}
+
+// blocking mode accept loops wait in poll, accept itself must not block
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("error: fcntl failure");
+        return -1;
     }
-    close(fd);
     return 0;
 }
 
-int main(int argc, char *argv[])
+// fill config from the command line, return 0 if arguments are invalid
+int parse_args(int argc, char *argv[])
 {
-    // validate number of args received equals to 4 ( 0 - program name)
-    if (argc != 4)
+    static struct option long_options[] = {
+        {"epoll", no_argument, NULL, 'e'},
+        {"uring", no_argument, NULL, 'y'},
+        {"keepalive-requests", required_argument, NULL, 'k'},
+        {"keepalive-timeout", required_argument, NULL, 't'},
+        {"cache-size", required_argument, NULL, 'c'},
+        {"cache-entries", required_argument, NULL, 'n'},
+        {"cache-small", required_argument, NULL, 's'},
+        {"cache-revalidate", required_argument, NULL, 'r'},
+        {"pool", required_argument, NULL, 'p'},
+        {"conn-pool", required_argument, NULL, 'o'},
+        {"stack-size", required_argument, NULL, 'z'},
+        {"listeners", required_argument, NULL, 'l'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"pin-cpus", no_argument, NULL, 'u'},
+        {"compress-max", required_argument, NULL, 'x'},
+        {"mime-types", required_argument, NULL, 'm'},
+        {"stats", no_argument, NULL, 'a'},
+        {"queue-max", required_argument, NULL, 'q'},
+        {"queue-wait", required_argument, NULL, 'w'},
+        {"pool-max", required_argument, NULL, 'g'},
+        {"pool-idle", required_argument, NULL, 'i'},
+        {"access-log", required_argument, NULL, 'L'},
+        {"header-timeout", required_argument, NULL, 'H'},
+        {"send-timeout", required_argument, NULL, 'S'},
+        {"send-min-rate", required_argument, NULL, 'R'},
+        {"coalesce", required_argument, NULL, 'C'},
+        {"nodelay", no_argument, NULL, 'N'},
+        {"defer-accept", required_argument, NULL, 'D'},
+        {"fastopen", required_argument, NULL, 'F'},
+        {"sndbuf", required_argument, NULL, 'B'},
+        {"bulk-min", required_argument, NULL, 'M'},
+        {"bulk-slice", required_argument, NULL, 'U'},
+        {"bulk-reserve", required_argument, NULL, 'V'},
+        {NULL, 0, NULL, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
     {
-        usage();
-        return 0;
+        switch (opt)
+        {
+        case 'e':
+            config.use_epoll = 1;
+            break;
+        case 'y':
+            // the io_uring engine is event driven as well
+            config.use_epoll = 1;
+            config.use_uring = 1;
+            break;
+        case 'k':
+            config.keepalive_requests = atoi(optarg);
+            if (config.keepalive_requests < 1)
+                return 0;
+            break;
+        case 't':
+            config.keepalive_timeout = atoi(optarg);
+            if (config.keepalive_timeout < 0)
+                return 0;
+            break;
+        case 'c':
+            config.cache_size = atoi(optarg);
+            if (config.cache_size < 0)
+                return 0;
+            break;
+        case 'n':
+            config.cache_entries = atoi(optarg);
+            if (config.cache_entries < 1)
+                return 0;
+            break;
+        case 's':
+            config.cache_small = atoi(optarg);
+            if (config.cache_small < 0)
+                return 0;
+            break;
+        case 'r':
+            config.cache_revalidate = atoi(optarg);
+            if (config.cache_revalidate < 0)
+                return 0;
+            break;
+        case 'p':
+            if (strcmp(optarg, "mutex") == 0)
+                config.pool_mode = THREADPOOL_MUTEX;
+            else if (strcmp(optarg, "ws") == 0)
+                config.pool_mode = THREADPOOL_WORK_STEALING;
+            else
+                return 0;
+            break;
+        case 'o':
+            config.conn_pool_size = atoi(optarg);
+            if (config.conn_pool_size < 1)
+                return 0;
+            break;
+        case 'z':
+            config.stack_size = atoi(optarg);
+            if (config.stack_size < 0)
+                return 0;
+            break;
+        case 'l':
+            config.listeners = atoi(optarg);
+            if (config.listeners < 1 || config.listeners > MAXT_IN_POOL)
+                return 0;
+            break;
+        case 'b':
+            config.backlog = atoi(optarg);
+            if (config.backlog < 1)
+                return 0;
+            break;
+        case 'u':
+            config.pin_cpus = 1;
+            break;
+        case 'x':
+            config.compress_max = atoi(optarg);
+            if (config.compress_max < 0)
+                return 0;
+            break;
+        case 'm':
+            config.mime_types = optarg;
+            break;
+        case 'a':
+            config.stats = 1;
+            break;
+        case 'q':
+            config.queue_max = atoi(optarg);
+            if (config.queue_max < 0)
+                return 0;
+            break;
+        case 'w':
+            config.queue_wait = atoi(optarg);
+            if (config.queue_wait < 0)
+                return 0;
+            break;
+        case 'g':
+            config.pool_max = atoi(optarg);
+            if (config.pool_max < 1 || config.pool_max > MAXT_IN_POOL)
+                return 0;
+            break;
+        case 'i':
+            config.pool_idle = atoi(optarg);
+            if (config.pool_idle < 0)
+                return 0;
+            break;
+        case 'L':
+            config.access_log = optarg;
+            break;
+        case 'H':
+            config.header_timeout = atoi(optarg);
+            if (config.header_timeout < 0)
+                return 0;
+            break;
+        case 'S':
+            config.send_timeout = atoi(optarg);
+            if (config.send_timeout < 0)
+                return 0;
+            break;
+        case 'R':
+            config.send_min_rate = atoi(optarg);
+            if (config.send_min_rate < 0)
+                return 0;
+            break;
+        case 'C':
+            if (strcmp(optarg, "more") == 0)
+                sockopts.coalesce = COALESCE_MORE;
+            else if (strcmp(optarg, "cork") == 0)
+                sockopts.coalesce = COALESCE_CORK;
+            else if (strcmp(optarg, "off") == 0)
+                sockopts.coalesce = COALESCE_OFF;
+            else
+                return 0;
+            break;
+        case 'N':
+            sockopts.nodelay = 1;
+            break;
+        case 'D':
+            sockopts.defer_accept = atoi(optarg);
+            if (sockopts.defer_accept < 0)
+                return 0;
+            break;
+        case 'F':
+            sockopts.fastopen = atoi(optarg);
+            if (sockopts.fastopen < 0)
+                return 0;
+            break;
+        case 'B':
+            sockopts.sndbuf = atoi(optarg);
+            if (sockopts.sndbuf < 0 || sockopts.sndbuf > (1 << 20))
+                return 0;
+            sockopts.sndbuf <<= 10;
+            break;
+        case 'M':
+            config.bulk_min = atoi(optarg);
+            if (config.bulk_min < 0 || config.bulk_min > (1 << 20))
+                return 0;
+            break;
+        case 'U':
+            config.bulk_slice = atoi(optarg);
+            if (config.bulk_slice < 1 || config.bulk_slice > (1 << 20))
+                return 0;
+            break;
+        case 'V':
+            config.bulk_reserve = atoi(optarg);
+            if (config.bulk_reserve < 0 || config.bulk_reserve > MAXT_IN_POOL)
+                return 0;
+            break;
+        default:
+            return 0;
+        }
     }
-    int port = atoi(argv[1]);
-    int pool_size = atoi(argv[2]);
-    int max_request = atoi(argv[3]);
-    int port_len = log_10(port) + 1;
-    int pool_size_len = log_10(pool_size) + 1;
-    int max_request_len = log_10(max_request) + 1;
+    // validate number of positional args received equals to 3
+    if (argc - optind != 3)
+        return 0;
+    char **args = &argv[optind];
+    config.port = atoi(args[0]);
+    config.pool_size = atoi(args[1]);
+    config.max_request = atoi(args[2]);
+    int port_len = log_10(config.port) + 1;
+    int pool_size_len = log_10(config.pool_size) + 1;
+    int max_request_len = log_10(config.max_request) + 1;
     // validate arguments not contains another characters
-    if (port_len != strlen(argv[1]) || pool_size_len != strlen(argv[2]) || max_request_len != strlen(argv[3]) || !validatePort(argv[1]))
-    {
-        usage();
+    if (port_len != strlen(args[0]) || pool_size_len != strlen(args[1]) || max_request_len != strlen(args[2]) || !validatePort(args[0]))
         return 0;
-    }
-    // create brand new threadpool
-    threadpool *t = create_threadpool(pool_size);
-    if (!t)
-    {
-        printf("threadpool failed to create\n");
+    // an elastic pool starts with pool-size threads and never goes below
+    if (config.pool_max && config.pool_max < config.pool_size)
         return 0;
-    }
-    // integers to store fd for sockets
-    int welcome_sockfd, cur_sockfd;
-    struct sockaddr_in serv_addr;
+    return 1;
+}
 
+// open a listening socket on port, reuseport - 1 if other listeners share the port
+int open_listener(int port, int backlog, int reuseport)
+{
     // create new fd for welcome socket
-    welcome_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (welcome_sockfd < 0)
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
     {
         // validate welcome socket created
         perror("error: create socket failure\n");
-        destroy_threadpool(t);
-        return EXIT_FAILURE;
+        return -1;
+    }
+    int on = 1;
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        perror("error: setsockopt failure");
+        close(sockfd);
+        return -1;
     }
     // setup server
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(port);
-
     // bind welcome socket
-    if (bind(welcome_sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
         perror("error: bind failure");
-        destroy_threadpool(t);
-        close(welcome_sockfd);
-        return EXIT_FAILURE;
+        close(sockfd);
+        return -1;
+    }
+    if (sockopt_listener(sockfd) < 0)
+    {
+        close(sockfd);
+        return -1;
     }
-    // listen to clients queue set to 5
-    if (listen(welcome_sockfd, 5) < 0)
+    if (listen(sockfd, backlog) < 0)
     {
         perror("error: listen failure\n");
-        destroy_threadpool(t);
-        close(welcome_sockfd);
-        return EXIT_FAILURE;
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// create a threadpool of num_threads threads (growing up to max_threads) with the configured settings,
+// cpu - pin to it, -1 none
+threadpool *create_pool(int num_threads, int max_threads, int cpu)
+{
+    threadpool_attr pool_attr;
+    threadpool_attr_init(&pool_attr, num_threads);
+    pool_attr.max_threads = max_threads;
+    pool_attr.idle_timeout = config.pool_idle;
+    pool_attr.mode = config.pool_mode;
+    pool_attr.stack_size = (size_t)config.stack_size << 10;
+    pool_attr.cpu = cpu;
+    pool_attr.max_queue = config.queue_max;
+    pool_attr.max_wait_ms = config.queue_wait;
+    pool_attr.reserved = config.bulk_reserve;
+    threadpool *t = create_threadpool_attr(&pool_attr);
+    if (t)
+    {
+        pthread_mutex_lock(&stats_pools_lock);
+        stats_pools[stats_npools++] = t;
+        pthread_mutex_unlock(&stats_pools_lock);
+    }
+    return t;
+}
+
+void add_pool_stats(threadpool *t, threadpool_stats *total)
+{
+    threadpool_stats stats;
+    threadpool_get_stats(t, &stats);
+    total->dispatched += stats.dispatched;
+    total->parks += stats.parks;
+    total->lock_contended += stats.lock_contended;
+    total->steals += stats.steals;
+    total->full_waits += stats.full_waits;
+    total->rejected += stats.rejected;
+    total->expired += stats.expired;
+    total->grows += stats.grows;
+    total->shrinks += stats.shrinks;
+    total->bulk_dispatched += stats.bulk_dispatched;
+}
+
+// add the counters of t to total, then destroy t
+void destroy_pool(threadpool *t, threadpool_stats *total)
+{
+    // the stats page must not read the pool any more
+    pthread_mutex_lock(&stats_pools_lock);
+    for (int i = 0; i < stats_npools; i++)
+        if (stats_pools[i] == t)
+            stats_pools[i] = stats_pools[--stats_npools];
+    pthread_mutex_unlock(&stats_pools_lock);
+    if (total)
+        add_pool_stats(t, total);
+    destroy_threadpool(t);
+}
+
+// stop the keep-alive watcher once no more connections are accepted, before the pools go
+void stop_idle_clients(void)
+{
+    if (idle_clients)
+        keepalive_stop(idle_clients);
+    idle_clients = NULL;
+}
+
+// one shard of the multi-listener mode: a SO_REUSEPORT listener, its accept thread and its own workers
+typedef struct shard_st
+{
+    int listen_fd;
+    int cpu;         // cpu the shard runs on, -1 if not pinned
+    threadpool *pool;
+    pthread_t thread;
+} shard_t;
+
+// connections still allowed to be accepted, shared by all the shards
+static atomic_int accept_budget;
+
+// blocking mode accept loop of a shard: wait for the listener, then drain its backlog
+void shard_accept(shard_t *shard)
+{
+    if (set_nonblocking(shard->listen_fd) < 0)
+        return;
+    while (atomic_load(&accept_budget) > 0)
+    {
+        // wake up once a second to see whether other shards used up the budget
+        struct pollfd pfd = {shard->listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+        // a full batch may have left more connections in the backlog
+        while (accept_clients(shard->pool, shard->listen_fd, ACCEPT_BATCH, &accept_budget) == ACCEPT_BATCH)
+            ;
     }
-    // int sockets[pool_size]; -- TODO
-    for (int i = 0; i < max_request; i++)
+}
+
+// event driven mode: serve listen_fd from the io_uring engine or the epoll reactor until
+// max-number-of-request connections were served. shared - accept budget of all shards, NULL if none
+void run_engine(int listen_fd, threadpool *t, atomic_int *shared)
+{
+    if (config.use_uring)
     {
-        // get the new fd from accept to handle the request
-        cur_sockfd = accept(welcome_sockfd, NULL, NULL);
-        if (cur_sockfd < 0)
+        uring_engine *e = create_uring(listen_fd, config.max_request, config.keepalive_timeout, t, handle_connection, connections);
+        if (e)
         {
-            perror("error: acceppt failure");
+            uring_set_shed(e, shed_connection);
+            uring_set_timeouts(e, config.header_timeout, config.send_timeout, (unsigned long)config.send_min_rate * config.send_timeout);
+            if (shared)
+                uring_share_accepts(e, shared);
+            uring_run(e);
+            destroy_uring(e);
+            return;
+        }
+        printf("io_uring engine failed to create, using epoll\n");
+    }
+    reactor *r = create_reactor(listen_fd, config.max_request, config.keepalive_timeout, t, handle_connection, connections);
+    if (!r)
+        return;
+    reactor_set_shed(r, shed_connection);
+    reactor_set_timeouts(r, config.header_timeout, config.send_timeout, (unsigned long)config.send_min_rate * config.send_timeout);
+    if (shared)
+        reactor_share_accepts(r, shared);
+    reactor_run(r);
+    destroy_reactor(r);
+}
+
+// thread of one shard
+void *run_shard(void *arg)
+{
+    shard_t *shard = (shard_t *)arg;
+    if (!config.use_epoll)
+    {
+        shard_accept(shard);
+        return NULL;
+    }
+    // event driven mode: every shard runs its own engine
+    run_engine(shard->listen_fd, shard->pool, &accept_budget);
+    return NULL;
+}
+
+// multi-listener mode: config.listeners shards accept and serve in parallel until max_request
+// connections were accepted. returns -1 if no shard could start
+int run_shards(threadpool_stats *pool_stats)
+{
+    int count = config.listeners;
+    shard_t *shards = (shard_t *)calloc(count, sizeof(shard_t));
+    if (!shards)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return -1;
+    }
+    atomic_store(&accept_budget, config.max_request);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    // the pool size is split between the shards
+    int threads = config.pool_size / count > 0 ? config.pool_size / count : 1;
+    int max_threads = config.pool_max / count > threads ? config.pool_max / count : threads;
+    int started = 0;
+    for (int i = 0; i < count; i++)
+    {
+        shard_t *shard = &shards[i];
+        shard->cpu = config.pin_cpus && cpus > 0 ? (int)(i % cpus) : -1;
+        shard->listen_fd = open_listener(config.port, config.backlog, 1);
+        shard->pool = shard->listen_fd >= 0 ? create_pool(threads, max_threads, shard->cpu) : NULL;
+        if (!shard->pool)
+        {
+            if (shard->listen_fd >= 0)
+            {
+                printf("threadpool failed to create\n");
+                close(shard->listen_fd);
+            }
+            // a listener nobody accepts on would still be handed connections
+            shard->listen_fd = -1;
+            continue;
+        }
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (shard->cpu >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(shard->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        if (pthread_create(&shard->thread, &attr, run_shard, shard))
+        {
+            perror("ERROR: THREAD_CREATE_FAILED");
+            destroy_pool(shard->pool, NULL);
+            shard->pool = NULL;
+            close(shard->listen_fd);
+            shard->listen_fd = -1;
         }
         else
+            started++;
+        pthread_attr_destroy(&attr);
+    }
+    for (int i = 0; i < count; i++)
+        if (shards[i].pool)
+            pthread_join(shards[i].thread, NULL);
+    // the parked connections are handed to the pools until the last one left
+    stop_idle_clients();
+    for (int i = 0; i < count; i++)
+    {
+        if (!shards[i].pool)
+            continue;
+        close(shards[i].listen_fd);
+        destroy_pool(shards[i].pool, pool_stats);
+    }
+    free(shards);
+    return started ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse_args(argc, argv))
+    {
+        usage();
+        return 0;
+    }
+    int max_request = config.max_request;
+    // first: every thread created later inherits the signal mask the log sets up
+    if (config.access_log && accesslog_open(config.access_log) < 0)
+    {
+        printf("access log failed to open\n");
+        return EXIT_FAILURE;
+    }
+    // a client closing early must fail the write, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    if (config.stats)
+        stats_enable();
+    if (config.use_uring && !uring_supported())
+    {
+        printf("io_uring is not supported by this kernel, using epoll\n");
+        config.use_uring = 0;
+    }
+    if (mime_init(config.mime_types) < 0)
+    {
+        printf("mime types failed to load\n");
+        return EXIT_FAILURE;
+    }
+    if (headers_init() < 0)
+    {
+        printf("response headers failed to init\n");
+        mime_destroy();
+        return EXIT_FAILURE;
+    }
+    path_resolver = create_resolver(".", RESOLVE_MAX_DIRS, config.cache_revalidate);
+    if (!path_resolver)
+    {
+        printf("path resolver failed to create\n");
+        headers_destroy();
+        mime_destroy();
+        return EXIT_FAILURE;
+    }
+    connections = create_connpool(config.conn_pool_size, REQUEST_ARENA_SIZE);
+    if (!connections)
+    {
+        printf("connection pool failed to create\n");
+        destroy_resolver(path_resolver);
+        headers_destroy();
+        mime_destroy();
+        return EXIT_FAILURE;
+    }
+    if (config.cache_size > 0)
+    {
+        file_cache = create_filecache((size_t)config.cache_size << 20, config.cache_entries,
+                                      (size_t)config.cache_small << 10, config.cache_revalidate, recheck_cached, path_resolver);
+        if (!file_cache)
+            printf("file cache failed to create, serving without it\n");
+    }
+    // blocking mode: idle keep-alive connections wait in the watcher, not on a pool thread
+    if (!config.use_epoll && config.keepalive_timeout > 0)
+    {
+        idle_clients = create_keepalive(config.keepalive_timeout, client_ready, client_idle);
+        if (!idle_clients)
+            printf("keep-alive watcher failed to start, idle connections keep their thread\n");
+    }
+    threadpool_stats pool_stats;
+    memset(&pool_stats, 0, sizeof(pool_stats));
+    int failed = 0;
+    if (config.listeners > 1)
+        failed = run_shards(&pool_stats) < 0;
+    else
+    {
+        // create brand new threadpool
+        threadpool *t = create_pool(config.pool_size, config.pool_max ? config.pool_max : config.pool_size, -1);
+        int welcome_sockfd = t ? open_listener(config.port, config.backlog, 0) : -1;
+        if (!t)
+            printf("threadpool failed to create\n");
+        if (welcome_sockfd < 0)
+            failed = 1;
+        else if (config.use_epoll)
+        {
+            // event driven mode: the engine owns the sockets, the pool builds responses
+            if (max_request > 0)
+                run_engine(welcome_sockfd, t, NULL);
+        }
+        else if (set_nonblocking(welcome_sockfd) < 0)
+            failed = 1;
+        for (int served = 0; served < max_request && !failed && !config.use_epoll;)
         {
-            char fd[5];
-            sprintf(fd, "%d", cur_sockfd);
-            // send_response work to dispatch
-            dispatch(t, handle_client, fd);
+            // wait for clients, then take every connection in the backlog as one batch of jobs
+            struct pollfd pfd = {welcome_sockfd, POLLIN, 0};
+            if (poll(&pfd, 1, -1) <= 0)
+                continue;
+            served += accept_clients(t, welcome_sockfd, max_request - served, NULL);
+        }
+        if (welcome_sockfd >= 0)
+            close(welcome_sockfd);
+        // the parked connections are handed to the pool until the last one left
+        stop_idle_clients();
+        if (t)
+        {
+            destroy_pool(t, &pool_stats);
         }
     }
-    close(welcome_sockfd);
-    destroy_threadpool(t);
+    if (!failed)
+        printf("threadpool: %lu jobs, %lu parks, %lu contended locks, %lu steals, %lu full waits, %lu rejected, %lu expired,"
+               " %lu grows, %lu shrinks, %lu bulk jobs\n",
+               pool_stats.dispatched, pool_stats.parks, pool_stats.lock_contended, pool_stats.steals, pool_stats.full_waits,
+               pool_stats.rejected, pool_stats.expired, pool_stats.grows, pool_stats.shrinks, pool_stats.bulk_dispatched);
+    if (file_cache)
+    {
+        filecache_stats stats;
+        filecache_get_stats(file_cache, &stats);
+        printf("file cache: %lu hits, %lu misses, %lu evictions, %lu invalidations, %d entries, %zu bytes\n",
+               stats.hits, stats.misses, stats.evictions, stats.invalidations, stats.entries, stats.bytes);
+        destroy_filecache(file_cache);
+    }
+    printf("connection pool: %lu overflow allocations\n", atomic_load(&connections->overflows));
+    if (accesslog_enabled)
+    {
+        // the pools are gone, the writer takes the last records with it
+        accesslog_close();
+        unsigned long written, dropped;
+        accesslog_counts(&written, &dropped);
+        printf("access log: %lu records, %lu dropped\n", written, dropped);
+    }
+    destroy_connpool(connections);
+    destroy_resolver(path_resolver);
+    headers_destroy();
+    mime_destroy();
+    stats_destroy();
+    return failed ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,45 @@
+#include "sockopt.h"
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+sock_options sockopts = {.coalesce = COALESCE_MORE};
+
+int sockopt_listener(int fd)
+{
+    if (sockopts.defer_accept &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &sockopts.defer_accept, sizeof(sockopts.defer_accept)) < 0)
+    {
+        perror("error: setsockopt TCP_DEFER_ACCEPT failure");
+        return -1;
+    }
+    if (sockopts.fastopen && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &sockopts.fastopen, sizeof(sockopts.fastopen)) < 0)
+    {
+        perror("error: setsockopt TCP_FASTOPEN failure");
+        return -1;
+    }
+    return 0;
+}
+
+void sockopt_accepted(int fd)
+{
+    int on = 1;
+    if (sockopts.nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+        perror("ERROR: setsockopt TCP_NODELAY failed");
+    // a fixed size turns the kernel's autotuning off for this socket
+    if (sockopts.sndbuf && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sockopts.sndbuf, sizeof(sockopts.sndbuf)) < 0)
+        perror("ERROR: setsockopt SO_SNDBUF failed");
+}
+
+int sockopt_more_flag(void)
+{
+    return sockopts.coalesce == COALESCE_MORE ? MSG_MORE : 0;
+}
+
+void sockopt_cork(int fd, int on)
+{
+    // uncorking sends what the cork held back at once
+    if (sockopts.coalesce == COALESCE_CORK)
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
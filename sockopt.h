@@ -0,0 +1,51 @@
+/**
+ * sockopt.h
+ *
+ * This file declares the socket options layer: the TCP options set on
+ * listening and accepted sockets, and how the pieces of a response
+ * (headers, body) are coalesced into full packets. the options are set
+ * once at startup, before any socket is opened.
+ */
+
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+// how the headers of a response are held back to leave with the first body bytes
+#define COALESCE_MORE 0 //MSG_MORE on a write followed by more of the response
+#define COALESCE_CORK 1 //TCP_CORK while a response is written, removed once it was flushed
+#define COALESCE_OFF 2	//every write leaves at once
+
+typedef struct sock_options_st
+{
+	int coalesce;	  //COALESCE_MORE, COALESCE_CORK or COALESCE_OFF
+	int nodelay;	  //1 - TCP_NODELAY on accepted sockets, a flushed response leaves without waiting on ACKs
+	int defer_accept; //seconds the kernel holds a new connection back until its first data, 0 - off
+	int fastopen;	  //TCP fast open queue of listeners, 0 - off
+	int sndbuf;		  //send buffer of accepted sockets in bytes, 0 - kernel autotuning
+} sock_options;
+
+// the options in effect, kernel defaults (and MSG_MORE coalescing) until changed
+extern sock_options sockopts;
+
+/**
+ * sockopt_listener sets the listener options on fd, before listen is called.
+ * returns -1 if an option could not be set.
+ */
+int sockopt_listener(int fd);
+
+/**
+ * sockopt_accepted sets the options of accepted sockets on fd, failures are only reported
+ */
+void sockopt_accepted(int fd);
+
+/**
+ * sockopt_more_flag returns the send flag of a write followed by more of the response
+ */
+int sockopt_more_flag(void);
+
+/**
+ * sockopt_cork corks (on - 1) or uncorks fd when coalescing with TCP_CORK, does nothing otherwise
+ */
+void sockopt_cork(int fd, int on);
+
+#endif
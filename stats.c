@@ -0,0 +1,185 @@
+#include "stats.h"
+#include "lfqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * the counters of one thread, written by that thread only
+ */
+typedef struct thread_stats_st
+{
+	_Alignas(CACHE_LINE) stats_snapshot counts;
+	struct thread_stats_st *next; //list of all slots
+} thread_stats;
+
+// status codes with their own counter, in the order of stats_snapshot.status
+static const int status_codes[STAT_STATUS_CODES] = {200, 206, 302, 304, 400, 403, 404, 416, 500, 501, 503};
+static const char *hist_names[STAT_HISTS] = {"queue_wait", "parse", "resolve", "send"};
+
+int stats_enabled;
+static thread_stats *all_slots;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread thread_stats *local_slot;
+
+// add n to a counter of the own slot, readers may load it any time
+#define SLOT_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+void stats_enable(void)
+{
+    __atomic_store_n(&stats_enabled, 1, __ATOMIC_RELEASE);
+}
+
+// the slot of the calling thread, created on its first count
+static thread_stats *slot(void)
+{
+    if (local_slot)
+        return local_slot;
+    thread_stats *s = (thread_stats *)aligned_alloc(CACHE_LINE, (sizeof(thread_stats) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    if (!s)
+        return NULL;
+    memset(s, 0, sizeof(thread_stats));
+    // slots outlive their thread, the counts stay in the totals
+    pthread_mutex_lock(&slots_lock);
+    s->next = all_slots;
+    all_slots = s;
+    pthread_mutex_unlock(&slots_lock);
+    local_slot = s;
+    return s;
+}
+
+unsigned long stats_now(void)
+{
+    if (!stats_enabled)
+        return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void stats_latency(int hist, unsigned long start)
+{
+    thread_stats *s;
+    if (!stats_enabled || !start || !(s = slot()))
+        return;
+    unsigned long us = (stats_now() - start) / 1000;
+    int bucket = us ? 64 - __builtin_clzl(us) : 0;
+    if (bucket >= STAT_BUCKETS)
+        bucket = STAT_BUCKETS - 1;
+    SLOT_ADD(s->counts.hist[hist][bucket], 1);
+}
+
+void stats_status(int status)
+{
+    thread_stats *s;
+    if (!stats_enabled || !(s = slot()))
+        return;
+    int i = 0;
+    while (i < STAT_STATUS_CODES && status_codes[i] != status)
+        i++;
+    SLOT_ADD(s->counts.status[i], 1);
+}
+
+void stats_bytes(unsigned long bytes)
+{
+    thread_stats *s;
+    if (bytes && stats_enabled && (s = slot()))
+        SLOT_ADD(s->counts.bytes_sent, bytes);
+}
+
+void stats_conn_opened(void)
+{
+    thread_stats *s;
+    if (stats_enabled && (s = slot()))
+        SLOT_ADD(s->counts.conns_opened, 1);
+}
+
+void stats_conn_closed(void)
+{
+    thread_stats *s;
+    if (stats_enabled && (s = slot()))
+        SLOT_ADD(s->counts.conns_closed, 1);
+}
+
+void stats_timeout(int kind)
+{
+    thread_stats *s;
+    if (stats_enabled && (s = slot()))
+        SLOT_ADD(s->counts.timeouts[kind], 1);
+}
+
+void stats_collect(stats_snapshot *s)
+{
+    memset(s, 0, sizeof(stats_snapshot));
+    unsigned long *sum = (unsigned long *)s;
+    size_t n = sizeof(stats_snapshot) / sizeof(unsigned long);
+    pthread_mutex_lock(&slots_lock);
+    for (thread_stats *t = all_slots; t; t = t->next)
+    {
+        unsigned long *counts = (unsigned long *)&t->counts;
+        for (size_t i = 0; i < n; i++)
+            sum[i] += __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&slots_lock);
+}
+
+// upper bound in us of the bucket holding the q-quantile (per mille) of a histogram
+static unsigned long percentile(const unsigned long *hist, unsigned long count, int per_mille)
+{
+    unsigned long rank = (count * per_mille + 999) / 1000;
+    unsigned long seen = 0;
+    for (int b = 0; b < STAT_BUCKETS; b++)
+    {
+        seen += hist[b];
+        if (seen >= rank && seen > 0)
+            return 1UL << b;
+    }
+    return 0;
+}
+
+int stats_render(chunk_buf_t *b, const stats_snapshot *s)
+{
+    int failed = chunkbuf_printf(b, "\"requests\":{") < 0;
+    for (int i = 0; i < STAT_STATUS_CODES; i++)
+        failed |= chunkbuf_printf(b, "\"%d\":%lu,", status_codes[i], s->status[i]) < 0;
+    failed |= chunkbuf_printf(b, "\"other\":%lu},\"bytes_sent\":%lu,\"connections\":{\"active\":%lu,\"opened\":%lu},",
+                              s->status[STAT_STATUS_CODES], s->bytes_sent, s->conns_opened - s->conns_closed, s->conns_opened) < 0;
+    failed |= chunkbuf_printf(b, "\"timeouts\":{\"header\":%lu,\"idle\":%lu,\"send\":%lu},", s->timeouts[STAT_TIMEOUT_HEADER],
+                              s->timeouts[STAT_TIMEOUT_IDLE], s->timeouts[STAT_TIMEOUT_SEND]) < 0;
+    failed |= chunkbuf_printf(b, "\"latency_us\":{") < 0;
+    for (int h = 0; h < STAT_HISTS; h++)
+    {
+        const unsigned long *hist = s->hist[h];
+        unsigned long count = 0;
+        for (int i = 0; i < STAT_BUCKETS; i++)
+            count += hist[i];
+        failed |= chunkbuf_printf(b, "%s\"%s\":{\"count\":%lu,\"p50\":%lu,\"p99\":%lu,\"p999\":%lu,\"buckets\":{", h ? "," : "", hist_names[h],
+                                  count, percentile(hist, count, 500), percentile(hist, count, 990), percentile(hist, count, 999)) < 0;
+        // buckets by their upper bound in us, empty ones left out
+        int first = 1;
+        for (int i = 0; i < STAT_BUCKETS; i++)
+        {
+            if (!hist[i])
+                continue;
+            failed |= chunkbuf_printf(b, "%s\"%lu\":%lu", first ? "" : ",", 1UL << i, hist[i]) < 0;
+            first = 0;
+        }
+        failed |= chunkbuf_printf(b, "}}") < 0;
+    }
+    failed |= chunkbuf_printf(b, "}") < 0;
+    return failed ? -1 : 0;
+}
+
+void stats_destroy(void)
+{
+    pthread_mutex_lock(&slots_lock);
+    while (all_slots)
+    {
+        thread_stats *next = all_slots->next;
+        free(all_slots);
+        all_slots = next;
+    }
+    pthread_mutex_unlock(&slots_lock);
+}
@@ -0,0 +1,104 @@
+#include <stddef.h>
+#include "response.h"
+
+/**
+ * stats.h
+ *
+ * This file declares the server metrics. every thread counts into its own
+ * cache line aligned slot with plain stores, the slots are only summed when
+ * the metrics are read, so counting adds no shared writes to the hot path.
+ * latencies go into log2 histograms of microseconds.
+ * nothing is counted until stats_enable is called.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+// latency histograms
+#define STAT_QUEUE_WAIT 0 //job dispatched until a pool thread runs it
+#define STAT_PARSE 1	  //one call of the request parser
+#define STAT_RESOLVE 2	  //request analysed: cache lookup or path resolution
+#define STAT_SEND 3		  //response built until its last byte was written
+#define STAT_HISTS 4
+
+// bucket 0 counts latencies under 1us, bucket b latencies under 2^b us
+#define STAT_BUCKETS 32
+
+// connections closed for missing a deadline
+#define STAT_TIMEOUT_HEADER 0 //the request did not arrive in time
+#define STAT_TIMEOUT_IDLE 1	  //no next request on a keep-alive connection
+#define STAT_TIMEOUT_SEND 2	  //the client took the response too slowly
+#define STAT_TIMEOUTS 3
+
+// status codes counted one by one, others are counted together
+#define STAT_STATUS_CODES 11
+
+/**
+ * metrics summed over all threads
+ */
+typedef struct stats_snapshot_st
+{
+	unsigned long status[STAT_STATUS_CODES + 1]; //responses by status, last - other codes
+	unsigned long bytes_sent;
+	unsigned long conns_opened;
+	unsigned long conns_closed;
+	unsigned long timeouts[STAT_TIMEOUTS];
+	unsigned long hist[STAT_HISTS][STAT_BUCKETS];
+} stats_snapshot;
+
+// 1 once stats_enable was called
+extern int stats_enabled;
+
+/**
+ * stats_enable starts counting
+ */
+void stats_enable(void);
+
+/**
+ * stats_now returns the monotonic time in nanoseconds, 0 while stats are disabled
+ */
+unsigned long stats_now(void);
+
+/**
+ * stats_latency records the time since start (a stats_now value) in histogram hist
+ */
+void stats_latency(int hist, unsigned long start);
+
+/**
+ * stats_status counts a response with status code status
+ */
+void stats_status(int status);
+
+/**
+ * stats_bytes counts bytes written to clients
+ */
+void stats_bytes(unsigned long bytes);
+
+/**
+ * stats_conn_opened / stats_conn_closed count client connections
+ */
+void stats_conn_opened(void);
+void stats_conn_closed(void);
+
+/**
+ * stats_timeout counts a connection closed for missing a deadline of kind (a STAT_TIMEOUT_ value)
+ */
+void stats_timeout(int kind);
+
+/**
+ * stats_collect sums the slots of all threads into s
+ */
+void stats_collect(stats_snapshot *s);
+
+/**
+ * stats_render appends the metrics of s as JSON members (without the enclosing
+ * braces) to b, returns -1 on memory failure
+ */
+int stats_render(chunk_buf_t *b, const stats_snapshot *s);
+
+/**
+ * stats_destroy frees the slots of all threads
+ */
+void stats_destroy(void);
+
+#endif
@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+/**
+ * check.h
+ *
+ * This file holds the check macro of the standalone test programs. a
+ * failed check prints its file, line and expression and marks the test
+ * failed, the program goes on and exits with 1 once it finished.
+ */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+static int check_failures;
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            check_failures++;                                              \
+        }                                                                  \
+    } while (0)
+
+// the exit status of a test program, prints its verdict
+#define CHECK_DONE(name) \
+    (printf("%s: %s\n", name, check_failures ? "FAILED" : "ok"), check_failures ? 1 : 0)
+
+#endif
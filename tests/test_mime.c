@@ -0,0 +1,96 @@
+#include "../mime.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EXTRA_EXTS 1000
+
+static int type_is(const char *path, const char *type)
+{
+    const char *got = mime_type(path);
+    if (strcmp(got, type) != 0)
+    {
+        fprintf(stderr, "%s: %s, expected %s\n", path, got, type);
+        return 0;
+    }
+    return 1;
+}
+
+static void test_builtin(void)
+{
+    CHECK(mime_init(NULL) == 0);
+    CHECK(type_is("index.html", "text/html"));
+    CHECK(type_is("/a/b/page.htm", "text/html"));
+    CHECK(type_is("style.css", "text/css"));
+    CHECK(type_is("app.mjs", "text/javascript"));
+    CHECK(type_is("font.woff2", "font/woff2"));
+    CHECK(type_is("archive.tar.gz", "application/gzip"));
+    // extensions match whatever their case
+    CHECK(type_is("PHOTO.JPG", "image/jpeg"));
+    CHECK(type_is("Photo.JpEg", "image/jpeg"));
+    // no usable extension
+    CHECK(type_is("README", MIME_DEFAULT_TYPE));
+    CHECK(type_is("file.", MIME_DEFAULT_TYPE));
+    CHECK(type_is("dir.html/file", MIME_DEFAULT_TYPE));
+    CHECK(type_is("file.unknown", MIME_DEFAULT_TYPE));
+    CHECK(type_is("file.htmlhtmlhtmlhtml", MIME_DEFAULT_TYPE));
+    CHECK(type_is("", MIME_DEFAULT_TYPE));
+    mime_destroy();
+    // a destroyed registry knows nothing
+    CHECK(type_is("index.html", MIME_DEFAULT_TYPE));
+}
+
+// a types file overrides built-in types and adds enough extensions to grow the table many times
+static void test_types_file(void)
+{
+    char path[] = "/tmp/test_mime_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return;
+    FILE *f = fdopen(fd, "w");
+    fprintf(f, "# comment line\n\n");
+    fprintf(f, "text/x-custom HTML foo # trailing comment ignored\n");
+    fprintf(f, "application/x-lonely\n");
+    fprintf(f, "text/x-max abcdefghijklmno abcdefghijklmnop\n");
+    for (int i = 0; i < EXTRA_EXTS; i++)
+        fprintf(f, "application/x-gen%d\tx%d y%d;\n", i, i, i);
+    fclose(f);
+
+    CHECK(mime_init(path) == 0);
+    CHECK(type_is("page.html", "text/x-custom"));
+    CHECK(type_is("bar.FOO", "text/x-custom"));
+    CHECK(type_is("x.ignored", MIME_DEFAULT_TYPE));
+    // built-in types the file does not name are kept
+    CHECK(type_is("page.htm", "text/html"));
+    CHECK(type_is("img.png", "image/png"));
+    // MIME_MAX_EXT bytes are held, a longer extension is never found
+    CHECK(type_is("f.abcdefghijklmno", "text/x-max"));
+    CHECK(type_is("f.abcdefghijklmnop", MIME_DEFAULT_TYPE));
+    int wrong = 0;
+    for (int i = 0; i < EXTRA_EXTS; i++)
+    {
+        char name[32], type[32];
+        snprintf(type, sizeof(type), "application/x-gen%d", i);
+        snprintf(name, sizeof(name), "file.x%d", i);
+        wrong += !type_is(name, type);
+        snprintf(name, sizeof(name), "file.Y%d", i);
+        wrong += !type_is(name, type);
+    }
+    CHECK(wrong == 0);
+    CHECK(type_is("file.x1000", MIME_DEFAULT_TYPE));
+    mime_destroy();
+
+    // a missing file fails (its error is printed) and leaves no registry behind
+    CHECK(mime_init("/nonexistent/mime.types") == -1);
+    CHECK(type_is("index.html", MIME_DEFAULT_TYPE));
+    unlink(path);
+}
+
+int main(void)
+{
+    test_builtin();
+    test_types_file();
+    return CHECK_DONE("test_mime");
+}
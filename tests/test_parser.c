@@ -0,0 +1,185 @@
+// the parser is included rather than linked, so both line end scanners can be checked
+#include "../http_parser.c"
+#include "check.h"
+#include <stdlib.h>
+
+// compare a scanner with memchr on every length, alignment and needle position up to a few vectors
+static void check_scanner(size_t (*scan)(const char *, size_t, char))
+{
+    char buf[256];
+    for (size_t start = 0; start < 32; start++)
+        for (size_t n = 0; n + start <= 160; n++)
+            for (long at = -1; at < (long)n; at++)
+            {
+                memset(buf, 'a', sizeof(buf));
+                // a needle past the end must not be found
+                buf[start + n] = '\n';
+                if (at >= 0)
+                    buf[start + at] = '\n';
+                const char *found = (const char *)memchr(&buf[start], '\n', n);
+                size_t expected = found ? (size_t)(found - &buf[start]) : n;
+                size_t got = scan(&buf[start], n, '\n');
+                if (got != expected)
+                {
+                    fprintf(stderr, "scan start %zu n %zu at %ld: %zu, expected %zu\n", start, n, at, got, expected);
+                    check_failures++;
+                    return;
+                }
+            }
+    // bytes with the high bit set, movemask looks at exactly that bit
+    memset(buf, 0xff, sizeof(buf));
+    buf[77] = (char)0xfe;
+    CHECK(scan(buf, 100, (char)0xfe) == 77);
+    CHECK(scan(buf, 77, (char)0xfe) == 77);
+}
+
+static void test_scanners(void)
+{
+    check_scanner(find_byte_sse2);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        check_scanner(find_byte_avx2);
+    else
+        printf("test_parser: no avx2, its scanner is not checked\n");
+    check_scanner(http_find_byte);
+}
+
+static const char request[] =
+    "\r\n"
+    "GET /dir/index.html?q=1 HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Accept:  \t text/html \t\r\n"
+    "X-Empty:\r\n"
+    "Connection: keep-alive\n"
+    "\r\n"
+    "GET /next HTTP/1.0\r\n\r\n";
+
+static void check_request(const http_request *req, const char *buf)
+{
+    CHECK(req->state == HTTP_STATE_DONE);
+    CHECK(http_slice_eq(buf, req->method, "GET"));
+    CHECK(http_slice_eq(buf, req->target, "/dir/index.html?q=1"));
+    CHECK(req->version_minor == 1);
+    CHECK(req->header_count == 4);
+    const http_header *h = http_find_header(req, buf, "accept");
+    CHECK(h && http_slice_eq(buf, h->value, "text/html"));
+    h = http_find_header(req, buf, "X-EMPTY");
+    CHECK(h && h->value.len == 0);
+    h = http_find_header(req, buf, "connection");
+    CHECK(h && http_slice_caseeq(buf, h->value, "Keep-Alive"));
+    CHECK(http_find_header(req, buf, "Cookie") == NULL);
+    CHECK(req->length == strlen(request) - strlen("GET /next HTTP/1.0\r\n\r\n"));
+}
+
+static void test_whole(void)
+{
+    http_request req;
+    http_parser_init(&req);
+    CHECK(http_parse(&req, request, strlen(request)) == HTTP_PARSE_DONE);
+    check_request(&req, request);
+    // a finished parser keeps its result
+    CHECK(http_parse(&req, request, strlen(request)) == HTTP_PARSE_DONE);
+    // the pipelined request behind it
+    http_parser_init(&req);
+    const char *next = &request[strlen(request) - strlen("GET /next HTTP/1.0\r\n\r\n")];
+    CHECK(http_parse(&req, next, strlen(next)) == HTTP_PARSE_DONE);
+    CHECK(http_slice_eq(next, req.target, "/next") && req.version_minor == 0 && req.header_count == 0);
+}
+
+// every split of the request into reads gives the same result as one read
+static void test_partial(void)
+{
+    size_t len = strlen(request);
+    char buf[sizeof(request)];
+    for (size_t step = 1; step <= 7; step++)
+    {
+        http_request req;
+        http_parser_init(&req);
+        memset(buf, 0, sizeof(buf));
+        size_t have = 0;
+        int result = HTTP_PARSE_MORE;
+        while (result == HTTP_PARSE_MORE && have < len)
+        {
+            size_t n = have + step <= len ? step : len - have;
+            memcpy(&buf[have], &request[have], n);
+            have += n;
+            result = http_parse(&req, buf, have);
+            // nothing before the scan position is looked at again
+            CHECK(req.pos <= have);
+        }
+        CHECK(result == HTTP_PARSE_DONE);
+        check_request(&req, buf);
+    }
+    // one byte at a time, the request is incomplete until its empty line
+    http_request req;
+    http_parser_init(&req);
+    size_t end = strlen(request) - strlen("GET /next HTTP/1.0\r\n\r\n");
+    for (size_t have = 1; have < end; have++)
+        CHECK(http_parse(&req, request, have) == HTTP_PARSE_MORE);
+    CHECK(http_parse(&req, request, end) == HTTP_PARSE_DONE);
+}
+
+static int parse_text(const char *text)
+{
+    http_request req;
+    http_parser_init(&req);
+    return http_parse(&req, text, strlen(text));
+}
+
+static void test_errors(void)
+{
+    CHECK(parse_text("GET / HTTP/2.0\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET /\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET  / HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text(" GET / HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("G(T / HTTP/1.1\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET / HTTP/1.1\r\nHost\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET / HTTP/1.1\r\n: x\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET / HTTP/1.1\r\nBad Name: x\r\n\r\n") == HTTP_PARSE_ERROR);
+    CHECK(parse_text("GET / HTTP/1.1\r\nHost: x\r\n") == HTTP_PARSE_MORE);
+}
+
+static void test_limits(void)
+{
+    // a line of exactly HTTP_MAX_LINE bytes is accepted, one more byte is not
+    char *buf = (char *)malloc(HTTP_MAX_LINE * 2 + 64);
+    strcpy(buf, "GET / HTTP/1.1\r\nX: ");
+    size_t at = strlen(buf);
+    size_t value = HTTP_MAX_LINE - 3;
+    memset(&buf[at], 'v', value);
+    strcpy(&buf[at + value], "\r\n\r\n");
+    CHECK(parse_text(buf) == HTTP_PARSE_DONE);
+    memset(&buf[at], 'v', value + 1);
+    strcpy(&buf[at + value + 1], "\r\n\r\n");
+    CHECK(parse_text(buf) == HTTP_PARSE_TOO_LARGE);
+    // an unterminated line is refused as soon as it is over the limit, not once its end arrives
+    http_request req;
+    http_parser_init(&req);
+    memset(&buf[at], 'v', HTTP_MAX_LINE);
+    CHECK(http_parse(&req, buf, at + HTTP_MAX_LINE - 3) == HTTP_PARSE_MORE);
+    CHECK(http_parse(&req, buf, at + HTTP_MAX_LINE) == HTTP_PARSE_TOO_LARGE);
+    CHECK(http_parse(&req, buf, at + HTTP_MAX_LINE) == HTTP_PARSE_TOO_LARGE);
+    free(buf);
+
+    // HTTP_MAX_HEADERS headers fit, one more does not
+    char headers[HTTP_MAX_HEADERS * 16 + 64];
+    for (int extra = 0; extra <= 1; extra++)
+    {
+        size_t len = sprintf(headers, "GET / HTTP/1.1\r\n");
+        for (int i = 0; i < HTTP_MAX_HEADERS + extra; i++)
+            len += sprintf(&headers[len], "H%d: %d\r\n", i, i);
+        strcpy(&headers[len], "\r\n");
+        CHECK(parse_text(headers) == (extra ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_DONE));
+    }
+}
+
+int main(void)
+{
+    test_scanners();
+    test_whole();
+    test_partial();
+    test_errors();
+    test_limits();
+    return CHECK_DONE("test_parser");
+}
@@ -0,0 +1,226 @@
+#include "../lfqueue.h"
+#include "check.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define THIEVES 3
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS 200000
+
+// items are numbers from 2 up, clear of NULL and WS_ABORT
+#define ITEM(n) ((void *)(uintptr_t)((n) + 2))
+#define NUMBER(item) ((long)(uintptr_t)(item) - 2)
+
+static void test_deque_single(void)
+{
+    ws_deque d;
+    CHECK(ws_deque_init(&d, 5) == 0);
+    // capacity rounds up to 8
+    for (int i = 0; i < 8; i++)
+        CHECK(ws_push(&d, ITEM(i)) == 0);
+    CHECK(ws_push(&d, ITEM(8)) == -1);
+    CHECK(ws_size(&d) == 8);
+    // the owner takes the newest, thieves the oldest
+    CHECK(ws_pop(&d) == ITEM(7));
+    CHECK(ws_steal(&d) == ITEM(0));
+    CHECK(ws_steal(&d) == ITEM(1));
+    CHECK(ws_pop(&d) == ITEM(6));
+    CHECK(ws_size(&d) == 4);
+    for (int i = 5; i >= 2; i--)
+        CHECK(ws_pop(&d) == ITEM(i));
+    CHECK(ws_pop(&d) == NULL);
+    CHECK(ws_steal(&d) == WS_EMPTY);
+    CHECK(ws_size(&d) == 0);
+    // the indexes wrap around the slots many times
+    for (int round = 0; round < 1000; round++)
+    {
+        CHECK(ws_push(&d, ITEM(round)) == 0);
+        CHECK(ws_push(&d, ITEM(round + 1)) == 0);
+        CHECK(ws_steal(&d) == ITEM(round));
+        CHECK(ws_pop(&d) == ITEM(round + 1));
+    }
+    CHECK(ws_pop(&d) == NULL);
+    ws_deque_destroy(&d);
+}
+
+static void test_mpmc_single(void)
+{
+    mpmc_ring q;
+    CHECK(mpmc_init(&q, 3) == 0);
+    // capacity rounds up to 4
+    for (int i = 0; i < 4; i++)
+        CHECK(mpmc_enqueue(&q, ITEM(i)) == 0);
+    CHECK(mpmc_enqueue(&q, ITEM(4)) == -1);
+    for (int i = 0; i < 4; i++)
+        CHECK(mpmc_dequeue(&q) == ITEM(i));
+    CHECK(mpmc_dequeue(&q) == NULL);
+    for (int i = 0; i < 1000; i++)
+    {
+        CHECK(mpmc_enqueue(&q, ITEM(i)) == 0);
+        CHECK(mpmc_dequeue(&q) == ITEM(i));
+    }
+    CHECK(mpmc_dequeue(&q) == NULL);
+    mpmc_destroy(&q);
+}
+
+static ws_deque deque;
+static atomic_int taken[ITEMS];
+static atomic_int owner_done;
+
+static void take(void *item)
+{
+    long n = NUMBER(item);
+    if (n < 0 || n >= ITEMS)
+    {
+        fprintf(stderr, "foreign item %ld\n", n);
+        check_failures++;
+        return;
+    }
+    atomic_fetch_add(&taken[n], 1);
+}
+
+static void *thief(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int done = atomic_load(&owner_done);
+        void *item = ws_steal(&deque);
+        if (item == WS_EMPTY)
+        {
+            // only an empty deque seen after the owner finished means nothing is left
+            if (done)
+                break;
+            // waiting threads give up the cpu, the test must also progress on a single core
+            sched_yield();
+        }
+        else if (item != WS_ABORT)
+            take(item);
+    }
+    return NULL;
+}
+
+// the owner pushes and pops while thieves steal, every item is taken exactly once
+static void test_deque_threads(void)
+{
+    pthread_t thieves[THIEVES];
+    CHECK(ws_deque_init(&deque, 64) == 0);
+    for (int i = 0; i < THIEVES; i++)
+        pthread_create(&thieves[i], NULL, thief, NULL);
+    long next = 0;
+    unsigned int seed = 1;
+    while (next < ITEMS)
+    {
+        // bursts of pushes and pops, a full deque is drained by popping
+        int pushes = rand_r(&seed) % 8 + 1;
+        for (int i = 0; i < pushes && next < ITEMS; i++)
+        {
+            if (ws_push(&deque, ITEM(next)) == 0)
+                next++;
+            else
+                break;
+        }
+        int pops = rand_r(&seed) % 4;
+        for (int i = 0; i < pops; i++)
+        {
+            void *item = ws_pop(&deque);
+            if (item)
+                take(item);
+        }
+    }
+    void *item;
+    while ((item = ws_pop(&deque)) != NULL)
+        take(item);
+    atomic_store(&owner_done, 1);
+    for (int i = 0; i < THIEVES; i++)
+        pthread_join(thieves[i], NULL);
+    int wrong = 0;
+    for (int i = 0; i < ITEMS; i++)
+        if (atomic_load(&taken[i]) != 1 && wrong++ < 5)
+            fprintf(stderr, "deque item %d taken %d times\n", i, atomic_load(&taken[i]));
+    CHECK(wrong == 0);
+    ws_deque_destroy(&deque);
+}
+
+static mpmc_ring ring;
+static atomic_int consumed[PRODUCERS * ITEMS];
+static atomic_long total_consumed;
+
+static void *producer(void *arg)
+{
+    long p = (long)(intptr_t)arg;
+    for (long i = 0; i < ITEMS; i++)
+        while (mpmc_enqueue(&ring, ITEM(p * ITEMS + i)) < 0)
+            sched_yield();
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    (void)arg;
+    long last[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; p++)
+        last[p] = -1;
+    while (atomic_load(&total_consumed) < PRODUCERS * ITEMS)
+    {
+        void *item = mpmc_dequeue(&ring);
+        if (!item)
+        {
+            sched_yield();
+            continue;
+        }
+        long n = NUMBER(item);
+        if (n < 0 || n >= PRODUCERS * ITEMS)
+        {
+            fprintf(stderr, "foreign item %ld\n", n);
+            check_failures++;
+            atomic_fetch_add(&total_consumed, 1);
+            continue;
+        }
+        // one producer's items reach any consumer in the order they were enqueued
+        long p = n / ITEMS, i = n % ITEMS;
+        if (i <= last[p])
+        {
+            fprintf(stderr, "item %ld of producer %ld after %ld\n", i, p, last[p]);
+            check_failures++;
+        }
+        last[p] = i;
+        atomic_fetch_add(&consumed[n], 1);
+        atomic_fetch_add(&total_consumed, 1);
+    }
+    return NULL;
+}
+
+// producers and consumers share a small ring, every item comes out exactly once
+static void test_mpmc_threads(void)
+{
+    pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+    CHECK(mpmc_init(&ring, 16) == 0);
+    for (long i = 0; i < CONSUMERS; i++)
+        pthread_create(&consumers[i], NULL, consumer, NULL);
+    for (long i = 0; i < PRODUCERS; i++)
+        pthread_create(&producers[i], NULL, producer, (void *)(intptr_t)i);
+    for (int i = 0; i < PRODUCERS; i++)
+        pthread_join(producers[i], NULL);
+    for (int i = 0; i < CONSUMERS; i++)
+        pthread_join(consumers[i], NULL);
+    int wrong = 0;
+    for (long n = 0; n < PRODUCERS * ITEMS; n++)
+        if (atomic_load(&consumed[n]) != 1 && wrong++ < 5)
+            fprintf(stderr, "ring item %ld consumed %d times\n", n, atomic_load(&consumed[n]));
+    CHECK(wrong == 0);
+    CHECK(mpmc_dequeue(&ring) == NULL);
+    mpmc_destroy(&ring);
+}
+
+int main(void)
+{
+    test_deque_single();
+    test_mpmc_single();
+    test_deque_threads();
+    test_mpmc_threads();
+    return CHECK_DONE("test_queues");
+}
@@ -0,0 +1,128 @@
+#include "../conditional.h"
+#include "check.h"
+#include <string.h>
+
+#define ETAG "\"12-400-5f00\""
+#define LAST_MODIFIED "Sun, 06 Nov 1994 08:49:37 GMT"
+
+static byte_range ranges[RANGE_MAX];
+static int count;
+
+// the Range verdict for a request carrying the header lines in headers, on a file of size bytes
+static int ranges_of(const char *headers, off_t size)
+{
+    static char buff[4096];
+    snprintf(buff, sizeof(buff), "GET /file HTTP/1.1\r\n%s\r\n", headers);
+    http_request hr;
+    http_parser_init(&hr);
+    if (http_parse(&hr, buff, strlen(buff)) != HTTP_PARSE_DONE)
+    {
+        fprintf(stderr, "request not parsed: %s\n", headers);
+        check_failures++;
+        return -1;
+    }
+    count = -1;
+    return request_ranges(&hr, buff, ETAG, LAST_MODIFIED, size, ranges, &count);
+}
+
+static int range_is(int i, off_t first, off_t last)
+{
+    return i < count && ranges[i].first == first && ranges[i].last == last;
+}
+
+static void test_single(void)
+{
+    CHECK(ranges_of("Range: bytes=0-99\r\n", 1000) == RANGE_OK && count == 1 && range_is(0, 0, 99));
+    CHECK(ranges_of("Range: bytes=500-\r\n", 1000) == RANGE_OK && count == 1 && range_is(0, 500, 999));
+    // the last byte is clamped to the file
+    CHECK(ranges_of("Range: bytes=900-5000\r\n", 1000) == RANGE_OK && range_is(0, 900, 999));
+    CHECK(ranges_of("Range: bytes=999-999\r\n", 1000) == RANGE_OK && range_is(0, 999, 999));
+    CHECK(ranges_of("range: BYTES=0-0\r\n", 1000) == RANGE_OK && range_is(0, 0, 0));
+}
+
+static void test_suffix(void)
+{
+    CHECK(ranges_of("Range: bytes=-100\r\n", 1000) == RANGE_OK && count == 1 && range_is(0, 900, 999));
+    // a suffix longer than the file is the whole file
+    CHECK(ranges_of("Range: bytes=-5000\r\n", 1000) == RANGE_OK && range_is(0, 0, 999));
+    CHECK(ranges_of("Range: bytes=-1\r\n", 1) == RANGE_OK && range_is(0, 0, 0));
+    // the last 0 bytes are no bytes
+    CHECK(ranges_of("Range: bytes=-0\r\n", 1000) == RANGE_UNSATISFIABLE && count == 0);
+    CHECK(ranges_of("Range: bytes=-\r\n", 1000) == RANGE_NONE);
+}
+
+static void test_several(void)
+{
+    CHECK(ranges_of("Range: bytes=0-9, 20-29,-5\r\n", 100) == RANGE_OK && count == 3 && range_is(0, 0, 9) &&
+          range_is(1, 20, 29) && range_is(2, 95, 99));
+    // overlapping and unordered ranges are served as asked, in the order asked
+    CHECK(ranges_of("Range: bytes=50-99,0-60,40-45\r\n", 100) == RANGE_OK && count == 3 && range_is(0, 50, 99) &&
+          range_is(1, 0, 60) && range_is(2, 40, 45));
+    CHECK(ranges_of("Range: bytes=0-10,0-10\r\n", 100) == RANGE_OK && count == 2 && range_is(0, 0, 10) &&
+          range_is(1, 0, 10));
+    // a range starting past the end is dropped, the others are still served
+    CHECK(ranges_of("Range: bytes=200-300,10-19\r\n", 100) == RANGE_OK && count == 1 && range_is(0, 10, 19));
+    // empty list elements are skipped
+    CHECK(ranges_of("Range: bytes=,0-1,,2-3,\r\n", 100) == RANGE_OK && count == 2 && range_is(1, 2, 3));
+}
+
+static void test_limit(void)
+{
+    char header[512];
+    for (int extra = 0; extra <= 1; extra++)
+    {
+        size_t len = sprintf(header, "Range: bytes=0-0");
+        for (int i = 1; i < RANGE_MAX + extra; i++)
+            len += sprintf(&header[len], ",%d-%d", i * 2, i * 2);
+        strcpy(&header[len], "\r\n");
+        int result = ranges_of(header, 1000);
+        // over RANGE_MAX ranges the whole file is sent
+        CHECK(extra ? result == RANGE_NONE : result == RANGE_OK && count == RANGE_MAX);
+    }
+}
+
+static void test_unsatisfiable(void)
+{
+    CHECK(ranges_of("Range: bytes=1000-\r\n", 1000) == RANGE_UNSATISFIABLE && count == 0);
+    CHECK(ranges_of("Range: bytes=1000-2000,5000-\r\n", 1000) == RANGE_UNSATISFIABLE);
+    // nothing of an empty file can be satisfied
+    CHECK(ranges_of("Range: bytes=0-\r\n", 0) == RANGE_UNSATISFIABLE);
+    CHECK(ranges_of("Range: bytes=-10\r\n", 0) == RANGE_UNSATISFIABLE);
+}
+
+static void test_ignored(void)
+{
+    CHECK(ranges_of("", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: items=0-1\r\n", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=\r\n", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=9-1\r\n", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=a-1\r\n", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=0-1;x\r\n", 1000) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=0-1,5\r\n", 1000) == RANGE_NONE);
+    // an offset that overflows off_t is malformed
+    CHECK(ranges_of("Range: bytes=0-99999999999999999999\r\n", 1000) == RANGE_NONE);
+}
+
+static void test_if_range(void)
+{
+    CHECK(ranges_of("Range: bytes=0-9\r\nIf-Range: " ETAG "\r\n", 100) == RANGE_OK && range_is(0, 0, 9));
+    CHECK(ranges_of("Range: bytes=0-9\r\nIf-Range: " LAST_MODIFIED "\r\n", 100) == RANGE_OK);
+    // a changed file (or a weak tag) is sent whole
+    CHECK(ranges_of("Range: bytes=0-9\r\nIf-Range: \"other\"\r\n", 100) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=0-9\r\nIf-Range: W/" ETAG "\r\n", 100) == RANGE_NONE);
+    CHECK(ranges_of("Range: bytes=0-9\r\nIf-Range: Mon, 07 Nov 1994 08:49:37 GMT\r\n", 100) == RANGE_NONE);
+    // a mismatch wins over an unsatisfiable range
+    CHECK(ranges_of("Range: bytes=500-\r\nIf-Range: \"other\"\r\n", 100) == RANGE_NONE);
+}
+
+int main(void)
+{
+    test_single();
+    test_suffix();
+    test_several();
+    test_limit();
+    test_unsatisfiable();
+    test_ignored();
+    test_if_range();
+    return CHECK_DONE("test_ranges");
+}
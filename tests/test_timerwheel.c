@@ -0,0 +1,175 @@
+#include "../timerwheel.h"
+#include "check.h"
+#include <stddef.h>
+#include <time.h>
+
+// the wheel reads the monotonic clock through clock_gettime, the test's definition replaces libc's
+static unsigned long fake_ms = 123456789;
+
+int clock_gettime(clockid_t clk, struct timespec *ts)
+{
+    (void)clk;
+    ts->tv_sec = fake_ms / 1000;
+    ts->tv_nsec = (fake_ms % 1000) * 1000000;
+    return 0;
+}
+
+typedef struct test_timer_st
+{
+    wheel_timer timer;
+    unsigned long due;	 //tick the timer must fire at
+    unsigned long fired; //tick it fired at, 0 - not yet
+    int fires;			 //times it fired
+    int period;			 //ms it re-arms itself with from the callback, 0 - once
+} test_timer;
+
+#define TIMER_OF(t) ((test_timer *)((char *)(t) - offsetof(test_timer, timer)))
+
+static void on_expired(wheel_timer *t, void *arg)
+{
+    timer_wheel *w = (timer_wheel *)arg;
+    test_timer *tt = TIMER_OF(t);
+    CHECK(t->prev == NULL);
+    tt->fired = w->now;
+    tt->fires++;
+    if (tt->period)
+    {
+        wheel_arm(w, t, tt->period);
+        tt->due = w->now + tt->period / WHEEL_TICK_MS;
+    }
+}
+
+static void arm(timer_wheel *w, test_timer *tt, unsigned long ms)
+{
+    wheel_arm(w, &tt->timer, ms);
+    unsigned long ticks = (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    tt->due = w->now + (ticks ? ticks : 1);
+    tt->fired = 0;
+    tt->fires = 0;
+}
+
+// move the clock n ticks, advancing the wheel after every one (or once at the end)
+static void run(timer_wheel *w, unsigned long n, int each)
+{
+    for (unsigned long i = 0; i < n; i++)
+    {
+        fake_ms += WHEEL_TICK_MS;
+        if (each)
+            wheel_advance(w, on_expired, w);
+    }
+    if (!each)
+        wheel_advance(w, on_expired, w);
+}
+
+// deadlines on both sides of every level boundary fire at their tick, after moving down the levels
+static void test_cascade(int each)
+{
+    static const unsigned long ticks[] = {1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 5000, 262143, 262144, 262145, 300001};
+    enum { NTIMERS = sizeof(ticks) / sizeof(ticks[0]) };
+    test_timer timers[NTIMERS * 2] = {0};
+    timer_wheel w;
+    wheel_init(&w);
+    // an unaligned start: every level is part way through its turn
+    run(&w, 37 + 64 * 5, 1);
+    for (int i = 0; i < NTIMERS; i++)
+    {
+        arm(&w, &timers[i], ticks[i] * WHEEL_TICK_MS);
+        // a partial tick rounds up
+        arm(&w, &timers[NTIMERS + i], ticks[i] * WHEEL_TICK_MS - WHEEL_TICK_MS / 2);
+    }
+    CHECK(w.count == NTIMERS * 2);
+    unsigned long start = w.now;
+    unsigned long last = ticks[NTIMERS - 1];
+    if (each)
+    {
+        for (unsigned long t = 1; t <= last; t++)
+        {
+            run(&w, 1, 1);
+            // nothing fires early
+            for (int i = 0; i < NTIMERS * 2; i++)
+                if (timers[i].fires && timers[i].fired != timers[i].due)
+                {
+                    fprintf(stderr, "timer of %lu ticks fired at %lu, due %lu\n", ticks[i % NTIMERS],
+                            timers[i].fired - start, timers[i].due - start);
+                    check_failures++;
+                    timers[i].fired = timers[i].due;
+                }
+        }
+    }
+    else
+        run(&w, last, 0);
+    for (int i = 0; i < NTIMERS * 2; i++)
+        if (timers[i].fires != 1 || timers[i].fired != timers[i].due)
+        {
+            fprintf(stderr, "timer of %lu ticks fired %d times, at %lu, due %lu\n", ticks[i % NTIMERS], timers[i].fires,
+                    timers[i].fired - start, timers[i].due - start);
+            check_failures++;
+        }
+    CHECK(w.count == 0);
+}
+
+static void test_cancel_rearm(void)
+{
+    test_timer a = {0}, b = {0}, c = {0};
+    timer_wheel w;
+    wheel_init(&w);
+    arm(&w, &a, 1000);
+    arm(&w, &b, 70000);
+    arm(&w, &c, 500);
+    wheel_cancel(&w, &a.timer);
+    CHECK(a.timer.prev == NULL && w.count == 2);
+    // cancelling twice is harmless
+    wheel_cancel(&w, &a.timer);
+    CHECK(w.count == 2);
+    // re-arming an armed timer moves it, it is counted once
+    arm(&w, &b, 200);
+    CHECK(w.count == 2);
+    run(&w, 700, 1);
+    CHECK(a.fires == 0);
+    CHECK(b.fires == 1 && b.fired == b.due);
+    CHECK(c.fires == 1 && c.fired == c.due);
+    CHECK(w.count == 0);
+}
+
+static void test_periodic(void)
+{
+    test_timer p = {0}, once = {0};
+    timer_wheel w;
+    wheel_init(&w);
+    arm(&w, &p, 300);
+    p.period = 300;
+    arm(&w, &once, 6500);
+    // the callback re-arms the timer, in single ticks and across a jump of many ticks
+    run(&w, 100, 1);
+    CHECK(p.fires == 33 && once.fires == 1);
+    run(&w, 100, 0);
+    CHECK(p.fires == 66);
+    CHECK(w.count == 1);
+    wheel_cancel(&w, &p.timer);
+    CHECK(w.count == 0);
+}
+
+// a wheel left empty while its engine slept is not behind when a timer is armed
+static void test_idle_wheel(void)
+{
+    test_timer t = {0};
+    timer_wheel w;
+    wheel_init(&w);
+    fake_ms += 3600 * 1000;
+    arm(&w, &t, 200);
+    CHECK(t.due == wheel_now() + 2);
+    run(&w, 1, 1);
+    CHECK(t.fires == 0);
+    run(&w, 1, 1);
+    CHECK(t.fires == 1);
+}
+
+int main(void)
+{
+    test_cascade(1);
+    test_cascade(0);
+    test_cancel_rearm();
+    test_periodic();
+    test_idle_wheel();
+    return CHECK_DONE("test_timerwheel");
+}
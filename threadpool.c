@@ -1,12 +1,70 @@
+#define _GNU_SOURCE
 #include "threadpool.h"
+#include "lfqueue.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
 
 #define MEMORY_FAILED 1
 #define MUTEX_INIT_FAILED 2
 #define COND_INIT_FAILED 3
 #define THREAD_CREATE_FAILED 4
 
+// work-stealing: per-worker deque size, further jobs go to the shared ring
+#define WS_DEQUE_CAPACITY 4096
+// work-stealing: rounds an idle worker spins before parking
+#define WS_SPIN_ROUNDS 200
+// elastic pools: share of a growth window the threads must be busy for the pool to grow
+#define POOL_BUSY_GROW_PERCENT 90
+
+/**
+ * one worker of a work-stealing pool
+ */
+typedef struct ws_worker_st
+{
+    ws_deque deque;          // jobs this worker dispatched itself
+    struct ws_pool_st *pool; // pool the worker belongs to
+    int id;                  // index in the workers array
+    unsigned int seed;       // victim selection
+    // counters written by the owner only, summed when read
+    unsigned long steals;
+    unsigned long steal_aborts;
+    unsigned long parks;
+} ws_worker;
+
+/**
+ * work-stealing state of a pool
+ */
+struct ws_pool_st
+{
+    threadpool *owner; // pool the state belongs to
+    ws_worker *workers;
+    int nworkers;
+    work_t *nodes;         // job node slab
+    mpmc_ring free_nodes;  // recycled job nodes
+    mpmc_ring inject;      // jobs dispatched from outside the pool
+    _Alignas(CACHE_LINE) atomic_long pending; // jobs queued and not taken yet
+    _Alignas(CACHE_LINE) atomic_int sleepers; // parked workers
+    _Alignas(CACHE_LINE) atomic_ulong dispatched;
+    atomic_ulong full_waits;
+    atomic_ulong rejected;
+    atomic_ulong expired;
+    atomic_int stop;
+    atomic_int closed; // dispatch refuses jobs, written by destroy while other threads dispatch
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond;
+};
+
+// worker running on this thread, NULL outside work-stealing pools
+static __thread ws_worker *current_worker;
+// pool whose thread this is, NULL outside pool threads
+static __thread threadpool *current_pool;
+
 void err(int err_type, void *threadpool, void *threads)
 {
     if (threadpool)
@@ -31,10 +89,200 @@ void err(int err_type, void *threadpool, void *threads)
     }
 }
 
+// lock the queue, counting how often it was already taken
+static void lock_queue(threadpool *t)
+{
+    if (pthread_mutex_trylock(&(t->qlock)))
+    {
+        pthread_mutex_lock(&(t->qlock));
+        t->lock_contended++;
+    }
+}
+
+// start a pool thread with the pool's stack size
+static int start_thread(threadpool *t, pthread_t *thread, void *(*routine)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr))
+        return -1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (t->cpu >= 0)
+        CPU_SET(t->cpu, &set);
+    if ((t->stack_size && pthread_attr_setstacksize(&attr, t->stack_size)) ||
+        (t->cpu >= 0 && pthread_attr_setaffinity_np(&attr, sizeof(set), &set)))
+    {
+        pthread_attr_destroy(&attr);
+        return -1;
+    }
+    int failed = pthread_create(thread, &attr, routine, arg);
+    pthread_attr_destroy(&attr);
+    return failed;
+}
+
+static unsigned long monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// dispatch time of a job, a clock is only read if someone looks at it
+static unsigned long job_clock(threadpool *t)
+{
+    return t->max_wait ? monotonic_ns() : stats_now();
+}
+
+static int is_elastic(threadpool *t)
+{
+    return t->max_threads > t->min_threads;
+}
+
+// elastic pools: integrate the number of busy threads up to now, called (under qlock) before it changes
+static void account_busy(threadpool *t, unsigned long now)
+{
+    t->busy_time += (unsigned long)(t->num_threads - t->idle) * (now - t->last_change);
+    t->last_change = now;
+}
+
+// elastic pools: start one more thread, qlock held
+static void grow_pool(threadpool *t, unsigned long now)
+{
+    // threads that exited on their idle timeout are reaped first, they already left the lock
+    while (t->nretired > 0)
+        pthread_join(t->retired[--t->nretired], NULL);
+    // the new thread locks the queue before looking itself up, so its id is stored by then
+    if (start_thread(t, &(t->threads[t->num_threads]), do_work, t))
+    {
+        perror("ERROR: THREAD_CREATE_FAILED");
+        return;
+    }
+    account_busy(t, now);
+    t->num_threads++;
+    t->grows++;
+}
+
+// elastic pools: once per grow_interval add a thread if the queue stayed busy, qlock held
+static void check_growth(threadpool *t)
+{
+    unsigned long now = monotonic_ns();
+    unsigned long window = now - t->window_start;
+    if (window < t->grow_interval)
+        return;
+    account_busy(t, now);
+    // threads blocked inside a job (disk reads) count as busy as well
+    int saturated = t->busy_time * 100 >= (unsigned long)t->num_threads * window * POOL_BUSY_GROW_PERCENT;
+    t->busy_time = 0;
+    t->window_start = now;
+    if (saturated && t->qsize + t->bulk_qsize > 0 && t->idle == 0 && t->num_threads < t->max_threads)
+        grow_pool(t, now);
+}
+
+// elastic pools: the calling thread leaves the pool after its idle timeout, qlock held
+static void retire_thread(threadpool *t)
+{
+    pthread_t self = pthread_self();
+    account_busy(t, monotonic_ns());
+    for (int i = 0; i < t->num_threads; i++)
+        if (pthread_equal(t->threads[i], self))
+        {
+            t->threads[i] = t->threads[t->num_threads - 1];
+            break;
+        }
+    t->num_threads--;
+    t->retired[t->nretired++] = self;
+    t->shrinks++;
+}
+
+// 1 if a thread may take a job: one waits in the regular lane, or one waits in the
+// bulk lane and fewer than num_threads - reserved threads (at least one) run bulk jobs
+static int bulk_limit(threadpool *t)
+{
+    int limit = t->num_threads - t->reserved;
+    return limit > 0 ? limit : 1;
+}
+
+static int job_ready(threadpool *t)
+{
+    return t->qsize > 0 || (t->bulk_qsize > 0 && t->bulk_running < bulk_limit(t));
+}
+
+// jobs that will wait for a thread: idle threads take the first queued jobs at once, qlock held
+static int jobs_waiting(threadpool *t)
+{
+    return t->qsize - t->idle;
+}
+
+// signal one idle thread for every job a thread may take now that no thread was woken for yet, qlock held
+static void wake_idle(threadpool *t)
+{
+    int jobs = t->qsize;
+    int bulk = bulk_limit(t) - t->bulk_running;
+    if (bulk > 0)
+        jobs += t->bulk_qsize < bulk ? t->bulk_qsize : bulk;
+    int wake = jobs - t->wakeups;
+    if (wake > t->idle - t->wakeups)
+        wake = t->idle - t->wakeups;
+    for (; wake > 0; wake--)
+    {
+        t->wakeups++;
+        pthread_cond_signal(&(t->q_not_empty));
+    }
+}
+
+// 1 if a dequeued bounded job waited past the pool's deadline
+static int job_expired(threadpool *t, work_t *work)
+{
+    return work->expired && t->max_wait && job_clock(t) - work->enqueued > t->max_wait;
+}
+
+// run a dequeued job, the expired routine of a job past its deadline does no real work
+static void run_job(work_t *work, int expired)
+{
+    stats_latency(STAT_QUEUE_WAIT, work->enqueued);
+    if (expired)
+        work->expired(work->arg);
+    else
+        work->routine(work->arg);
+}
+
+static int ws_init(threadpool *t, int capacity);
+static int ws_dispatch(threadpool *t, dispatch_fn dispatch_to_here, dispatch_fn expired, void *arg);
+static void ws_destroy(threadpool *t);
+
+void threadpool_attr_init(threadpool_attr *attr, int num_threads)
+{
+    attr->num_threads = num_threads;
+    attr->mode = THREADPOOL_MUTEX;
+    attr->queue_capacity = WS_QUEUE_CAPACITY;
+    attr->stack_size = 0;
+    attr->cpu = -1;
+    attr->max_queue = 0;
+    attr->max_wait_ms = 0;
+    attr->max_threads = num_threads;
+    attr->idle_timeout = POOL_IDLE_TIMEOUT;
+    attr->grow_interval = POOL_GROW_INTERVAL;
+    attr->reserved = 0;
+}
+
 threadpool *create_threadpool(int num_threads_in_pool)
 {
+    threadpool_attr attr;
+    threadpool_attr_init(&attr, num_threads_in_pool);
+    return create_threadpool_attr(&attr);
+}
+
+threadpool *create_threadpool_attr(const threadpool_attr *attr)
+{
+    int num_threads_in_pool = attr->num_threads;
     if (num_threads_in_pool < 1 || num_threads_in_pool > MAXT_IN_POOL)
         return NULL;
+    if ((attr->mode == THREADPOOL_WORK_STEALING && attr->queue_capacity < 1) || attr->max_queue < 0 || attr->max_wait_ms < 0)
+        return NULL;
+    // work-stealing pools have one deque per thread and keep their size
+    int max_threads = attr->mode == THREADPOOL_MUTEX && attr->max_threads > num_threads_in_pool ? attr->max_threads : num_threads_in_pool;
+    if (max_threads > MAXT_IN_POOL || attr->idle_timeout < 0 || attr->grow_interval < 0 || attr->reserved < 0)
+        return NULL;
     threadpool *t = (threadpool *)calloc(1, sizeof(threadpool));
     if (!t)
     {
@@ -43,12 +291,24 @@ threadpool *create_threadpool(int num_threads_in_pool)
     }
     // threadpool arguments init
     t->num_threads = num_threads_in_pool;
-    t->threads = (pthread_t *)calloc(num_threads_in_pool, sizeof(pthread_t));
+    // an elastic pool keeps its retired threads in a second half of the same array
+    int elastic = max_threads > num_threads_in_pool;
+    t->threads = (pthread_t *)calloc(elastic ? 2 * max_threads : max_threads, sizeof(pthread_t));
     if (!t->threads)
     {
         err(MEMORY_FAILED, t, NULL);
         return NULL;
     }
+    t->min_threads = num_threads_in_pool;
+    t->max_threads = max_threads;
+    t->idle_timeout = (unsigned long)attr->idle_timeout * 1000000000UL;
+    t->grow_interval = (unsigned long)attr->grow_interval * 1000000UL;
+    if (elastic)
+    {
+        t->retired = t->threads + max_threads;
+        t->window_start = monotonic_ns();
+        t->last_change = t->window_start;
+    }
     // start with empty queue
     t->qhead = NULL;
     t->qtail = NULL;
@@ -56,6 +316,22 @@ threadpool *create_threadpool(int num_threads_in_pool)
     // threadpool flags init
     t->shutdown = 0;
     t->dont_accept = 0;
+    t->mode = attr->mode;
+    t->stack_size = attr->stack_size;
+    t->cpu = attr->cpu;
+    t->max_queue = attr->max_queue;
+    t->max_wait = (unsigned long)attr->max_wait_ms * 1000000UL;
+    t->reserved = attr->reserved;
+    if (t->mode == THREADPOOL_WORK_STEALING)
+    {
+        // the work-stealing pool starts its own workers
+        if (ws_init(t, attr->queue_capacity))
+        {
+            err(MEMORY_FAILED, t, t->threads);
+            return NULL;
+        }
+        return t;
+    }
     // threadpool mutex and cond's init
     if (pthread_mutex_init(&(t->qlock), NULL))
     {
@@ -68,7 +344,13 @@ threadpool *create_threadpool(int num_threads_in_pool)
         pthread_mutex_destroy(&(t->qlock));
         return NULL;
     }
-    if (pthread_cond_init(&(t->q_not_empty), NULL))
+    // idle timeouts of an elastic pool are measured on the monotonic clock
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_failed = pthread_cond_init(&(t->q_not_empty), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (cond_failed)
     {
         err(COND_INIT_FAILED, t, t->threads);
         pthread_mutex_destroy(&(t->qlock));
@@ -78,7 +360,7 @@ threadpool *create_threadpool(int num_threads_in_pool)
     // create requested number of threads in threadpool
     for (int i = 0; i < num_threads_in_pool; i++)
     {
-        if (pthread_create(&(t->threads[i]), NULL, do_work, t))
+        if (start_thread(t, &(t->threads[i]), do_work, t))
         {
             err(THREAD_CREATE_FAILED, t, t->threads);
             pthread_mutex_destroy(&(t->qlock));
@@ -90,26 +372,51 @@ threadpool *create_threadpool(int num_threads_in_pool)
     return t;
 }
 
-void dispatch(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg)
+int dispatch(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg)
 {
+    int queued;
+    if (from_me->mode == THREADPOOL_WORK_STEALING)
+        queued = ws_dispatch(from_me, dispatch_to_here, NULL, arg);
+    else
+        queued = dispatch_bounded(from_me, dispatch_to_here, NULL, arg);
+    // an unbounded job is only refused by a pool being destroyed (or on memory failure)
+    if (queued < 0)
+        fprintf(stderr, "ERROR: DISPATCH_FAILED, job dropped\n");
+    return queued;
+}
 
+int dispatch_bounded(threadpool *from_me, dispatch_fn dispatch_to_here, dispatch_fn expired, void *arg)
+{
+    if (from_me->mode == THREADPOOL_WORK_STEALING)
+        return ws_dispatch(from_me, dispatch_to_here, expired, arg);
     // lock the threadpool to insert new job safely
-    pthread_mutex_lock(&(from_me->qlock));
+    lock_queue(from_me);
     // check if shutdown flag is up
     if (from_me->dont_accept)
-        return;
-    // if (!dispatch_to_here)
-    //     return;
+    {
+        pthread_mutex_unlock(&(from_me->qlock));
+        return -1;
+    }
+    // admission control: a full queue refuses bounded jobs before allocating anything
+    if (expired && from_me->max_queue && jobs_waiting(from_me) >= from_me->max_queue)
+    {
+        from_me->rejected++;
+        pthread_mutex_unlock(&(from_me->qlock));
+        return -1;
+    }
     work_t *work = (work_t *)calloc(1, sizeof(work_t));
     if (!work)
     {
+        pthread_mutex_unlock(&(from_me->qlock));
         err(MEMORY_FAILED, NULL, NULL);
-        return;
+        return -1;
     }
     // init work args
     work->arg = arg;
     work->next = NULL;
     work->routine = dispatch_to_here;
+    work->expired = expired;
+    work->enqueued = job_clock(from_me);
 
     // insert work into queue
     if (!from_me->qhead)
@@ -124,20 +431,147 @@ void dispatch(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg)
     }
     // updating works queue size
     from_me->qsize++;
+    from_me->dispatched++;
+    if (is_elastic(from_me))
+        check_growth(from_me);
+    // signal to sleeping thread to do_work
+    wake_idle(from_me);
     // unlock threadpool for other thread
     pthread_mutex_unlock(&(from_me->qlock));
-    // signal to sleeping thread to do_work
-    pthread_cond_signal(&(from_me->q_not_empty));
+    return 0;
+}
+
+int dispatch_batch(threadpool *from_me, dispatch_fn dispatch_to_here, dispatch_fn expired, void **args, int n)
+{
+    int queued = 0;
+    if (from_me->mode == THREADPOOL_WORK_STEALING)
+    {
+        // the stealing queues take no lock, the jobs go in one by one
+        while (queued < n && ws_dispatch(from_me, dispatch_to_here, expired, args[queued]) == 0)
+            queued++;
+        return queued;
+    }
+    // allocate the job nodes before taking the lock, the batch holds it only to link them
+    work_t *first = NULL, *last = NULL;
+    int allocated = 0;
+    for (; allocated < n; allocated++)
+    {
+        work_t *work = (work_t *)calloc(1, sizeof(work_t));
+        if (!work)
+        {
+            err(MEMORY_FAILED, NULL, NULL);
+            break;
+        }
+        work->routine = dispatch_to_here;
+        work->expired = expired;
+        work->arg = args[allocated];
+        if (last)
+            last->next = work;
+        else
+            first = work;
+        last = work;
+    }
+    lock_queue(from_me);
+    if (!from_me->dont_accept)
+    {
+        queued = allocated;
+        // admission control: the jobs past a full queue are refused, jobs idle threads take do not wait
+        if (expired && from_me->max_queue)
+        {
+            int room = from_me->max_queue - jobs_waiting(from_me);
+            if (queued > room)
+                queued = room > 0 ? room : 0;
+            from_me->rejected += allocated - queued;
+        }
+        unsigned long enqueued = job_clock(from_me);
+        work_t *work = first;
+        for (int i = 0; i < queued; i++)
+        {
+            work_t *next = work->next;
+            work->next = NULL;
+            work->enqueued = enqueued;
+            if (from_me->qtail)
+                from_me->qtail->next = work;
+            else
+                from_me->qhead = work;
+            from_me->qtail = work;
+            work = next;
+        }
+        first = work;
+        from_me->qsize += queued;
+        from_me->dispatched += queued;
+        if (queued && is_elastic(from_me))
+            check_growth(from_me);
+        // a busy thread takes the jobs no idle thread was woken for when it finishes its own
+        wake_idle(from_me);
+    }
+    pthread_mutex_unlock(&(from_me->qlock));
+    // the refused jobs
+    while (first)
+    {
+        work_t *next = first->next;
+        free(first);
+        first = next;
+    }
+    return queued;
+}
+
+int dispatch_bulk(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg)
+{
+    // a worker waiting for a free job node could wait for itself, stealing pools keep one lane
+    if (from_me->mode == THREADPOOL_WORK_STEALING)
+        return -1;
+    work_t *work = (work_t *)calloc(1, sizeof(work_t));
+    if (!work)
+    {
+        err(MEMORY_FAILED, NULL, NULL);
+        return -1;
+    }
+    work->routine = dispatch_to_here;
+    work->arg = arg;
+    work->enqueued = job_clock(from_me);
+    lock_queue(from_me);
+    if (from_me->dont_accept)
+    {
+        pthread_mutex_unlock(&(from_me->qlock));
+        free(work);
+        return -1;
+    }
+    if (from_me->bulk_tail)
+        from_me->bulk_tail->next = work;
+    else
+        from_me->bulk_head = work;
+    from_me->bulk_tail = work;
+    from_me->bulk_qsize++;
+    from_me->bulk_dispatched++;
+    if (is_elastic(from_me))
+        check_growth(from_me);
+    // a job that must wait for a bulk thread to finish is taken by that thread
+    wake_idle(from_me);
+    pthread_mutex_unlock(&(from_me->qlock));
+    return 0;
+}
+
+threadpool *threadpool_current(void)
+{
+    return current_pool;
 }
 
 void destroy_threadpool(threadpool *destroyme)
 {
+    if (destroyme->mode == THREADPOOL_WORK_STEALING)
+    {
+        ws_destroy(destroyme);
+        free(destroyme->threads);
+        free(destroyme);
+        return;
+    }
     // lock the threadpool to other
     pthread_mutex_lock(&(destroyme->qlock));
     // set dont accept flag up
     destroyme->dont_accept = 1;
     // there other jobs to do -> wait
-    if (destroyme->qsize)
+    while (destroyme->qsize || destroyme->bulk_qsize)
         pthread_cond_wait(&(destroyme->q_empty), &(destroyme->qlock));
     // the queue jobs is empty, set shut down flag up
     destroyme->shutdown = 1;
@@ -150,6 +584,9 @@ void destroy_threadpool(threadpool *destroyme)
     // clear the threads by using pthread_join
     for (int i = 0; i < destroyme->num_threads; i++)
         pthread_join(destroyme->threads[i], NULL);
+    // threads that left on their idle timeout
+    for (int i = 0; i < destroyme->nretired; i++)
+        pthread_join(destroyme->retired[i], NULL);
     // free table args from memory
     pthread_cond_destroy(&(destroyme->q_empty));
     pthread_cond_destroy(&(destroyme->q_not_empty));
@@ -161,9 +598,13 @@ void destroy_threadpool(threadpool *destroyme)
 void *do_work(void *p)
 {
     threadpool *t = (threadpool *)p;
+    int bulk = 0; //1 while the job run last came from the bulk lane
+    current_pool = t;
     while (1)
     {
-        pthread_mutex_lock(&(t->qlock));
+        lock_queue(t);
+        if (bulk)
+            t->bulk_running--;
         // if shutdown flag is up, dont accepet new work -> unlock mutex and kill thread
         if (t->shutdown)
         {
@@ -172,34 +613,319 @@ void *do_work(void *p)
         }
 
         // if threse no jobs to so -> go to sleep
-        while (t->qsize == 0)
+        int elastic = is_elastic(t);
+        while (!job_ready(t))
         {
-            pthread_cond_wait(&(t->q_not_empty), &(t->qlock));
+            t->parks++;
+            if (elastic)
+                account_busy(t, monotonic_ns());
+            t->idle++;
+            int timed_out = 0;
+            if (elastic && t->num_threads > t->min_threads && t->idle_timeout)
+            {
+                // threads above the minimum wait for work only so long
+                unsigned long deadline = monotonic_ns() + t->idle_timeout;
+                struct timespec ts = {deadline / 1000000000UL, deadline % 1000000000UL};
+                timed_out = pthread_cond_timedwait(&(t->q_not_empty), &(t->qlock), &ts) == ETIMEDOUT;
+            }
+            else
+                pthread_cond_wait(&(t->q_not_empty), &(t->qlock));
+            if (elastic)
+                account_busy(t, monotonic_ns());
+            t->idle--;
+            // woken, timed out or spuriously: a lost count only costs an extra wakeup later
+            if (t->wakeups > 0)
+                t->wakeups--;
             // if threadpool shut down flag is up leave job and finish thread work
             if (t->shutdown)
             {
                 pthread_mutex_unlock(&(t->qlock));
                 return NULL;
             }
+            if (timed_out && !job_ready(t) && t->num_threads > t->min_threads)
+            {
+                retire_thread(t);
+                pthread_mutex_unlock(&(t->qlock));
+                return NULL;
+            }
         }
-        work_t *cur_work = t->qhead;
-        t->qsize--;
-        if (t->qhead->next)
+        // the regular lane first, bulk jobs only run while it is empty
+        bulk = t->qsize == 0;
+        work_t *cur_work;
+        int expired = 0;
+        if (bulk)
         {
-
-            t->qhead = t->qhead->next;
+            cur_work = t->bulk_head;
+            t->bulk_head = cur_work->next;
+            if (!t->bulk_head)
+                t->bulk_tail = NULL;
+            t->bulk_qsize--;
+            t->bulk_running++;
         }
         else
         {
-            // no other jobs in queue -> set head and tail to be NULL
-            t->qhead = NULL;
-            t->qtail = NULL;
-            // if threadpool dont_accept is up
-            if (t->dont_accept)
-                pthread_cond_signal(&(t->q_empty));
+            cur_work = t->qhead;
+            expired = job_expired(t, cur_work);
+            if (expired)
+                t->expired++;
+            t->qsize--;
+            if (t->qhead->next)
+            {
+
+                t->qhead = t->qhead->next;
+            }
+            else
+            {
+                // no other jobs in queue -> set head and tail to be NULL
+                t->qhead = NULL;
+                t->qtail = NULL;
+            }
         }
+        // if threadpool dont_accept is up
+        if (t->dont_accept && t->qsize == 0 && t->bulk_qsize == 0)
+            pthread_cond_signal(&(t->q_empty));
+        // a bulk job held back while this thread ran one may go to an idle thread now
+        wake_idle(t);
         pthread_mutex_unlock(&(t->qlock));
-        cur_work->routine(cur_work->arg);
+        run_job(cur_work, expired);
         free(cur_work);
     }
 }
+
+void threadpool_get_stats(threadpool *pool, threadpool_stats *stats)
+{
+    memset(stats, 0, sizeof(threadpool_stats));
+    if (pool->mode == THREADPOOL_WORK_STEALING)
+    {
+        struct ws_pool_st *ws = pool->ws;
+        stats->threads = pool->num_threads;
+        long pending = atomic_load(&ws->pending);
+        stats->queued = pending > 0 ? (int)pending : 0;
+        stats->idle = atomic_load(&ws->sleepers);
+        stats->dispatched = atomic_load(&ws->dispatched);
+        stats->full_waits = atomic_load(&ws->full_waits);
+        stats->rejected = atomic_load(&ws->rejected);
+        stats->expired = atomic_load(&ws->expired);
+        // worker counters are read without synchronization, they are estimates
+        for (int i = 0; i < ws->nworkers; i++)
+        {
+            stats->steals += ws->workers[i].steals;
+            stats->steal_aborts += ws->workers[i].steal_aborts;
+            stats->parks += ws->workers[i].parks;
+        }
+        return;
+    }
+    pthread_mutex_lock(&(pool->qlock));
+    stats->threads = pool->num_threads;
+    stats->grows = pool->grows;
+    stats->shrinks = pool->shrinks;
+    stats->queued = pool->qsize;
+    stats->idle = pool->idle;
+    stats->dispatched = pool->dispatched;
+    stats->parks = pool->parks;
+    stats->lock_contended = pool->lock_contended;
+    stats->rejected = pool->rejected;
+    stats->expired = pool->expired;
+    stats->bulk_queued = pool->bulk_qsize;
+    stats->bulk_running = pool->bulk_running;
+    stats->bulk_dispatched = pool->bulk_dispatched;
+    pthread_mutex_unlock(&(pool->qlock));
+}
+
+// work-stealing: own deque first, then the shared ring, then other workers' deques
+static work_t *ws_find_work(ws_worker *w)
+{
+    struct ws_pool_st *ws = w->pool;
+    work_t *work = (work_t *)ws_pop(&w->deque);
+    if (work)
+        return work;
+    work = (work_t *)mpmc_dequeue(&ws->inject);
+    if (work)
+        return work;
+    int n = ws->nworkers;
+    int victim = rand_r(&w->seed) % n;
+    for (int i = 0; i < n; i++, victim = (victim + 1) % n)
+    {
+        if (victim == w->id)
+            continue;
+        void *item;
+        while ((item = ws_steal(&ws->workers[victim].deque)) == WS_ABORT)
+            w->steal_aborts++;
+        if (item)
+        {
+            w->steals++;
+            return (work_t *)item;
+        }
+    }
+    return NULL;
+}
+
+// the work function of a work-stealing worker thread
+static void *ws_do_work(void *p)
+{
+    ws_worker *w = (ws_worker *)p;
+    struct ws_pool_st *ws = w->pool;
+    current_worker = w;
+    current_pool = ws->owner;
+    while (1)
+    {
+        work_t *work = ws_find_work(w);
+        // spin a little before parking, jobs often come in bursts
+        for (int i = 0; !work && i < WS_SPIN_ROUNDS; i++)
+        {
+            if (atomic_load_explicit(&ws->pending, memory_order_relaxed) > 0)
+                work = ws_find_work(w);
+            else
+                sched_yield();
+        }
+        if (!work)
+        {
+            pthread_mutex_lock(&(ws->park_lock));
+            atomic_fetch_add(&ws->sleepers, 1);
+            // pending is re-checked after announcing the sleeper, dispatch checks sleepers after raising pending
+            while (atomic_load(&ws->pending) <= 0 && !atomic_load(&ws->stop))
+            {
+                w->parks++;
+                pthread_cond_wait(&(ws->park_cond), &(ws->park_lock));
+            }
+            atomic_fetch_sub(&ws->sleepers, 1);
+            int stop = atomic_load(&ws->stop) && atomic_load(&ws->pending) <= 0;
+            pthread_mutex_unlock(&(ws->park_lock));
+            if (stop)
+                return NULL;
+            continue;
+        }
+        atomic_fetch_sub(&ws->pending, 1);
+        int expired = job_expired(ws->owner, work);
+        if (expired)
+            atomic_fetch_add_explicit(&ws->expired, 1, memory_order_relaxed);
+        run_job(work, expired);
+        // recycle the node, the ring has a cell for every node of the slab
+        if (mpmc_enqueue(&ws->free_nodes, work) < 0)
+            fprintf(stderr, "ERROR: job node lost, free ring full\n");
+    }
+}
+
+static int ws_dispatch(threadpool *t, dispatch_fn dispatch_to_here, dispatch_fn expired, void *arg)
+{
+    struct ws_pool_st *ws = t->ws;
+    if (atomic_load(&ws->closed))
+        return -1;
+    // admission control: bounded jobs are refused instead of waiting for room, parked workers take one each
+    if (expired && t->max_queue && atomic_load_explicit(&ws->pending, memory_order_relaxed) - atomic_load_explicit(&ws->sleepers, memory_order_relaxed) >= t->max_queue)
+    {
+        atomic_fetch_add_explicit(&ws->rejected, 1, memory_order_relaxed);
+        return -1;
+    }
+    work_t *work;
+    ws_worker *self = current_worker;
+    int inside = self && self->pool == ws;
+    // bounded queue: wait for a job node to be recycled. a worker never waits, the nodes
+    // come back from workers and all of them waiting here would recycle none
+    while (!(work = (work_t *)mpmc_dequeue(&ws->free_nodes)))
+    {
+        if (expired || inside)
+        {
+            atomic_fetch_add_explicit(&ws->rejected, 1, memory_order_relaxed);
+            return -1;
+        }
+        atomic_fetch_add_explicit(&ws->full_waits, 1, memory_order_relaxed);
+        sched_yield();
+    }
+    work->routine = dispatch_to_here;
+    work->expired = expired;
+    work->arg = arg;
+    work->next = NULL;
+    work->enqueued = job_clock(t);
+    // a worker dispatching from inside the pool keeps the job on its own deque
+    if ((!inside || ws_push(&self->deque, work) < 0) && mpmc_enqueue(&ws->inject, work) < 0)
+    {
+        // no room left anywhere, the node goes back unused
+        mpmc_enqueue(&ws->free_nodes, work);
+        atomic_fetch_add_explicit(&ws->rejected, 1, memory_order_relaxed);
+        return -1;
+    }
+    atomic_fetch_add(&ws->pending, 1);
+    atomic_fetch_add_explicit(&ws->dispatched, 1, memory_order_relaxed);
+    // wake a parked worker only if there is one
+    if (atomic_load(&ws->sleepers) > 0)
+    {
+        pthread_mutex_lock(&(ws->park_lock));
+        pthread_cond_signal(&(ws->park_cond));
+        pthread_mutex_unlock(&(ws->park_lock));
+    }
+    return 0;
+}
+
+static void ws_free(struct ws_pool_st *ws)
+{
+    for (int i = 0; i < ws->nworkers; i++)
+        ws_deque_destroy(&ws->workers[i].deque);
+    mpmc_destroy(&ws->free_nodes);
+    mpmc_destroy(&ws->inject);
+    pthread_cond_destroy(&(ws->park_cond));
+    pthread_mutex_destroy(&(ws->park_lock));
+    free(ws->workers);
+    free(ws->nodes);
+    free(ws);
+}
+
+static int ws_init(threadpool *t, int capacity)
+{
+    struct ws_pool_st *ws = (struct ws_pool_st *)aligned_alloc(CACHE_LINE, (sizeof(struct ws_pool_st) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    if (!ws)
+        return -1;
+    memset(ws, 0, sizeof(struct ws_pool_st));
+    ws->owner = t;
+    ws->nworkers = t->num_threads;
+    ws->workers = (ws_worker *)calloc(ws->nworkers, sizeof(ws_worker));
+    ws->nodes = (work_t *)calloc(capacity, sizeof(work_t));
+    int failed = !ws->workers || !ws->nodes || mpmc_init(&ws->free_nodes, capacity) || mpmc_init(&ws->inject, capacity);
+    pthread_mutex_init(&(ws->park_lock), NULL);
+    pthread_cond_init(&(ws->park_cond), NULL);
+    for (int i = 0; !failed && i < ws->nworkers; i++)
+    {
+        ws->workers[i].pool = ws;
+        ws->workers[i].id = i;
+        ws->workers[i].seed = i * 7919 + 1;
+        failed = ws_deque_init(&ws->workers[i].deque, capacity < WS_DEQUE_CAPACITY ? capacity : WS_DEQUE_CAPACITY);
+    }
+    if (failed)
+    {
+        ws_free(ws);
+        return -1;
+    }
+    // the ring was sized for the slab, every node fits
+    for (int i = 0; i < capacity; i++)
+        mpmc_enqueue(&ws->free_nodes, &ws->nodes[i]);
+    t->ws = ws;
+    for (int i = 0; i < ws->nworkers; i++)
+    {
+        if (start_thread(t, &(t->threads[i]), ws_do_work, &ws->workers[i]))
+        {
+            perror("ERROR: THREAD_CREATE_FAILED");
+            // stop the workers already running
+            t->num_threads = i;
+            ws_destroy(t);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void ws_destroy(threadpool *t)
+{
+    struct ws_pool_st *ws = t->ws;
+    atomic_store(&ws->closed, 1);
+    // let the queued jobs run before stopping the workers
+    while (atomic_load(&ws->pending) > 0)
+        usleep(1000);
+    pthread_mutex_lock(&(ws->park_lock));
+    atomic_store(&ws->stop, 1);
+    pthread_cond_broadcast(&(ws->park_cond));
+    pthread_mutex_unlock(&(ws->park_lock));
+    for (int i = 0; i < t->num_threads; i++)
+        pthread_join(t->threads[i], NULL);
+    ws_free(ws);
+    t->ws = NULL;
+}
@@ -1,3 +1,6 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
 #include <pthread.h>
 
 /**
@@ -10,13 +13,27 @@
 // maximum number of threads allowed in a pool
 #define MAXT_IN_POOL 200
 
+// pool implementations
+#define THREADPOOL_MUTEX 0		   //one queue under qlock
+#define THREADPOOL_WORK_STEALING 1 //lock-free deque per worker with work stealing
+
+// default number of queued jobs a work-stealing pool holds
+#define WS_QUEUE_CAPACITY 65536
+
+// elastic (mutex) pools: default seconds an idle thread above the minimum waits before it exits
+#define POOL_IDLE_TIMEOUT 30
+// elastic (mutex) pools: default ms between two growth decisions
+#define POOL_GROW_INTERVAL 100
+
 /**
  * the pool holds a queue of this structure
  */
 typedef struct work_st
 {
 	int (*routine)(void *); //the threads process function
+	int (*expired)(void *); //run instead of routine once the job waited past the pool's max_wait, NULL - never
 	void *arg;				//argument to the function
+	unsigned long enqueued; //monotonic ns when dispatched (0 without stats and max_wait), for the queue wait
 	struct work_st *next;
 } work_t;
 
@@ -27,16 +44,89 @@ typedef struct _threadpool_st
 {
 	int num_threads;			//number of active threads
 	int qsize;					//number in the queue
-	pthread_t *threads;			//pointer to threads
+	pthread_t *threads;			//pointer to threads, room for max_threads
 	work_t *qhead;				//queue head pointer
 	work_t *qtail;				//queue tail pointer
 	pthread_mutex_t qlock;		//lock on the queue list
 	pthread_cond_t q_not_empty; //non empty and empty condidtion vairiables
 	pthread_cond_t q_empty;
 	int shutdown;	 //1 if the pool is in distruction process
-	int dont_accept; //1 if destroy function has begun
+	int dont_accept; //1 if destroy function has begun (mutex mode, stealing pools keep an atomic flag)
+	int mode;		 //THREADPOOL_MUTEX or THREADPOOL_WORK_STEALING
+	struct ws_pool_st *ws; //work-stealing state, NULL in mutex mode
+	unsigned long dispatched;	  //jobs taken into the queue (mutex mode)
+	unsigned long parks;		  //times a thread waited for work (mutex mode)
+	unsigned long lock_contended; //times qlock was found taken (mutex mode)
+	size_t stack_size;			  //bytes of stack per thread, 0 - system default
+	int cpu;					  //cpu the threads are pinned to, -1 - not pinned
+	int idle;					  //threads waiting for work (mutex mode)
+	int wakeups;				  //idle threads signalled that did not wake up yet, at most idle
+	int max_queue;				  //dispatch_bounded refuses jobs beyond this many waiting (queued and not taken by an idle thread), 0 - unbounded
+	unsigned long max_wait;		  //ns a bounded job may wait in the queue, 0 - no deadline
+	unsigned long rejected;		  //jobs refused by dispatch_bounded (mutex mode)
+	unsigned long expired;		  //jobs that ran their expired routine (mutex mode)
+	// elastic sizing (mutex mode), all under qlock
+	int min_threads;			  //threads kept however idle the pool is
+	int max_threads;			  //threads the pool may grow to, min_threads - fixed size
+	unsigned long idle_timeout;	  //ns an idle thread above min_threads waits before it exits
+	unsigned long grow_interval;  //ns between two growth decisions
+	unsigned long window_start;	  //start of the current growth window
+	unsigned long last_change;	  //last time the number of busy threads changed
+	unsigned long busy_time;	  //busy threads integrated over the window, thread-ns
+	pthread_t *retired;			  //threads that exited on their idle timeout, not joined yet
+	int nretired;
+	unsigned long grows;		  //threads started by the pool itself
+	unsigned long shrinks;		  //threads exited on their idle timeout
+	// bulk lane (mutex mode), all under qlock: long jobs wait here and run while no job above waits
+	work_t *bulk_head;
+	work_t *bulk_tail;
+	int bulk_qsize;				  //jobs in the bulk lane
+	int bulk_running;			  //threads running a bulk job
+	int reserved;				  //threads kept for the jobs above: at most num_threads - reserved run bulk jobs
+	unsigned long bulk_dispatched; //jobs taken into the bulk lane
 } threadpool;
 
+/**
+ * settings of a new pool
+ */
+typedef struct threadpool_attr_st
+{
+	int num_threads;	//threads in the pool
+	int mode;			//THREADPOOL_MUTEX or THREADPOOL_WORK_STEALING
+	int queue_capacity; //work-stealing: max queued jobs
+	size_t stack_size;	//bytes of stack per thread, 0 - system default
+	int cpu;			//cpu the threads are pinned to, -1 - not pinned
+	int max_queue;		//dispatch_bounded: max queued jobs, 0 - unbounded
+	int max_wait_ms;	//dispatch_bounded: max queue wait of a job, 0 - no deadline
+	int max_threads;	//mutex: grow up to this many threads, num_threads (the minimum) - fixed size
+	int idle_timeout;	//mutex elastic: seconds an idle thread above num_threads waits before it exits
+	int grow_interval;	//mutex elastic: ms between growth decisions, at most one thread is added each
+	int reserved;		//mutex: threads that never run bulk jobs (at least one thread always may)
+} threadpool_attr;
+
+/**
+ * counters to compare the pool implementations
+ */
+typedef struct threadpool_stats_st
+{
+	int threads;				  //threads running now
+	int queued;					  //jobs waiting in the queue(s)
+	int idle;					  //threads parked waiting for work
+	unsigned long dispatched;	  //jobs accepted
+	unsigned long parks;		  //times a thread went to sleep waiting for work
+	unsigned long lock_contended; //mutex: times qlock was found taken
+	unsigned long steals;		  //work-stealing: jobs taken from another worker
+	unsigned long steal_aborts;	  //work-stealing: steals lost to a concurrent take
+	unsigned long full_waits;	  //work-stealing: dispatches that waited for a free slot
+	unsigned long rejected;		  //jobs refused by dispatch_bounded, the queue was full
+	unsigned long expired;		  //jobs past their queue deadline, run as expired
+	unsigned long grows;		  //elastic: threads added while the queue stayed busy
+	unsigned long shrinks;		  //elastic: threads exited after their idle timeout
+	int bulk_queued;			  //mutex: jobs waiting in the bulk lane
+	int bulk_running;			  //mutex: threads running a bulk job
+	unsigned long bulk_dispatched; //mutex: jobs accepted into the bulk lane
+} threadpool_stats;
+
 // "dispatch_fn" declares a typed function pointer.  A
 // variable of type "dispatch_fn" points to a function
 // with the following signature:
@@ -57,6 +147,29 @@ typedef int (*dispatch_fn)(void *);
  */
 threadpool *create_threadpool(int num_threads_in_pool);
 
+/**
+ * threadpool_attr_init fills attr with the defaults of a mutex pool of num_threads threads
+ */
+void threadpool_attr_init(threadpool_attr *attr, int num_threads);
+
+/**
+ * create_threadpool_attr creates a pool with the settings in attr.
+ * both modes are used through the same dispatch and destroy_threadpool.
+ * a work-stealing pool keeps jobs in per-worker bounded deques, recycles
+ * job nodes instead of allocating them and idles by spinning then parking.
+ * a mutex pool with max_threads above num_threads is elastic: every
+ * grow_interval it adds a thread if jobs are queued, no thread is idle and
+ * the threads were busy (running or blocked in jobs) for 90% of the
+ * interval. a thread idle for idle_timeout exits while more than
+ * num_threads run. work-stealing pools keep num_threads.
+ */
+threadpool *create_threadpool_attr(const threadpool_attr *attr);
+
+/**
+ * threadpool_get_stats copies the pool counters into stats
+ */
+void threadpool_get_stats(threadpool *pool, threadpool_stats *stats);
+
 /**
  * dispatch enter a "job" of type work_t into the queue.
  * when an available thread takes a job from the queue, it will
@@ -67,8 +180,43 @@ threadpool *create_threadpool(int num_threads_in_pool);
  * 3. add the work_t element to the queue
  * 4. unlock mutex
  *
+ * both modes refuse jobs once destroy_threadpool began: the job is
+ * dropped with an error message and -1 is returned. returns 0 if queued.
  */
-void dispatch(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg);
+int dispatch(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg);
+
+/**
+ * dispatch_bounded enters a job under the pool's admission control.
+ * returns -1 without queueing the job when max_queue jobs are already
+ * waiting (or the pool no longer accepts jobs), the caller then answers
+ * the job itself. a job dequeued after waiting more than max_wait runs
+ * expired(arg) instead of dispatch_to_here(arg). returns 0 if queued.
+ */
+int dispatch_bounded(threadpool *from_me, dispatch_fn dispatch_to_here, dispatch_fn expired, void *arg);
+
+/**
+ * dispatch_batch enters n jobs dispatch_to_here(args[i]) under the pool's admission
+ * control like dispatch_bounded, taking the queue lock once and waking only as many
+ * idle threads as jobs were queued. the jobs are queued in order, returns how many
+ * were (args[0] to args[count - 1]), the caller answers the others itself.
+ */
+int dispatch_batch(threadpool *from_me, dispatch_fn dispatch_to_here, dispatch_fn expired, void **args, int n);
+
+/**
+ * dispatch_bulk enters a long job (or a slice of one that dispatches its next slice)
+ * into the bulk lane of a mutex pool. a thread takes bulk jobs only while the regular
+ * lane is empty, and at most num_threads - reserved threads run them at once, so short
+ * jobs never wait behind them. returns -1 without queueing the job if the pool no longer
+ * accepts jobs or has no bulk lane (work-stealing pools), the caller then runs it
+ * itself. returns 0 if queued.
+ */
+int dispatch_bulk(threadpool *from_me, dispatch_fn dispatch_to_here, void *arg);
+
+/**
+ * threadpool_current returns the pool the calling thread works for,
+ * NULL if it is not a pool thread. jobs use it to queue their follow-up jobs.
+ */
+threadpool *threadpool_current(void);
 
 /**
  * The work function of the thread
@@ -88,3 +236,5 @@ void *do_work(void *p);
  * frees all the memory associated with the threadpool.
  */
 void destroy_threadpool(threadpool *destroyme);
+
+#endif
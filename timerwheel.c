@@ -0,0 +1,126 @@
+#include "timerwheel.h"
+#include <time.h>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+unsigned long wheel_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / WHEEL_TICK_MS;
+}
+
+static void list_init(wheel_timer *head)
+{
+    head->prev = head;
+    head->next = head;
+}
+
+void wheel_init(timer_wheel *w)
+{
+    w->now = wheel_now();
+    w->count = 0;
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+        for (int i = 0; i < WHEEL_SLOTS; i++)
+            list_init(&w->slots[l][i]);
+}
+
+// put an unarmed timer in the slot of its expiry: the lowest level whose range covers it
+static void place(timer_wheel *w, wheel_timer *t)
+{
+    unsigned long delta = t->expires > w->now ? t->expires - w->now : 0;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1)))
+        level++;
+    // past the top level range: wait in the farthest slot, it moves down when reached
+    unsigned long max = (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    if (delta > max)
+        t->expires = w->now + max;
+    wheel_timer *head = &w->slots[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void unlink_timer(wheel_timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    t->next = NULL;
+}
+
+void wheel_arm(timer_wheel *w, wheel_timer *t, unsigned long ms)
+{
+    if (t->prev)
+        unlink_timer(t);
+    else if (w->count++ == 0)
+        // an empty wheel is not advanced while its engine sleeps, its tick may be stale
+        w->now = wheel_now();
+    // at least one tick, a timer never fires in the tick it was armed in
+    unsigned long ticks = (ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    t->expires = w->now + (ticks ? ticks : 1);
+    place(w, t);
+}
+
+void wheel_cancel(timer_wheel *w, wheel_timer *t)
+{
+    if (!t->prev)
+        return;
+    unlink_timer(t);
+    w->count--;
+}
+
+// move the timers of a higher level slot down to the levels below
+static void cascade(timer_wheel *w, int level, int index)
+{
+    wheel_timer *head = &w->slots[level][index];
+    wheel_timer list;
+    if (head->next == head)
+        return;
+    // detach the slot first, placing may put a timer back into it
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+    while (list.next != &list)
+    {
+        wheel_timer *t = list.next;
+        unlink_timer(t);
+        place(w, t);
+    }
+}
+
+void wheel_advance(timer_wheel *w, timer_fn expired, void *arg)
+{
+    unsigned long now = wheel_now();
+    if (w->count == 0)
+    {
+        w->now = now;
+        return;
+    }
+    while (w->now < now)
+    {
+        w->now++;
+        int index = w->now & WHEEL_MASK;
+        // a full turn of a level: its next slot at the level above comes due
+        for (int level = 1; level < WHEEL_LEVELS && index == 0; level++)
+        {
+            index = (w->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            cascade(w, level, index);
+        }
+        wheel_timer *head = &w->slots[0][w->now & WHEEL_MASK];
+        while (head->next != head)
+        {
+            wheel_timer *t = head->next;
+            unlink_timer(t);
+            // counted until the callback returned: re-arming the last timer must not reset the tick being caught up
+            expired(t, arg);
+            w->count--;
+        }
+        if (w->count == 0)
+            w->now = now;
+    }
+}
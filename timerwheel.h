@@ -0,0 +1,68 @@
+/**
+ * timerwheel.h
+ *
+ * This file declares the hierarchical timer wheel the event-driven engines
+ * keep connection deadlines in. timers live in doubly linked slot lists,
+ * so arming, re-arming and cancelling are O(1). the first level has a slot
+ * per tick, every higher level a slot per 64 slots of the level below;
+ * timers move down a level when the wheel reaches their slot, so every
+ * timer is touched at most once per level and a tick costs O(1) amortized.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+// resolution of the wheel
+#define WHEEL_TICK_MS 100
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+/**
+ * a timer, embedded in the object it times. unarmed while prev is NULL
+ */
+typedef struct wheel_timer_st
+{
+	struct wheel_timer_st *prev;
+	struct wheel_timer_st *next;
+	unsigned long expires; //tick the timer fires at
+} wheel_timer;
+
+typedef struct timer_wheel_st
+{
+	unsigned long now;								  //last tick the wheel was advanced to
+	long count;										  //armed timers
+	wheel_timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; //list heads
+} timer_wheel;
+
+// called for every expired timer, the timer is already unarmed
+typedef void (*timer_fn)(wheel_timer *t, void *arg);
+
+/**
+ * wheel_now returns the current tick of the monotonic clock
+ */
+unsigned long wheel_now(void);
+
+/**
+ * wheel_init starts an empty wheel at the current tick
+ */
+void wheel_init(timer_wheel *w);
+
+/**
+ * wheel_arm (re)arms t to fire ms milliseconds after the wheel's current tick
+ */
+void wheel_arm(timer_wheel *w, wheel_timer *t, unsigned long ms);
+
+/**
+ * wheel_cancel unarms t, nothing happens if it is not armed
+ */
+void wheel_cancel(timer_wheel *w, wheel_timer *t);
+
+/**
+ * wheel_advance moves the wheel to the current tick and calls expired for
+ * every timer that came due. expired may arm and cancel timers.
+ */
+void wheel_advance(timer_wheel *w, timer_fn expired, void *arg);
+
+#endif
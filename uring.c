@@ -0,0 +1,845 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "stats.h"
+#include "sockopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#define URING_ENTRIES 1024
+#define URING_MAX_FIXED 65536
+// a closing connection whose operations did not complete by then gets its socket shut down
+#define URING_CLOSE_GRACE_MS 1000
+
+// user_data of a submission: the object it is about with one of these tags in the low bits
+#define TAG_IGNORE 0 //completion needs no handling (fixed file updates, closes, cancels)
+#define TAG_ACCEPT 1
+#define TAG_RECV 2
+#define TAG_SEND 3
+#define TAG_POLL 4
+#define TAG_NOTIFY 5
+#define TAG_TICK 6
+#define TAG_CANCEL 7 //cancel of a closing connection's operations, counted in its inflight
+#define TAG_MASK 7
+
+// io_uring operations the engine relies on
+static const int required_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_SENDMSG,
+    IORING_OP_POLL_ADD, IORING_OP_CLOSE, IORING_OP_FILES_UPDATE, IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT,
+    // not used, added in the same release as multishot accept
+    IORING_OP_SOCKET};
+
+// removes a socket from the fixed file table
+static const int no_file = -1;
+
+static int ring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static time_t monotonic_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+int uring_supported(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = ring_setup(4, &p);
+    if (fd < 0)
+        return 0;
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    int supported = probe && ring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < sizeof(required_ops) / sizeof(required_ops[0]); i++)
+        supported = required_ops[i] <= probe->last_op && (probe->ops[required_ops[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    close(fd);
+    return supported && (p.features & IORING_FEAT_SINGLE_MMAP) && (p.features & IORING_FEAT_NODROP);
+}
+
+// pass the prepared submissions to the kernel, wait - completions to wait for
+static int ring_enter(uring_engine *e, unsigned wait)
+{
+    __atomic_store_n(e->sq_tail, e->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned pending = e->sq_local_tail - __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE);
+    return (int)syscall(__NR_io_uring_enter, e->ring_fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// make room for n submissions (a linked chain must go in one enter), flushing the ring if it is full
+static int sq_reserve(uring_engine *e, unsigned n)
+{
+    if (e->sq_local_tail - __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE) + n <= e->sq_entries)
+        return 0;
+    while (ring_enter(e, 0) < 0 && errno == EINTR)
+        ;
+    if (e->sq_local_tail - __atomic_load_n(e->sq_head, __ATOMIC_ACQUIRE) + n <= e->sq_entries)
+        return 0;
+    perror("ERROR: io_uring submission queue full");
+    return -1;
+}
+
+// next submission entry, room must have been reserved
+static struct io_uring_sqe *sq_next(uring_engine *e, int opcode, int fd, void *ptr, int tag)
+{
+    unsigned idx = e->sq_local_tail & e->sq_mask;
+    struct io_uring_sqe *sqe = &e->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uintptr_t)ptr | tag;
+    e->sq_array[idx] = idx;
+    e->sq_local_tail++;
+    e->outstanding++;
+    return sqe;
+}
+
+// submission on the connection socket, through the fixed file table when it is there
+static struct io_uring_sqe *conn_sqe(uring_engine *e, connection_t *conn, int opcode, int tag)
+{
+    struct io_uring_sqe *sqe = sq_next(e, opcode, conn->fd, conn, tag);
+    if (conn->fixed)
+        sqe->flags |= IOSQE_FIXED_FILE;
+    conn->inflight++;
+    return sqe;
+}
+
+// pool side: give a connection with its response queued back to the engine
+static void hand_back(uring_engine *e, connection_t *conn)
+{
+    pthread_mutex_lock(&(e->done_lock));
+    conn->done_next = e->done_head;
+    e->done_head = conn;
+    pthread_mutex_unlock(&(e->done_lock));
+    uint64_t one = 1;
+    if (write(e->notify_fd, &one, sizeof(one)) != sizeof(one))
+        perror("ERROR: notify io_uring engine failed");
+}
+
+// pool side: build the response then hand the connection back to the engine
+static int uring_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    uring_engine *e = (uring_engine *)conn->owner;
+    e->handler(conn);
+    hand_back(e, conn);
+    return 0;
+}
+
+// pool side: render the next piece of a generated response (a listing chunk) then hand the
+// connection back, the ring only sends bytes that are ready
+static int uring_generate_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    uring_engine *e = (uring_engine *)conn->owner;
+    if (outq_generate(&conn->out) < 0)
+        conn->closing = 1;
+    hand_back(e, conn);
+    return 0;
+}
+
+// pool side: the request waited too long in the queue, answer it without doing its work
+static int uring_shed_job(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    uring_engine *e = (uring_engine *)conn->owner;
+    e->shed(conn);
+    hand_back(e, conn);
+    return 0;
+}
+
+// same rule as the reactor: the headers ended, were found malformed, or the buffer is full
+static int request_complete(connection_t *conn)
+{
+    if (conn->rlen == REQ_MAX_SIZE)
+        return 1;
+    unsigned long start = stats_now();
+    int parsed = http_parse(&conn->parser, conn->rbuf, conn->rlen);
+    stats_latency(STAT_PARSE, start);
+    return parsed != HTTP_PARSE_MORE;
+}
+
+// the socket leaves the fixed table and is closed by the ring, the object goes back to the pool
+static void conn_release(uring_engine *e, connection_t *conn)
+{
+    if (sq_reserve(e, 2) < 0)
+    {
+        if (close(conn->fd) < 0)
+            perror("ERROR: close socket failed");
+    }
+    else
+    {
+        if (conn->fixed)
+        {
+            // hard link: the close must run even if the slot was never filled
+            struct io_uring_sqe *sqe = sq_next(e, IORING_OP_FILES_UPDATE, -1, NULL, TAG_IGNORE);
+            sqe->addr = (uintptr_t)&no_file;
+            sqe->len = 1;
+            sqe->off = conn->fd;
+            sqe->flags |= IOSQE_IO_HARDLINK;
+        }
+        sq_next(e, IORING_OP_CLOSE, conn->fd, NULL, TAG_IGNORE);
+    }
+    conn->fd = -1;
+    wheel_cancel(&e->wheel, &conn->timer);
+    stats_conn_closed();
+    outq_clear(&conn->out);
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        e->conns = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    e->live--;
+    connpool_put(e->cpool, conn);
+}
+
+static void conn_close(uring_engine *e, connection_t *conn)
+{
+    if (conn->inflight == 0)
+    {
+        conn_release(e, conn);
+        return;
+    }
+    // the ring still uses the object, cancel its operations and release it on their completion
+    if (conn->closing)
+        return;
+    conn->closing = 1;
+    // the state's deadline is replaced by one that reaps the connection whatever the cancel does
+    wheel_arm(&e->wheel, &conn->timer, URING_CLOSE_GRACE_MS);
+    if (sq_reserve(e, 1) < 0)
+    {
+        // no room to cancel, shutting the socket down completes them as well
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    // its completion comes back to the connection: a failed cancel must not leave it waiting
+    struct io_uring_sqe *sqe = sq_next(e, IORING_OP_ASYNC_CANCEL, conn->fd, conn, TAG_CANCEL);
+    conn->inflight++;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    if (conn->fixed)
+        sqe->cancel_flags |= IORING_ASYNC_CANCEL_FD_FIXED;
+}
+
+// read the next bytes of the request, into the registered slab when the object lives there.
+// first - the socket was just accepted and is put in the fixed table before the read
+static int arm_recv(uring_engine *e, connection_t *conn, int first)
+{
+    if (sq_reserve(e, 2) < 0)
+        return -1;
+    if (first && conn->fixed)
+    {
+        // the read is linked to the update, it starts once the slot holds the socket
+        struct io_uring_sqe *sqe = sq_next(e, IORING_OP_FILES_UPDATE, -1, NULL, TAG_IGNORE);
+        sqe->addr = (uintptr_t)&conn->fd;
+        sqe->len = 1;
+        sqe->off = conn->fd;
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    int registered = e->fixed_buffers && conn->pooled;
+    struct io_uring_sqe *sqe = conn_sqe(e, conn, registered ? IORING_OP_READ_FIXED : IORING_OP_RECV, TAG_RECV);
+    sqe->addr = (uintptr_t)&conn->rbuf[conn->rlen];
+    sqe->len = REQ_MAX_SIZE - conn->rlen;
+    if (registered)
+    {
+        sqe->off = (__u64)-1;
+        sqe->buf_index = 0;
+    }
+    return 0;
+}
+
+// wait until the socket is ready for events (a full send buffer, or a read the kernel would not queue)
+static int arm_poll(uring_engine *e, connection_t *conn, unsigned events)
+{
+    if (sq_reserve(e, 1) < 0)
+        return -1;
+    struct io_uring_sqe *sqe = conn_sqe(e, conn, IORING_OP_POLL_ADD, TAG_POLL);
+    sqe->poll32_events = events;
+    return 0;
+}
+
+static void conn_write(uring_engine *e, connection_t *conn);
+
+// arm the deadline of the state the connection is in, same rules as the reactor
+static void conn_deadline(uring_engine *e, connection_t *conn)
+{
+    int seconds = 0;
+    if (conn->state == CONN_READING)
+        seconds = conn->rlen == 0 && conn->requests > 0 ? e->idle_timeout : e->header_timeout;
+    else if (conn->state == CONN_WRITING)
+    {
+        seconds = e->send_timeout;
+        conn->window_sent = conn->out.sent;
+    }
+    if (seconds)
+        wheel_arm(&e->wheel, &conn->timer, seconds * 1000UL);
+    else
+        wheel_cancel(&e->wheel, &conn->timer);
+}
+
+// a deadline passed: close the connection, unless a sending client took enough in its window
+static void conn_expired(wheel_timer *t, void *arg)
+{
+    uring_engine *e = (uring_engine *)arg;
+    connection_t *conn = (connection_t *)((char *)t - offsetof(connection_t, timer));
+    if (conn->closing)
+    {
+        // its operations are still armed: complete them until the connection can be released
+        shutdown(conn->fd, SHUT_RDWR);
+        wheel_arm(&e->wheel, &conn->timer, URING_CLOSE_GRACE_MS);
+        return;
+    }
+    if (conn->state == CONN_WRITING)
+    {
+        unsigned long taken = conn->out.sent - conn->window_sent;
+        if (taken > 0 && taken >= e->send_min_bytes)
+        {
+            conn_deadline(e, conn);
+            return;
+        }
+        stats_timeout(STAT_TIMEOUT_SEND);
+    }
+    else
+        stats_timeout(conn->rlen == 0 && conn->requests > 0 ? STAT_TIMEOUT_IDLE : STAT_TIMEOUT_HEADER);
+    conn_close(e, conn);
+}
+
+// hand a complete request to the pool
+static void conn_dispatch(uring_engine *e, connection_t *conn)
+{
+    conn->state = CONN_PROCESSING;
+    wheel_cancel(&e->wheel, &conn->timer);
+    if (!e->shed)
+    {
+        if (dispatch(e->pool, uring_job, conn) < 0)
+            conn_close(e, conn);
+    }
+    else if (dispatch_bounded(e->pool, uring_job, uring_shed_job, conn) < 0)
+    {
+        // the pool is full, the shed response is written right away
+        e->shed(conn);
+        conn->send_start = stats_now();
+        conn_write(e, conn);
+    }
+}
+
+// wait for the next request, or serve one already buffered (pipelined)
+static void conn_next_request(uring_engine *e, connection_t *conn)
+{
+    conn->state = CONN_READING;
+    conn_deadline(e, conn);
+    if (conn->rlen > 0 && request_complete(conn))
+        conn_dispatch(e, conn);
+    else if (arm_recv(e, conn, 0) < 0)
+        conn_close(e, conn);
+}
+
+static void conn_write(uring_engine *e, connection_t *conn)
+{
+    conn->last_active = monotonic_now();
+    // a new response starts its first send window
+    if (conn->state != CONN_WRITING)
+    {
+        conn->state = CONN_WRITING;
+        conn_deadline(e, conn);
+        // with TCP_CORK coalescing the cork is held until outq_flush sees the response written
+        outq_cork(&conn->out, conn->fd);
+    }
+    int more;
+    int n = outq_iov(&conn->out, conn->send_iov, URING_MAX_IOV, &more);
+    if (n > 0)
+    {
+        // memory segments go through the ring, only one send is in flight so the connection's message is reused
+        if (sq_reserve(e, 1) < 0)
+        {
+            conn_close(e, conn);
+            return;
+        }
+        struct msghdr *msg = &conn->send_msg;
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_iov = conn->send_iov;
+        msg->msg_iovlen = n;
+        outq_stream_end(&conn->out, n, conn->fd);
+        struct io_uring_sqe *sqe = conn_sqe(e, conn, IORING_OP_SENDMSG, TAG_SEND);
+        sqe->addr = (uintptr_t)msg;
+        // headers followed by a file body are held back to leave in one packet with the first body bytes
+        sqe->msg_flags = MSG_NOSIGNAL | (more ? sockopt_more_flag() : 0);
+        return;
+    }
+    // a file body, a piece to generate (or nothing) at the head: sendfile on the non-blocking socket, the ring waits for room
+    unsigned long sent = conn->out.sent;
+    int flushed = outq_flush(&conn->out, conn->fd);
+    stats_bytes(conn->out.sent - sent);
+    switch (flushed)
+    {
+    case OUTQ_AGAIN:
+        if (arm_poll(e, conn, POLLOUT) < 0)
+            conn_close(e, conn);
+        break;
+    case OUTQ_GENERATE:
+        // nothing is in flight for the connection until the job hands it back
+        conn->state = CONN_GENERATING;
+        conn_deadline(e, conn);
+        if (dispatch(e->pool, uring_generate_job, conn) < 0)
+            conn_close(e, conn);
+        break;
+    case OUTQ_DONE:
+        // everything queued was written, the request scratch can go
+        stats_latency(STAT_SEND, conn->send_start);
+        arena_reset(&conn->arena);
+        if (!conn->keep_alive || conn->peer_closed)
+            conn_close(e, conn);
+        else
+            conn_next_request(e, conn);
+        break;
+    case OUTQ_ERROR:
+        conn_close(e, conn);
+        break;
+    }
+}
+
+static void conn_received(uring_engine *e, connection_t *conn, int res)
+{
+    if (res == -EAGAIN)
+    {
+        // older kernels give a non-blocking socket back instead of waiting on it
+        if (arm_poll(e, conn, POLLIN | POLLRDHUP) < 0)
+            conn_close(e, conn);
+        return;
+    }
+    if (res < 0)
+    {
+        errno = -res;
+        if (res != -ECONNRESET && res != -ECANCELED)
+            perror("ERROR: read failure");
+        conn_close(e, conn);
+        return;
+    }
+    int was_empty = conn->rlen == 0;
+    if (res == 0)
+        conn->peer_closed = 1;
+    else
+    {
+        conn->last_active = monotonic_now();
+        conn->rlen += res;
+        conn->rbuf[conn->rlen] = '\0';
+    }
+    if (conn->rlen > 0 && (request_complete(conn) || conn->peer_closed))
+        conn_dispatch(e, conn);
+    else if (conn->peer_closed || arm_recv(e, conn, 0) < 0)
+        conn_close(e, conn);
+    else if (was_empty)
+        // the first bytes of a request start its header deadline
+        conn_deadline(e, conn);
+}
+
+static void conn_sent(uring_engine *e, connection_t *conn, int res)
+{
+    if (res < 0)
+    {
+        errno = -res;
+        if (res != -EPIPE && res != -ECONNRESET && res != -ECANCELED)
+            perror("ERROR: write response to fd failed");
+        conn_close(e, conn);
+        return;
+    }
+    outq_advance(&conn->out, res);
+    stats_bytes(res);
+    conn_write(e, conn);
+}
+
+static void conn_complete(uring_engine *e, connection_t *conn, int tag, int res)
+{
+    conn->inflight--;
+    if (conn->closing)
+    {
+        // the cancel failed (IORING_ASYNC_CANCEL_FD_FIXED needs linux 6.0) or found nothing
+        // yet, shutting the socket down completes what is still armed
+        if (tag == TAG_CANCEL && res < 0 && conn->inflight > 0)
+            shutdown(conn->fd, SHUT_RDWR);
+        if (conn->inflight == 0)
+            conn_release(e, conn);
+        return;
+    }
+    switch (tag)
+    {
+    case TAG_RECV:
+        conn_received(e, conn, res);
+        break;
+    case TAG_SEND:
+        conn_sent(e, conn, res);
+        break;
+    case TAG_POLL:
+        if (res < 0)
+            conn_close(e, conn);
+        else if (conn->state == CONN_WRITING)
+            conn_write(e, conn);
+        else if (arm_recv(e, conn, 0) < 0)
+            conn_close(e, conn);
+        break;
+    }
+}
+
+static int arm_accept(uring_engine *e)
+{
+    if (sq_reserve(e, 1) < 0)
+        return -1;
+    // one submission keeps accepting until it is cancelled or fails
+    struct io_uring_sqe *sqe = sq_next(e, IORING_OP_ACCEPT, e->listen_fd, e, TAG_ACCEPT);
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    e->accepting = 1;
+    return 0;
+}
+
+static void stop_listening(uring_engine *e)
+{
+    e->listen_fd = -1;
+    if (e->accepting && sq_reserve(e, 1) == 0)
+        sq_next(e, IORING_OP_ASYNC_CANCEL, -1, NULL, TAG_IGNORE)->addr = (uintptr_t)e | TAG_ACCEPT;
+}
+
+static void accepted(uring_engine *e, int fd)
+{
+    // the multishot accept does not ask first, a connection past the budget is turned away
+    if (e->listen_fd < 0 || atomic_fetch_sub(e->accept_left, 1) <= 0)
+    {
+        if (e->listen_fd >= 0)
+        {
+            atomic_fetch_add(e->accept_left, 1);
+            stop_listening(e);
+        }
+        close(fd);
+        return;
+    }
+    connection_t *conn = connpool_get(e->cpool, fd);
+    if (!conn)
+    {
+        close(fd);
+        return;
+    }
+    conn->state = CONN_READING;
+    conn->accepted_at = monotonic_now();
+    conn->last_active = conn->accepted_at;
+    conn->owner = e;
+    sockopt_accepted(fd);
+    // the fixed table is indexed by fd, sockets past its end are used by fd
+    conn->fixed = fd < e->nfixed;
+    if (arm_recv(e, conn, 1) < 0)
+    {
+        close(fd);
+        connpool_put(e->cpool, conn);
+        return;
+    }
+    conn->next = e->conns;
+    if (e->conns)
+        e->conns->prev = conn;
+    e->conns = conn;
+    e->live++;
+    stats_conn_opened();
+    conn_deadline(e, conn);
+    // stop listening after the requested number of connections
+    if (atomic_load(e->accept_left) <= 0)
+        stop_listening(e);
+}
+
+static void arm_notify(uring_engine *e)
+{
+    if (sq_reserve(e, 1) < 0)
+        return;
+    struct io_uring_sqe *sqe = sq_next(e, IORING_OP_READ, e->notify_fd, e, TAG_NOTIFY);
+    sqe->addr = (uintptr_t)&e->notify_value;
+    sqe->len = sizeof(e->notify_value);
+}
+
+// take back connections whose response is ready and start sending it
+static void collect_done(uring_engine *e)
+{
+    pthread_mutex_lock(&(e->done_lock));
+    connection_t *conn = e->done_head;
+    e->done_head = NULL;
+    pthread_mutex_unlock(&(e->done_lock));
+    while (conn)
+    {
+        connection_t *next = conn->done_next;
+        conn->done_next = NULL;
+        if (conn->closing)
+        {
+            // the next piece could not be generated
+            conn_close(e, conn);
+        }
+        else
+        {
+            // a generated piece continues the response being sent
+            if (conn->state == CONN_PROCESSING)
+                conn->send_start = stats_now();
+            conn_write(e, conn);
+        }
+        conn = next;
+    }
+}
+
+static void arm_tick(uring_engine *e)
+{
+    if (sq_reserve(e, 1) < 0)
+        return;
+    struct io_uring_sqe *sqe = sq_next(e, IORING_OP_TIMEOUT, -1, e, TAG_TICK);
+    sqe->addr = (uintptr_t)&e->tick;
+    sqe->len = 1;
+    e->ticking = 1;
+}
+
+static void handle_cqe(uring_engine *e, uint64_t data, int res, unsigned flags)
+{
+    // a multishot submission is done once a completion comes without F_MORE
+    if (!(flags & IORING_CQE_F_MORE))
+        e->outstanding--;
+    if (e->stopping)
+        return;
+    int tag = data & TAG_MASK;
+    switch (tag)
+    {
+    case TAG_IGNORE:
+        break;
+    case TAG_ACCEPT:
+        if (!(flags & IORING_CQE_F_MORE))
+            e->accepting = 0;
+        if (res >= 0)
+            accepted(e, res);
+        else if (res != -ECANCELED && res != -ECONNABORTED && res != -EINTR)
+        {
+            errno = -res;
+            perror("error: acceppt failure");
+        }
+        if (!e->accepting && e->listen_fd >= 0)
+            arm_accept(e);
+        break;
+    case TAG_NOTIFY:
+        collect_done(e);
+        arm_notify(e);
+        break;
+    case TAG_TICK:
+        // the wheel is advanced after every batch, the timer only makes sure there is one
+        e->ticking = 0;
+        break;
+    default:
+        conn_complete(e, (connection_t *)(uintptr_t)(data & ~(uint64_t)TAG_MASK), tag, res);
+        break;
+    }
+}
+
+// handle every completion the kernel posted
+static void reap(uring_engine *e)
+{
+    unsigned head = *e->cq_head;
+    while (head != __atomic_load_n(e->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &e->cqes[head & e->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        // the slot is free for the kernel before the handler may submit more
+        head++;
+        __atomic_store_n(e->cq_head, head, __ATOMIC_RELEASE);
+        handle_cqe(e, data, res, flags);
+    }
+}
+
+// register the connection slab and a sparse fixed file table, the engine works without them
+static void register_resources(uring_engine *e)
+{
+    struct rlimit lim;
+    int nfixed = getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < URING_MAX_FIXED ? (int)lim.rlim_cur : URING_MAX_FIXED;
+    struct io_uring_rsrc_register reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = nfixed;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (ring_register(e->ring_fd, IORING_REGISTER_FILES2, &reg, sizeof(reg)) == 0)
+        e->nfixed = nfixed;
+    struct iovec slab;
+    slab.iov_base = e->cpool->slab;
+    slab.iov_len = e->cpool->stride * e->cpool->capacity;
+    e->fixed_buffers = ring_register(e->ring_fd, IORING_REGISTER_BUFFERS, &slab, 1) == 0;
+}
+
+static int map_rings(uring_engine *e, struct io_uring_params *p)
+{
+    size_t sq_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    size_t cq_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    e->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    e->ring_mem = mmap(NULL, e->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQ_RING);
+    if (e->ring_mem == MAP_FAILED)
+    {
+        e->ring_mem = NULL;
+        return -1;
+    }
+    e->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    e->sqes = (struct io_uring_sqe *)mmap(NULL, e->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd, IORING_OFF_SQES);
+    if (e->sqes == MAP_FAILED)
+    {
+        e->sqes = NULL;
+        return -1;
+    }
+    char *ring = (char *)e->ring_mem;
+    e->sq_head = (unsigned *)(ring + p->sq_off.head);
+    e->sq_tail = (unsigned *)(ring + p->sq_off.tail);
+    e->sq_array = (unsigned *)(ring + p->sq_off.array);
+    e->sq_mask = *(unsigned *)(ring + p->sq_off.ring_mask);
+    e->sq_entries = p->sq_entries;
+    e->sq_local_tail = *e->sq_tail;
+    e->cq_head = (unsigned *)(ring + p->cq_off.head);
+    e->cq_tail = (unsigned *)(ring + p->cq_off.tail);
+    e->cq_mask = *(unsigned *)(ring + p->cq_off.ring_mask);
+    e->cqes = (struct io_uring_cqe *)(ring + p->cq_off.cqes);
+    return 0;
+}
+
+uring_engine *create_uring(int listen_fd, int max_accept, int idle_timeout, threadpool *pool, request_fn handler, conn_pool *cpool)
+{
+    if (listen_fd < 0 || max_accept < 1 || idle_timeout < 0 || !pool || !handler || !cpool)
+        return NULL;
+    uring_engine *e = (uring_engine *)calloc(1, sizeof(uring_engine));
+    if (!e)
+    {
+        perror("ERROR: MEMORY_ALOC_FAILED");
+        return NULL;
+    }
+    e->listen_fd = listen_fd;
+    atomic_init(&e->own_accept_left, max_accept);
+    e->accept_left = &e->own_accept_left;
+    e->idle_timeout = idle_timeout;
+    e->pool = pool;
+    e->handler = handler;
+    e->cpool = cpool;
+    e->tick.tv_nsec = WHEEL_TICK_MS * 1000000L;
+    wheel_init(&e->wheel);
+    e->ring_fd = -1;
+    if (pthread_mutex_init(&(e->done_lock), NULL))
+    {
+        perror("ERROR: MUTEX_INIT_FAILED");
+        free(e);
+        return NULL;
+    }
+    // a blocking eventfd: the ring waits on it, reads of a non-blocking one may come back empty
+    e->notify_fd = eventfd(0, EFD_CLOEXEC);
+    // completions are delivered when the engine enters the kernel anyway, no interrupts needed
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = URING_ENTRIES * 4;
+    e->ring_fd = ring_setup(URING_ENTRIES, &p);
+    if (e->ring_fd < 0 && errno == EINVAL)
+    {
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = URING_ENTRIES * 4;
+        e->ring_fd = ring_setup(URING_ENTRIES, &p);
+    }
+    if (e->notify_fd < 0 || e->ring_fd < 0 || map_rings(e, &p) < 0)
+    {
+        perror("error: io_uring setup failure");
+        destroy_uring(e);
+        return NULL;
+    }
+    register_resources(e);
+    return e;
+}
+
+void uring_share_accepts(uring_engine *e, atomic_int *accept_left)
+{
+    e->accept_left = accept_left;
+}
+
+void uring_set_shed(uring_engine *e, request_fn shed)
+{
+    e->shed = shed;
+}
+
+void uring_set_timeouts(uring_engine *e, int header_timeout, int send_timeout, unsigned long send_min_bytes)
+{
+    e->header_timeout = header_timeout;
+    e->send_timeout = send_timeout;
+    e->send_min_bytes = send_min_bytes;
+}
+
+void uring_run(uring_engine *e)
+{
+    if (arm_accept(e) < 0)
+        return;
+    arm_notify(e);
+    while (e->listen_fd >= 0 || e->live > 0)
+    {
+        // a timer wakes the loop every tick while deadlines are armed, or to look for a budget used up by other engines
+        int shared = e->listen_fd >= 0 && e->accept_left != &e->own_accept_left;
+        if (!e->ticking && (e->wheel.count || shared))
+            arm_tick(e);
+        // one system call submits everything prepared and waits for the next completion
+        if (ring_enter(e, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("error: io_uring_enter failure");
+            return;
+        }
+        reap(e);
+        wheel_advance(&e->wheel, conn_expired, e);
+        if (e->listen_fd >= 0 && atomic_load(e->accept_left) <= 0)
+            stop_listening(e);
+    }
+}
+
+void destroy_uring(uring_engine *e)
+{
+    if (e->ring_mem && e->sqes && e->outstanding > 0)
+    {
+        // cancel what is still armed and wait for it, the kernel may write to the engine until then
+        e->stopping = 1;
+        if (sq_reserve(e, 1) == 0)
+            sq_next(e, IORING_OP_ASYNC_CANCEL, -1, NULL, TAG_IGNORE)->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        uint64_t one = 1;
+        if (write(e->notify_fd, &one, sizeof(one)) != sizeof(one))
+            perror("ERROR: notify io_uring engine failed");
+        while (e->outstanding > 0)
+        {
+            if (ring_enter(e, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                break;
+            reap(e);
+        }
+    }
+    // connections still open here were never completed
+    while (e->conns)
+    {
+        connection_t *conn = e->conns;
+        e->conns = conn->next;
+        close(conn->fd);
+        stats_conn_closed();
+        outq_clear(&conn->out);
+        connpool_put(e->cpool, conn);
+    }
+    if (e->sqes)
+        munmap(e->sqes, e->sqes_size);
+    if (e->ring_mem)
+        munmap(e->ring_mem, e->ring_size);
+    if (e->ring_fd >= 0)
+        close(e->ring_fd);
+    if (e->notify_fd >= 0)
+        close(e->notify_fd);
+    pthread_mutex_destroy(&(e->done_lock));
+    free(e);
+}
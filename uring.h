@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+#include "threadpool.h"
+#include "connpool.h"
+#include "timerwheel.h"
+
+/**
+ * uring.h
+ *
+ * This file declares the io_uring engine, a drop-in alternative to the
+ * epoll reactor. the engine thread owns every socket and drives it
+ * through one submission ring: a multishot accept, receives into the
+ * registered connection slab, sendmsg of the output queue and closes are
+ * queued as submissions and sent to the kernel together, one system call
+ * per loop. sockets are used through the ring's fixed file table.
+ * responses are built by the threadpool exactly as in the reactor.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+typedef struct _uring_engine_st
+{
+	int ring_fd;				 //io_uring instance
+	// submission ring, shared with the kernel
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_local_tail;		 //submissions prepared, published on the next enter
+	struct io_uring_sqe *sqes;	 //submission entries
+	// completion ring, shared with the kernel
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring_mem;				 //sq and cq rings (one mapping)
+	size_t ring_size;
+	size_t sqes_size;
+	long outstanding;			 //submissions whose last completion did not arrive yet
+	int stopping;				 //1 while destroy waits for the cancelled submissions
+	int nfixed;					 //size of the fixed file table, 0 - sockets are used by fd
+	int fixed_buffers;			 //1 if the connection slab is a registered buffer
+	int listen_fd;				 //welcome socket, -1 once max_accept was reached
+	int accepting;				 //1 while the multishot accept is armed
+	atomic_int *accept_left;	 //connections still allowed to be accepted, may be shared
+	atomic_int own_accept_left;	 //budget of an engine that shares it with no one
+	int notify_fd;				 //eventfd workers use to wake the engine
+	uint64_t notify_value;		 //read target of the notify fd
+	struct __kernel_timespec tick; //period of the wheel timer
+	int ticking;				 //1 while the timer is armed
+	int live;					 //number of open connections
+	int idle_timeout;			 //seconds a keep-alive connection may wait for its next request, 0 - no limit
+	int header_timeout;			 //seconds a request may take to arrive, 0 - no limit
+	int send_timeout;			 //seconds of a send window, 0 - no limit
+	unsigned long send_min_bytes; //bytes the client must take in every send window
+	timer_wheel wheel;			 //deadlines of the connections
+	threadpool *pool;			 //pool running the request handler
+	request_fn handler;			 //builds a response for a complete request
+	request_fn shed;			 //answers a request the pool has no room or time for, NULL - always queue
+	conn_pool *cpool;			 //connection objects
+	connection_t *conns;		 //list of open connections
+	pthread_mutex_t done_lock;	 //lock on the done list
+	connection_t *done_head;	 //connections returned by workers
+} uring_engine;
+
+/**
+ * uring_supported returns 1 if the running kernel has every io_uring
+ * operation the engine uses (multishot accept, 5.19 or later)
+ */
+int uring_supported(void);
+
+/**
+ * create_uring sets up a ring for the listening socket, same arguments as
+ * create_reactor. returns NULL on failure.
+ */
+uring_engine *create_uring(int listen_fd, int max_accept, int idle_timeout, threadpool *pool, request_fn handler, conn_pool *cpool);
+
+/**
+ * uring_share_accepts makes the engine take its connections from a budget
+ * shared with other engines, like reactor_share_accepts
+ */
+void uring_share_accepts(uring_engine *e, atomic_int *accept_left);
+
+/**
+ * uring_set_shed puts the engine's jobs under the pool's admission control, like reactor_set_shed
+ */
+void uring_set_shed(uring_engine *e, request_fn shed);
+
+/**
+ * uring_set_timeouts sets the connection deadlines, like reactor_set_timeouts
+ */
+void uring_set_timeouts(uring_engine *e, int header_timeout, int send_timeout, unsigned long send_min_bytes);
+
+/**
+ * uring_run runs the event loop until max_accept connections were
+ * accepted and all of them were closed.
+ */
+void uring_run(uring_engine *e);
+
+/**
+ * destroy_uring frees the engine, the listening socket is left to the caller.
+ */
+void destroy_uring(uring_engine *e);
+
+#endif